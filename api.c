@@ -1,11 +1,294 @@
 #include "esp_common.h"
-#include "api_struct.h"
+#include "api.h"
+#include "router_hash.h"
+#include "httpd_arena.h"
 
 extern char *strsep(char **stringp, const char *delim);
 
+static int ICACHE_FLASH_ATTR
+http_hex(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+/* Next byte of s[*i..end), with "%XX" and '+' decoded; a '%' not followed
+   by two hex digits is taken as it is */
+static uint8_t ICACHE_FLASH_ATTR
+http_param_byte(const char *s, uint32_t *i, uint32_t end)
+{
+	uint8_t c = (uint8_t)s[(*i)++];
+	int hi, lo;
+
+	if (c == '+')
+		return ' ';
+	if (c == '%' && *i + 2 <= end &&
+	    (hi = http_hex(s[*i])) >= 0 && (lo = http_hex(s[*i + 1])) >= 0) {
+		*i += 2;
+		return (uint8_t)(hi << 4 | lo);
+	}
+	return c;
+}
+
+/* Decode a slice of s in place; the result is never longer */
+static void ICACHE_FLASH_ATTR
+http_param_decode(char *s, HTTPSlice *sl)
+{
+	uint32_t i = sl->off, end = sl->off + sl->len;
+	uint32_t out = sl->off;
+
+	while (i < end)
+		s[out++] = (char)http_param_byte(s, &i, end);
+	sl->len = (uint16_t)(out - sl->off);
+}
+
+/* router_hash() of the decoded key, without decoding it */
+static uint32_t ICACHE_FLASH_ATTR
+http_param_hash(const char *s, const HTTPSlice *sl)
+{
+	uint32_t h = 2166136261u;
+	uint32_t i = sl->off, end = sl->off + sl->len;
+
+	while (i < end) {
+		h ^= http_param_byte(s, &i, end);
+		h *= 16777619u;
+	}
+	return h ^ (h >> 16);
+}
+
+static uint8_t * ICACHE_FLASH_ATTR
+http_params_slots(const HTTPParams *index)
+{
+	return (uint8_t *)&index->param[index->count];
+}
+
+/* Index s[0..len): one pass to count the pairs, one to slice and hash them.
+   Nothing is written to s. */
+static HTTPParams * ICACHE_FLASH_ATTR
+http_params_build(HTTPRequest *req, const char *s, uint32_t len)
+{
+	HTTPParams *index;
+	uint8_t *slots;
+	uint32_t count = 0, mask = 1, pos, n;
+
+	if (len > 0xffff)
+		len = 0xffff;
+	for (pos = 0; pos < len; pos++) {
+		if (s[pos] != '&' && (pos == 0 || s[pos - 1] == '&'))
+			count++;
+	}
+	if (count == 0)
+		return NULL;
+	if (count > HTTP_MAX_PARAMS)
+		count = HTTP_MAX_PARAMS;
+	/* at most half full, so that a probe ends soon */
+	while (mask + 1 < 2 * count)
+		mask = mask << 1 | 1;
+	index = (HTTPParams *)httpd_arena_alloc(&req->arena,
+		sizeof(HTTPParams) + (count - 1) * sizeof(HTTPParam) + mask + 1);
+	if (index == NULL)
+		return NULL;
+	index->decoded = 0;
+	index->len = (uint16_t)len;
+	index->count = (uint8_t)count;
+	index->mask = (uint8_t)mask;
+	slots = http_params_slots(index);
+	memset(slots, 0, mask + 1);
+
+	pos = 0;
+	for (n = 0; n < count; n++) {
+		HTTPParam *p = &index->param[n];
+		uint32_t end, eq, slot;
+
+		while (s[pos] == '&')
+			pos++;
+		for (end = pos; end < len && s[end] != '&'; end++)
+			;
+		for (eq = pos; eq < end && s[eq] != '='; eq++)
+			;
+		/* a key without '=' has an empty value */
+		p->key.off = (uint16_t)pos;
+		p->key.len = (uint16_t)(eq - pos);
+		p->value.off = (uint16_t)(eq < end ? eq + 1 : end);
+		p->value.len = (uint16_t)(end - p->value.off);
+		/* linear probing keeps pairs with the same key in order */
+		slot = http_param_hash(s, &p->key) & mask;
+		while (slots[slot] != 0)
+			slot = (slot + 1) & mask;
+		slots[slot] = (uint8_t)(n + 1);
+		pos = end;
+	}
+	return index;
+}
+
 /*
+	Build req->query from req->params and req->form from a buffered body,
+	called by the server before the handler runs.
+
+	@return int: 0, or -1 if there was no memory for an index
+*/
+int ICACHE_FLASH_ATTR
+http_params_index(HTTPRequest *req)
+{
+	int ret = 0;
+
+	req->query = NULL;
+	req->form = NULL;
+	if (req->params != NULL && req->params[0] != '\0') {
+		req->query = http_params_build(req, req->params, strlen(req->params));
+		if (req->query == NULL)
+			ret = -1;
+	}
+	if (req->post_data != NULL && req->post_len != 0) {
+		req->form = http_params_build(req, req->post_data, req->post_len);
+		if (req->form == NULL)
+			ret = -1;
+	}
+	return ret;
+}
+
+/*
+	@param index: an index built by http_params_index
+
+	@return uint32_t: its size in bytes, for copying it
+*/
+uint32_t ICACHE_FLASH_ATTR
+http_params_size(const HTTPParams *index)
+{
+	return sizeof(HTTPParams) + (index->count - 1) * sizeof(HTTPParam) + index->mask + 1;
+}
+
+static HTTPParams * ICACHE_FLASH_ATTR
+http_params_of(const HTTPRequest *req, int which, char **s)
+{
+	if (which == HTTP_PARAMS_FORM) {
+		*s = req->post_data;
+		return req->form;
+	}
+	*s = req->params;
+	return req->query;
+}
+
+/* Decode pair n in place, once */
+static HTTPParam * ICACHE_FLASH_ATTR
+http_param_decoded(HTTPParams *index, char *s, uint32_t n)
+{
+	HTTPParam *p = &index->param[n];
+
+	if (!(index->decoded & (1u << n))) {
+		http_param_decode(s, &p->key);
+		http_param_decode(s, &p->value);
+		index->decoded |= 1u << n;
+	}
+	return p;
+}
+
+/*
+	@param req: the request
+	@param which: HTTP_PARAMS_QUERY or HTTP_PARAMS_FORM
+
+	@return int: number of pairs indexed
+*/
+int ICACHE_FLASH_ATTR
+http_param_count(const HTTPRequest *req, int which)
+{
+	char *s;
+	HTTPParams *index = http_params_of(req, which, &s);
+
+	return index ? index->count : 0;
+}
+
+/*
+	Look up a key: one hash, and a compare for each pair in its probe
+	sequence. The pair found is decoded in place, the string it is part
+	of (req->params or req->post_data) is not meant to be read whole any
+	more after that.
+
+	@param req: the request
+	@param which: HTTP_PARAMS_QUERY or HTTP_PARAMS_FORM
+	@param key: NUL-terminated key, as decoded
+	@param len: receives the length of the value
+
+	@return char*: the first value given for key (not NUL-terminated),
+	               NULL if there is none
+*/
+const char * ICACHE_FLASH_ATTR
+http_param_get(HTTPRequest *req, int which, const char *key, uint16_t *len)
+{
+	char *s;
+	HTTPParams *index = http_params_of(req, which, &s);
+	uint32_t key_len = strlen(key);
+	uint32_t slot;
+	uint8_t *slots;
+
+	if (index == NULL)
+		return NULL;
+	slots = http_params_slots(index);
+	for (slot = router_hash(key, key_len, 0) & index->mask; slots[slot] != 0;
+	     slot = (slot + 1) & index->mask) {
+		uint32_t n = slots[slot] - 1;
+		HTTPParam *p = &index->param[n];
+
+		if (index->decoded & (1u << n)) {
+			if (p->key.len != key_len || memcmp(s + p->key.off, key, key_len) != 0)
+				continue;
+		} else {
+			/* compare as decoded, so that a miss writes nothing */
+			uint32_t i = p->key.off, end = p->key.off + p->key.len, k = 0;
+
+			while (i < end && k < key_len && http_param_byte(s, &i, end) == (uint8_t)key[k])
+				k++;
+			if (i < end || k < key_len)
+				continue;
+			p = http_param_decoded(index, s, n);
+		}
+		*len = p->value.len;
+		return s + p->value.off;
+	}
+	return NULL;
+}
+
+/*
+	Pairs in the order they appear, decoded in place like those found by
+	http_param_get.
+
+	@param req: the request
+	@param which: HTTP_PARAMS_QUERY or HTTP_PARAMS_FORM
+	@param idx: 0 .. http_param_count() - 1
+	@param key, key_len: receive the key (not NUL-terminated)
+	@param len: receives the length of the value
+
+	@return char*: the value (not NUL-terminated), NULL if there is no
+	               such pair
+*/
+const char * ICACHE_FLASH_ATTR
+http_param_at(HTTPRequest *req, int which, uint8_t idx, const char **key,
+	      uint16_t *key_len, uint16_t *len)
+{
+	char *s;
+	HTTPParams *index = http_params_of(req, which, &s);
+	HTTPParam *p;
+
+	if (index == NULL || idx >= index->count)
+		return NULL;
+	p = http_param_decoded(index, s, idx);
+	*key = s + p->key.off;
+	*key_len = p->key.len;
+	*len = p->value.len;
+	return s + p->value.off;
+}
+
+/*
+	Splits a parameter string into para[0 .. MAX_PARAM - 1], writing NULs
+	into it. Kept for old handlers: http_param_get() needs neither the
+	copy on the stack nor a second pass, and decodes.
+
 	@param args: args string
-	@param p: Params struct 
+	@param p: Params struct
 
 	@return int: number of parsed args
 */
@@ -17,24 +300,23 @@ int extract_params(char* args, Params *para)
 	char *key_point;
 	uint8_t count = 0;
 	char *idx;
-	char *saveptr;
 	while(p)
 	{
-		/* if param number is bigger than MAX_PARAM, it returns */
-		if (count > MAX_PARAM)
+		/* if param number reaches MAX_PARAM, it returns */
+		if (count >= MAX_PARAM)
 			break;
-		while ( key_point = strsep(&p, "&"))
-		{
-			if (*key_point == 0)
-				continue;
-			else
-				break;
-		}
+		key_point = strsep(&p, "&");
+		if (*key_point == 0)
+			continue;
 		/* deal with it */
 		idx = strchr(key_point, '=');
-		*idx = '\0';
 		para->key = key_point;
-		para->value = idx + 1;
+		if (idx != NULL) {
+			*idx = '\0';
+			para->value = idx + 1;
+		} else {
+			para->value = "";
+		}
 		para++; /* next item */
 		count++ ;
 	}
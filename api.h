@@ -3,19 +3,35 @@
 #ifndef _API_H
 #define _API_H
 #include "api_struct.h"
-#define URLS_ROUTE_LEN (sizeof(router_urls) / sizeof(URLRouter))
 
-extern const char* page_index(HTTPRequest *, void*);
-extern const char* page_ssid(HTTPRequest *, void*);
-extern const char* page_404(HTTPRequest *, void*);
+/* routes.c, generated from routes.def by tools/mkroutes */
+extern const URLRouteTable router_table;
 
-URLRouter page_err_404 = {
-	"/404.html", page_404
-};
+/* router.c */
+extern const URLRouter page_err_404;
+const URLRouter *router_lookup(const URLRouteTable *table, const char *url, HTTPRequest *req);
+const char *http_path_arg(const HTTPRequest *req, uint8_t idx, uint16_t *len);
 
-URLRouter router_urls[] = {
-	{"/", page_index},
-	{"/ssid", page_ssid}
-};
+/* api.c: query string and form parameters, see HTTPParams */
+#define HTTP_PARAMS_QUERY	0	/* the query string, req->params */
+#define HTTP_PARAMS_FORM	1	/* a form body, req->post_data */
 
-#endif
\ No newline at end of file
+/* at most this many pairs of a string are indexed, the rest are ignored */
+#define HTTP_MAX_PARAMS		32
+
+int http_params_index(HTTPRequest *req);
+uint32_t http_params_size(const HTTPParams *index);
+int http_param_count(const HTTPRequest *req, int which);
+const char *http_param_get(HTTPRequest *req, int which, const char *key, uint16_t *len);
+const char *http_param_at(HTTPRequest *req, int which, uint8_t idx, const char **key,
+			  uint16_t *key_len, uint16_t *len);
+int extract_params(char *args, Params *para);
+
+/* httpd.c: request headers, only valid while the handler runs */
+const char *http_header(const HTTPRequest *req, uint8_t id, uint16_t *len);
+const char *http_header_find(const HTTPRequest *req, const char *name, uint16_t *len);
+
+/* httpd_arena.c: memory freed with the request, never by the handler */
+void *http_alloc(HTTPRequest *req, uint32_t size);
+
+#endif
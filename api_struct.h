@@ -4,14 +4,137 @@
 #define MAX_API_CONTENT 4096
 #define MAX_PARAM 40 /* maximun params */
 
+/* Legacy handler: returns a malloc'ed, NUL-terminated response that the
+   server frees when the connection is done with it, or one allocated with
+   http_alloc() */
 typedef const char* (*router_handler)(HTTPRequest *, void *);
 
+/* Writes the response into buf (buf_len bytes, owned by the connection)
+   and returns its length. A result >= buf_len means it did not fit, as
+   with snprintf(): nothing past buf_len may be written and the handler
+   is called once more with buf_len = result + 1. A negative result
+   serves the 404 page. The response is sent with req->status, which the
+   handler may change (to one listed in headers.def). */
+typedef int (*http_handler)(HTTPRequest *req, char *buf, int buf_len, void *args);
+
+/* Returned by an http_handler that got a token from httpd_defer(): the
+   response is sent once httpd_complete() is called with that token, and
+   the server goes on serving other connections until then */
+#define HTTP_DEFERRED	(-0x7fff)
+
+#define HTTP_HANDLER_BUF_DEFAULT	256	/* response size first tried if buf_size is 0 */
+
+/* Generator for responses of any size, sent a window at a time: writes
+   the next part of the response into buf (at most buf_len bytes) and
+   returns its length, 0 at the end. *state is 0 on the first call and
+   kept for the handler between calls. Only the first call, made before
+   the header is sent, gets the request (req is NULL later): it may set
+   req->status, and a negative result serves the 404 page. Later negative
+   results close the connection without completing the response. It is
+   sent with
+   Transfer-Encoding: chunked to HTTP/1.1 clients, and delimited by
+   closing the connection otherwise. */
+typedef int (*http_stream_handler)(HTTPRequest *req, char *buf, int buf_len, uint32_t *state,
+				   void *args);
+
+#define HTTP_STREAM_WINDOW_MIN	64	/* a generator's buf_len is at least this */
+
+/* Receives the request body piece by piece as it arrives, before the
+   response handler runs; req->post_len counts what was passed so far.
+   With ROUTE_MANUAL_WND, the TCP window only reopens as the handler calls
+   httpd_post_data_recved(req->connection, len). Returns 0, or a negative
+   value to refuse the request. */
+typedef int (*http_body_handler)(HTTPRequest *req, const char *data, int len, void *args);
+
+/* A part of a multipart/form-data body, see http_part_handler. The
+   strings are slices of the part's headers (not NUL-terminated, NULL if
+   the part has none), valid until the part ends. */
+typedef struct http_part
+{
+	const char *name;	/* name= of its Content-Disposition */
+	const char *filename;	/* filename=, NULL for a plain form field */
+	const char *type;	/* its Content-Type */
+	uint16_t name_len;
+	uint16_t filename_len;
+	uint16_t type_len;
+	uint16_t index;		/* 0 for the first part of the body */
+	uint32_t len;		/* data bytes of the part passed so far */
+	uint32_t state;		/* the handler's, 0 at the start of the body */
+} HTTPPart;
+
+#define HTTP_PART_BEGIN	0	/* the headers of a part are in, data is NULL */
+#define HTTP_PART_DATA	1	/* the next len bytes of its data */
+#define HTTP_PART_END	2	/* its data is complete, data is NULL */
+
+/* Receives a multipart/form-data body as it arrives, instead of the body
+   being buffered: for each part HTTP_PART_BEGIN, its data in pieces of
+   any size, then HTTP_PART_END. The data is not copied and the server
+   holds no more than a delimiter of it, so a part may be larger than the
+   heap (a file written to flash as it comes). Returns 0, or a negative
+   value to refuse the request. */
+typedef int (*http_part_handler)(HTTPRequest *req, int event, HTTPPart *part,
+				 const char *data, int len, void *args);
+
+/* Decides on a request with a body from its head (URI, path arguments,
+   headers and req->content_len, which is 0 for a chunked body) before any
+   of the body is received. Returns 0 to take the body, or the status to
+   refuse the request with (one listed in headers.def), which the client
+   gets right away instead of "100 Continue". Runs in the tcpip thread,
+   whatever the route's options. */
+typedef int (*http_accept_handler)(HTTPRequest *req, void *args);
+
+#define ROUTE_MANUAL_WND	0x01	/* body handler updates the window itself */
+#define ROUTE_WORKER		0x02	/* handler runs in a worker task, see httpd_worker.c */
+
+typedef struct route_method
+{
+	http_handler handler;	/* NULL for a legacy or missing handler */
+	router_handler legacy;	/* served through the legacy adapter in fs.c */
+	http_stream_handler stream;	/* NULL unless the response is generated */
+	http_body_handler body;	/* NULL: body is buffered into req->post_data */
+	http_part_handler part;	/* not NULL: the body is multipart/form-data
+				   parsed for it (httpd_multipart.c) */
+	http_accept_handler accept;	/* NULL: every body within max_body is taken */
+	uint32_t buf_size;	/* expected response size, 0 for the default */
+	uint32_t max_body;	/* largest body taken (413 beyond), 0: no limit
+				   but that of the buffer */
+	uint32_t flags;		/* ROUTE_* */
+} RouteMethod;
+
 typedef struct url_route
 {
 	const char *url;
-	router_handler func;
+	RouteMethod func[HTTP_METHOD_COUNT];	/* indexed by HTTP_METHOD_* */
 } URLRouter, *pURLRouter;
 
+#define ROUTE_NODE_STATIC	0	/* label must match */
+#define ROUTE_NODE_PARAM	1	/* ":name", matches one path segment */
+#define ROUTE_NODE_WILDCARD	2	/* "*", matches the rest of the path */
+
+/* Radix trie node for routes with parameters; 32-bit fields only since
+   the trie is kept in flash */
+typedef struct url_route_node
+{
+	const char *label;
+	uint32_t label_len;
+	uint32_t type;		/* ROUTE_NODE_* */
+	uint32_t first_child;	/* children are contiguous, static ones first */
+	uint32_t child_count;
+	uint32_t route;		/* route + 1, 0 if no route ends here */
+} URLRouteNode;
+
+/* Route table generated by tools/mkroutes: a collision-free hash over the
+   static URLs and a radix trie over the ones with parameters */
+typedef struct url_route_table
+{
+	const URLRouter *routes;
+	const uint32_t *slots;	/* 2 words per slot: {hash, len << 16 | route + 1} */
+	uint32_t seed;
+	uint32_t mask;		/* number of slots - 1 */
+	uint32_t count;
+	const URLRouteNode *nodes;	/* nodes[0] is the root, NULL if unused */
+} URLRouteTable;
+
 typedef struct params
 {
 	const char *key;
@@ -31,124 +31,219 @@
  */
 #include "lwip/opt.h"
 #include "lwip/def.h"
+#include "lwip/mem.h"
 #include "fs.h"
 #include <string.h>
 #include "esp_common.h"
 #include "api.h"
 #include "http_request.h"
+#include "httpd_worker.h"
+#include "httpd_arena.h"
 
 /*-----------------------------------------------------------------------------------*/
-/* Define the number of open files that we can support. */
-#ifndef LWIP_MAX_OPEN_FILES
-#define LWIP_MAX_OPEN_FILES     10
-#endif
-
 static const u8_t * webfs_romfs = NULL;
 
-/* Define the file system memory allocation structure. */
-struct webfs_table {
-  struct webfs_file file;
-  u8_t inuse;
-};
+/* No response yet: httpd_complete() (or a worker) supplies it later */
+static void ICACHE_FLASH_ATTR
+webfs_set_deferred(struct webfs_file *file)
+{
+    file->data = NULL;
+    file->len = 0;
+    file->data_owner = WEBFS_DATA_STATIC;
+    file->deferred = 1;
+}
 
-/* Allocate file system memory */
-struct webfs_table webfs_memory[LWIP_MAX_OPEN_FILES];
+/* Response memory: from the request's arena, which frees it with the
+   request, or from the heap when there is no request */
+static char * ICACHE_FLASH_ATTR
+webfs_alloc(struct webfs_file *file, HTTPRequest *req, int size)
+{
+    if (req == NULL) {
+        file->data_owner = WEBFS_DATA_MEM;
+        return (char *)mem_malloc(size);
+    }
+    file->data_owner = WEBFS_DATA_ARENA;
+    return (char *)httpd_arena_alloc(&req->arena, size);
+}
 
-int ICACHE_FLASH_ATTR
-webfs_open_custom(struct webfs_file *file, const char *name, void* args) {
-    printf("[*] webfs_open_custom invoked\n");
-    uint32_t len;
-    uint32_t i;
-    const char * buf;
-    /* args = HTTPRequest*/
-    HTTPRequest* req = (HTTPRequest *) args;
-    URLRouter *obj_page;
-    /* URLRouter determination */
-    for(i = 0; i < URLS_ROUTE_LEN; i++)
-    {
-        if (strcmp(name, router_urls[i].url) == 0)
-        {
-            /* we found obj_page */
-            printf("[*] webfs_open_custom: %s found", name);
-            obj_page = &router_urls[i];
-            break;
+/* Shrink (size > 0) or drop what webfs_alloc() returned */
+static char * ICACHE_FLASH_ATTR
+webfs_trim(struct webfs_file *file, HTTPRequest *req, char *buf, int size)
+{
+    if (file->data_owner == WEBFS_DATA_ARENA)
+        return (char *)httpd_arena_trim(&req->arena, buf, size);
+    if (size == 0) {
+        mem_free(buf);
+        return NULL;
+    }
+    return (char *)mem_trim(buf, size);
+}
+
+/* Runs a length-returning handler in a buffer sized to fit: the route's
+   size hint first, then exactly what the handler asked for */
+static int ICACHE_FLASH_ATTR
+webfs_run_handler(struct webfs_file *file, const RouteMethod *m, HTTPRequest *req)
+{
+    int size = m->buf_size ? (int)m->buf_size : HTTP_HANDLER_BUF_DEFAULT;
+    int len = -1;
+    int tries;
+    char *buf;
+
+    for (tries = 0; tries < 2; tries++) {
+        /* size bytes of response plus the NUL snprintf() insists on */
+        buf = webfs_alloc(file, req, size + 1);
+        if (buf == NULL)
+            return 0;
+        len = m->handler(req, buf, size + 1, NULL);
+        if (len == HTTP_DEFERRED) {
+            webfs_trim(file, req, buf, 0);
+            webfs_set_deferred(file);
+            return 1;
         }
+        if (len >= 0 && len <= size)
+            break;
+        webfs_trim(file, req, buf, 0);
+        if (len < 0)
+            return 0;
+        size = len;
     }
-    /* not found */
-    if (URLS_ROUTE_LEN == i)
-        obj_page = &page_err_404;
+    if (tries == 2)
+        return 0;
+    buf[len] = '\0';
+    /* give back what the size hint over-estimated */
+    file->data = webfs_trim(file, req, buf, len + 1);
+    file->len = len;
+    return 1;
+}
+
+/* First window of a generated response, made while the request is still
+   there; webfs_read() serves it and then calls the generator for more */
+static int ICACHE_FLASH_ATTR
+webfs_run_stream(struct webfs_file *file, const RouteMethod *m, HTTPRequest *req)
+{
+    int size = m->buf_size ? (int)m->buf_size : HTTP_HANDLER_BUF_DEFAULT;
+    int len;
+    char *buf;
 
-    buf = obj_page->func(req, NULL);
-    printf("[*] webfs_open_custom: content:%s ", buf);
-    if (!buf)
+    if (size < HTTP_STREAM_WINDOW_MIN)
+        size = HTTP_STREAM_WINDOW_MIN;
+    buf = webfs_alloc(file, req, size);
+    if (buf == NULL)
+        return 0;
+    file->stream_state = 0;
+    len = m->stream(req, buf, size, &file->stream_state, NULL);
+    if (len < 0 || len > size) {
+        webfs_trim(file, req, buf, 0);
+        return 0;
+    }
+    file->data = webfs_trim(file, req, buf, len ? len : 1);
+    file->len = len;
+    /* an empty first window is the whole (empty) response */
+    if (len != 0)
+        file->stream = m->stream;
+    return 1;
+}
+
+/* Adapter for router_handler: the result is served in place, measured once */
+static int ICACHE_FLASH_ATTR
+webfs_run_legacy(struct webfs_file *file, router_handler func, HTTPRequest *req)
+{
+    const char *buf = func(req, NULL);
+
+    if (buf == NULL)
         return 0;
-    
     file->data = buf;
     file->len = strlen(buf);
-    file->index = strlen(buf);
-    file->pextension = NULL;
-    file->http_header_included = 0;
-    
+    /* malloc()ed, or http_alloc()ed and gone with the request */
+    file->data_owner = (req != NULL && httpd_arena_owns(req->arena, buf)) ?
+        WEBFS_DATA_ARENA : WEBFS_DATA_MALLOC;
     return 1;
 }
 
-void webfs_close_custom(struct webfs_file *file) { }
-
-/*-----------------------------------------------------------------------------------*/
-static struct webfs_file *
-ICACHE_FLASH_ATTR
-webfs_malloc(void)
+/* Runs the (v2 or legacy) handler of a route into file. Only file and req
+   are touched, so the worker tasks call this as well */
+int ICACHE_FLASH_ATTR
+webfs_run_route(struct webfs_file *file, const RouteMethod *m, HTTPRequest *req)
 {
-  int i;
-  for(i = 0; i < LWIP_MAX_OPEN_FILES; i++) {
-    if(webfs_memory[i].inuse == 0) {
-      webfs_memory[i].inuse = 1;
-      return(&webfs_memory[i].file);
-    }
-  }
-  return(NULL);
+    if (m->handler != NULL)
+        return webfs_run_handler(file, m, req);
+    return webfs_run_legacy(file, m->legacy, req);
 }
 
-/*-----------------------------------------------------------------------------------*/
-static void
-webfs_free(struct webfs_file *file)
-{
-  int i;
-  for(i = 0; i < LWIP_MAX_OPEN_FILES; i++) {
-    if(&webfs_memory[i].file == file) {
-      webfs_memory[i].inuse = 0;
-      break;
+int ICACHE_FLASH_ATTR
+webfs_open_custom(struct webfs_file *file, const char *name, void* args) {
+    /* args = HTTPRequest*/
+    HTTPRequest* req = (HTTPRequest *) args;
+    const URLRouter *obj_page;
+    const RouteMethod *m = NULL;
+    uint8_t method = (req != NULL) ? req->method : HTTP_METHOD_GET;
+    uint16_t status = 200;
+    int ok;
+
+    /* URLRouter determination */
+    obj_page = router_lookup(&router_table, name, req);
+    if (obj_page != NULL) {
+        m = &obj_page->func[method];
+        if (m->handler == NULL && m->legacy == NULL && m->stream == NULL)
+            m = NULL;
     }
-  }
-  return;
+    if (m == NULL) {
+        /* not found, or no handler for this method */
+        m = &page_err_404.func[method];
+        status = 404;
+    }
+    if (req != NULL)
+        req->status = status;
+
+    file->stream = NULL;
+    file->deferred = 0;
+    ok = 1;
+    if (m->stream != NULL)
+        ok = webfs_run_stream(file, m, req);
+#if LWIP_HTTPD_WORKERS
+    else if ((m->flags & ROUTE_WORKER) && req != NULL && httpd_worker_submit(m, req))
+        webfs_set_deferred(file);
+#endif
+    else
+        ok = webfs_run_route(file, m, req);
+    if (!ok)
+        return 0;
+    file->status = (req != NULL) ? req->status : status;
+
+    /* everything is in memory already, nothing left for webfs_read(),
+       except for a generated response, which is read from the start */
+    file->index = (file->stream != NULL) ? 0 : file->len;
+
+    return 1;
 }
 
+void webfs_close_custom(struct webfs_file *file) { }
+
 /*-----------------------------------------------------------------------------------*/
-struct webfs_file *
-webfs_open(const char *name, void* args)
+int
+webfs_open(struct webfs_file *file, const char *name, void* args)
 {
   printf("[*] webfs_open invoked\n");
-  struct webfs_file *file;
-
-  file = webfs_malloc();
-  printf("[*] webfs_open: file malloc done\n");
-  if(file == NULL) {
-    return NULL;
-  }
+  return webfs_open_custom(file, name, args);
+}
 
-  if(webfs_open_custom(file, name, args)) {
-    return file;
+/*-----------------------------------------------------------------------------------*/
+void
+webfs_free_data(struct webfs_file *file)
+{
+  if (file->data_owner == WEBFS_DATA_MEM) {
+    mem_free((void *)file->data);
+  } else if (file->data_owner == WEBFS_DATA_MALLOC) {
+    free((void *)file->data);
   }
-  printf("[*] webfs_open: free\n");
-  webfs_free(file);
-  return NULL;
+  file->data = NULL;
+  file->data_owner = WEBFS_DATA_STATIC;
 }
-
 /*-----------------------------------------------------------------------------------*/
 void
 webfs_close(struct webfs_file *file)
 {
-  webfs_free(file);
+  webfs_free_data(file);
 }
 /*-----------------------------------------------------------------------------------*/
 int
@@ -156,8 +251,20 @@ webfs_read(struct webfs_file *file, char *buffer, int count)
 {
   int read;
 
+  if((file->index == file->len) && (file->stream != NULL)) {
+    /* the first window is sent: only one window is kept at a time (one
+       in the arena stays there until the request is done) */
+    webfs_free_data(file);
+    read = file->stream(NULL, buffer, count, &file->stream_state, NULL);
+    if (read <= 0 || read > count) {
+      file->stream = NULL;
+      file->index = file->len;
+      return (read == 0) ? WEBFS_EOF : WEBFS_ERR;
+    }
+    return read;
+  }
   if(file->index == file->len) {
-    return -1;
+    return WEBFS_EOF;
   }
 
   read = file->len - file->index;
@@ -173,6 +280,10 @@ webfs_read(struct webfs_file *file, char *buffer, int count)
 /*-----------------------------------------------------------------------------------*/
 int webfs_bytes_left(struct webfs_file *file)
 {
+  if (file->stream != NULL) {
+    /* not known, but there is more */
+    return (file->len - file->index) + 1;
+  }
   return file->len - file->index;
 }
 /*-----------------------------------------------------------------------------------*/
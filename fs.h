@@ -34,18 +34,43 @@
 
 #include "lwip/opt.h"
 
+/* Who owns webfs_file.data, freed by webfs_close() */
+#define WEBFS_DATA_STATIC   0
+#define WEBFS_DATA_MALLOC   1 /* legacy handler result, free() */
+#define WEBFS_DATA_MEM      2 /* handler buffer, mem_free() */
+#define WEBFS_DATA_ARENA    3 /* in the request's arena, freed with it */
+
+/* webfs_read() results other than a length */
+#define WEBFS_EOF           -1
+#define WEBFS_ERR           -2 /* the generator failed */
+
+struct http_request;
+struct route_method;
+
 struct webfs_file {
   const char *data;
+  /* generator of the rest of the response (an http_stream_handler), NULL
+     when data holds all of it; len is then only the first window */
+  int (*stream)(struct http_request *req, char *buf, int buf_len, u32_t *state, void *args);
   int len;
   int index;
-  void *pextension;
-  u8_t http_header_included;
+  u32_t stream_state;
+  u16_t status; /* HTTP status of the response */
+  u8_t data_owner;
+  u8_t deferred; /* the handler returned HTTP_DEFERRED, no data yet */
 };
 
 void webfs_init(const u8_t *prefix);
-struct webfs_file *webfs_open(const char *name, void* args);
+/* open name into file (the caller's, see struct http_state): 1 if found,
+   0 if not, leaving nothing to close */
+int webfs_open(struct webfs_file *file, const char *name, void* args);
 void webfs_close(struct webfs_file *file);
 int webfs_read(struct webfs_file *file, char *buffer, int count);
 int webfs_bytes_left(struct webfs_file *file);
+/* release file->data, whoever owns it */
+void webfs_free_data(struct webfs_file *file);
+/* run a route's v2 or legacy handler into file */
+int webfs_run_route(struct webfs_file *file, const struct route_method *m,
+                    struct http_request *req);
 
 #endif /* __FS_H__ */
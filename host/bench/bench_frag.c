@@ -0,0 +1,522 @@
+/*
+ * Heap fragmentation stress test: serves the same request mix twice on a
+ * model of the device heap, once allocating and freeing every buffer of a
+ * request on its own (as the server did before httpd_arena.c) and once
+ * through the per-request arena, and reports how fragmented the heap gets.
+ *
+ * The heap is a copy of the lwIP 1.4.1 mem.c allocator (first fit,
+ * neighbours merged on free, mem_trim() in place) over MEM_SIZE bytes, the
+ * same one mem_malloc() uses on the device. Several connections run at
+ * once, their steps interleaved at random, and every TCP segment they send
+ * holds a small heap block (the pbuf of its header, or of copied data)
+ * until a later step ACKs it, as tcp_write() does.
+ *
+ * Usage: bench_frag [requests]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/opt.h"
+#include "lwip/mem.h"
+
+#define BENCH_DEFAULT_REQUESTS  1000000
+#define BENCH_CONNS             8     /* connections served at once */
+#define BENCH_SEG_HDR           (16 + 54) /* struct pbuf + TCP/IP/link headers */
+#define BENCH_SEGS_MAX          8     /* unACKed segments per connection */
+#define BENCH_SAMPLE            1000  /* requests between heap samples */
+
+/* ---------- model heap, after lwIP 1.4.1 src/core/mem.c ---------- */
+
+struct mem {
+  mem_size_t next;
+  mem_size_t prev;
+  u8_t used;
+};
+
+#define MIN_SIZE_ALIGNED     LWIP_MEM_ALIGN_SIZE(12)
+#define SIZEOF_STRUCT_MEM    LWIP_MEM_ALIGN_SIZE(sizeof(struct mem))
+#define MEM_SIZE_ALIGNED     LWIP_MEM_ALIGN_SIZE(MEM_SIZE)
+
+static u8_t ram_heap[MEM_SIZE_ALIGNED + (2 * SIZEOF_STRUCT_MEM) + MEM_ALIGNMENT];
+static u8_t *ram;
+static struct mem *ram_end, *lfree;
+static unsigned long heap_mallocs;
+
+static void
+plug_holes(struct mem *mem)
+{
+  struct mem *nmem = (struct mem *)(void *)&ram[mem->next];
+  struct mem *pmem = (struct mem *)(void *)&ram[mem->prev];
+
+  if ((mem != nmem) && !nmem->used && (nmem != ram_end)) {
+    if (lfree == nmem) {
+      lfree = mem;
+    }
+    mem->next = nmem->next;
+    ((struct mem *)(void *)&ram[nmem->next])->prev = (mem_size_t)((u8_t *)mem - ram);
+  }
+  if ((pmem != mem) && !pmem->used) {
+    if (lfree == mem) {
+      lfree = pmem;
+    }
+    pmem->next = mem->next;
+    ((struct mem *)(void *)&ram[mem->next])->prev = (mem_size_t)((u8_t *)pmem - ram);
+  }
+}
+
+static void
+heap_init(void)
+{
+  struct mem *mem;
+
+  ram = (u8_t *)LWIP_MEM_ALIGN(ram_heap);
+  mem = (struct mem *)(void *)ram;
+  mem->next = MEM_SIZE_ALIGNED;
+  mem->prev = 0;
+  mem->used = 0;
+  ram_end = (struct mem *)(void *)&ram[MEM_SIZE_ALIGNED];
+  ram_end->used = 1;
+  ram_end->next = MEM_SIZE_ALIGNED;
+  ram_end->prev = MEM_SIZE_ALIGNED;
+  lfree = (struct mem *)(void *)ram;
+  heap_mallocs = 0;
+}
+
+void *
+mem_malloc(mem_size_t size)
+{
+  mem_size_t ptr, ptr2;
+  struct mem *mem, *mem2;
+
+  if (size == 0) {
+    return NULL;
+  }
+  size = LWIP_MEM_ALIGN_SIZE(size);
+  if (size < MIN_SIZE_ALIGNED) {
+    size = MIN_SIZE_ALIGNED;
+  }
+  if (size > MEM_SIZE_ALIGNED) {
+    return NULL;
+  }
+  heap_mallocs++;
+  for (ptr = (mem_size_t)((u8_t *)lfree - ram); ptr < MEM_SIZE_ALIGNED - size;
+       ptr = ((struct mem *)(void *)&ram[ptr])->next) {
+    mem = (struct mem *)(void *)&ram[ptr];
+    if (!mem->used && (mem->next - (ptr + SIZEOF_STRUCT_MEM)) >= size) {
+      if (mem->next - (ptr + SIZEOF_STRUCT_MEM) >= (size + SIZEOF_STRUCT_MEM + MIN_SIZE_ALIGNED)) {
+        ptr2 = (mem_size_t)(ptr + SIZEOF_STRUCT_MEM + size);
+        mem2 = (struct mem *)(void *)&ram[ptr2];
+        mem2->used = 0;
+        mem2->next = mem->next;
+        mem2->prev = ptr;
+        mem->next = ptr2;
+        mem->used = 1;
+        if (mem2->next != MEM_SIZE_ALIGNED) {
+          ((struct mem *)(void *)&ram[mem2->next])->prev = ptr2;
+        }
+      } else {
+        mem->used = 1;
+      }
+      if (mem == lfree) {
+        while (lfree->used && (lfree != ram_end)) {
+          lfree = (struct mem *)(void *)&ram[lfree->next];
+        }
+      }
+      return (u8_t *)mem + SIZEOF_STRUCT_MEM;
+    }
+  }
+  return NULL;
+}
+
+void
+mem_free(void *rmem)
+{
+  struct mem *mem;
+
+  if (rmem == NULL) {
+    return;
+  }
+  mem = (struct mem *)(void *)((u8_t *)rmem - SIZEOF_STRUCT_MEM);
+  mem->used = 0;
+  if (mem < lfree) {
+    lfree = mem;
+  }
+  plug_holes(mem);
+}
+
+void *
+mem_trim(void *rmem, mem_size_t newsize)
+{
+  mem_size_t size, ptr, ptr2;
+  struct mem *mem, *mem2;
+
+  newsize = LWIP_MEM_ALIGN_SIZE(newsize);
+  if (newsize < MIN_SIZE_ALIGNED) {
+    newsize = MIN_SIZE_ALIGNED;
+  }
+  mem = (struct mem *)(void *)((u8_t *)rmem - SIZEOF_STRUCT_MEM);
+  ptr = (mem_size_t)((u8_t *)mem - ram);
+  size = (mem_size_t)(mem->next - ptr - SIZEOF_STRUCT_MEM);
+  if (newsize >= size) {
+    return rmem;
+  }
+  mem2 = (struct mem *)(void *)&ram[mem->next];
+  if (!mem2->used) {
+    mem_size_t next = mem2->next;
+    ptr2 = (mem_size_t)(ptr + SIZEOF_STRUCT_MEM + newsize);
+    if (lfree == mem2) {
+      lfree = (struct mem *)(void *)&ram[ptr2];
+    }
+    mem2 = (struct mem *)(void *)&ram[ptr2];
+    mem2->used = 0;
+    mem2->next = next;
+    mem2->prev = ptr;
+    mem->next = ptr2;
+    if (mem2->next != MEM_SIZE_ALIGNED) {
+      ((struct mem *)(void *)&ram[mem2->next])->prev = ptr2;
+    }
+  } else if (newsize + SIZEOF_STRUCT_MEM + MIN_SIZE_ALIGNED <= size) {
+    ptr2 = (mem_size_t)(ptr + SIZEOF_STRUCT_MEM + newsize);
+    mem2 = (struct mem *)(void *)&ram[ptr2];
+    if (mem2 < lfree) {
+      lfree = mem2;
+    }
+    mem2->used = 0;
+    mem2->next = mem->next;
+    mem2->prev = ptr;
+    mem->next = ptr2;
+    if (mem2->next != MEM_SIZE_ALIGNED) {
+      ((struct mem *)(void *)&ram[mem2->next])->prev = ptr2;
+    }
+  }
+  return rmem;
+}
+
+/* Free blocks and the largest allocation that would still succeed */
+static void
+heap_walk(unsigned *holes, unsigned *largest, unsigned *free_bytes)
+{
+  mem_size_t ptr;
+
+  *holes = *largest = *free_bytes = 0;
+  for (ptr = 0; ptr < MEM_SIZE_ALIGNED; ptr = ((struct mem *)(void *)&ram[ptr])->next) {
+    struct mem *mem = (struct mem *)(void *)&ram[ptr];
+    if (!mem->used) {
+      unsigned size = mem->next - ptr - SIZEOF_STRUCT_MEM;
+      (*holes)++;
+      *free_bytes += size;
+      if (size > *largest) {
+        *largest = size;
+      }
+    }
+  }
+}
+
+/* ---------- the allocator under test ---------- */
+
+#include "../../httpd_arena.c"
+
+/* ---------- request mix ---------- */
+
+enum { REQ_INDEX, REQ_SSID_GET, REQ_SSID_POST, REQ_STATIONS, REQ_TYPES };
+
+struct conn {
+  int busy;
+  int type;
+  int send_steps;               /* segments still to send */
+  struct httpd_arena_chunk *arena;
+  /* separate allocations, freed one by one (arena off) */
+  void *req_head, *post, *post_data, *response, *send_buf;
+  void *segs[BENCH_SEGS_MAX];   /* unACKed segments, oldest first */
+  int num_segs;
+};
+
+struct result {
+  unsigned long served, failed;
+  unsigned long no_block;       /* failed although enough was free in total */
+  unsigned long samples, holes_sum;
+  unsigned largest_min, holes_max;
+  unsigned holes_end, largest_end, free_end;
+  double mallocs_per_req;       /* made for the server, not for segments */
+};
+
+static u32_t rng_state;
+
+static u32_t
+rng(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static u32_t
+rng_range(u32_t lo, u32_t hi)
+{
+  return lo + rng() % (hi - lo + 1);
+}
+
+static int use_arena;
+static unsigned long no_block, seg_mallocs;
+
+/* A server allocation failed: was the heap full, or just in pieces? */
+static void
+note_failure(u32_t size)
+{
+  unsigned holes, largest, free_bytes;
+
+  heap_walk(&holes, &largest, &free_bytes);
+  if (free_bytes >= size + SIZEOF_STRUCT_MEM + HTTPD_ARENA_HDR) {
+    no_block++;
+  }
+}
+
+static void *
+req_alloc(struct conn *c, void **slot, u32_t size)
+{
+  void *p;
+
+  if (use_arena) {
+    p = httpd_arena_alloc(&c->arena, size);
+  } else {
+    p = *slot = mem_malloc((mem_size_t)size);
+  }
+  if (p == NULL) {
+    note_failure(size);
+  }
+  return p;
+}
+
+static void
+req_free(void **slot)
+{
+  mem_free(*slot);
+  *slot = NULL;
+}
+
+/* Response of a length-returning handler: a guess first, then what the
+   handler asked for, trimmed to what it wrote (webfs_run_handler()) */
+static void *
+run_handler(struct conn *c, u32_t guess, u32_t len)
+{
+  void *buf = req_alloc(c, &c->response, guess + 1);
+
+  if ((buf != NULL) && (len > guess)) {
+    if (use_arena) {
+      httpd_arena_trim(&c->arena, buf, 0);
+    } else {
+      req_free(&c->response);
+    }
+    buf = req_alloc(c, &c->response, len + 1);
+  }
+  if (buf == NULL) {
+    return NULL;
+  }
+  if (use_arena) {
+    return httpd_arena_trim(&c->arena, buf, len + 1);
+  }
+  return c->response = mem_trim(buf, (mem_size_t)(len + 1));
+}
+
+static void
+conn_end(struct conn *c)
+{
+  int i;
+
+  req_free(&c->req_head);
+  if (use_arena) {
+    httpd_arena_free(&c->arena);
+  } else {
+    req_free(&c->post);
+    req_free(&c->post_data);
+    req_free(&c->response);
+    req_free(&c->send_buf);
+  }
+  /* the last segments are ACKed after the connection is done with them */
+  for (i = 0; i < c->num_segs; i++) {
+    mem_free(c->segs[i]);
+  }
+  c->num_segs = 0;
+  c->busy = 0;
+}
+
+/* Parse the head, take the body, run the handler: one step */
+static int
+conn_start(struct conn *c)
+{
+  u32_t head_len = rng_range(120, 700);
+  u32_t mix = rng() % 100;
+
+  c->busy = 1;
+  /* page loads, the pages polling their data, the odd form post */
+  c->type = (mix < 40) ? REQ_INDEX : (mix < 80) ? REQ_SSID_GET :
+            (mix < 95) ? REQ_STATIONS : REQ_SSID_POST;
+  /* browsers' heads are split across segments now and then */
+  if ((rng() % 4) == 0) {
+    /* the copy is freed once parsed, in both schemes */
+    if ((c->req_head = mem_malloc((mem_size_t)(head_len + 1))) == NULL) {
+      note_failure(head_len + 1);
+      return 0;
+    }
+  }
+  switch (c->type) {
+  case REQ_INDEX:
+    if (run_handler(c, 256, rng_range(150, 900)) == NULL) {
+      return 0;
+    }
+    break;
+  case REQ_SSID_GET:
+    if (run_handler(c, 192, rng_range(90, 120)) == NULL) {
+      return 0;
+    }
+    break;
+  case REQ_SSID_POST:
+    if ((req_alloc(c, &c->post, 12) == NULL) ||
+        (req_alloc(c, &c->post_data, rng_range(20, 512) + 1) == NULL)) {
+      return 0;
+    }
+    /* legacy handler: MAX_API_CONTENT, never trimmed */
+    if (req_alloc(c, &c->response, 4096) == NULL) {
+      return 0;
+    }
+    break;
+  default: {
+    u32_t count = 2 * TCP_MSS;
+    if (run_handler(c, 256, rng_range(64, 256)) == NULL) {
+      return 0;
+    }
+    /* the send buffer, halved until it fits (http_send_data()) */
+    while (req_alloc(c, &c->send_buf, count) == NULL) {
+      count /= 2;
+      if (count <= 100) {
+        return 0;
+      }
+    }
+    break;
+  }
+  }
+  /* the head is done with once the handler ran */
+  req_free(&c->req_head);
+  if (use_arena) {
+    httpd_arena_fit(&c->arena);
+  }
+  c->send_steps = (c->type == REQ_STATIONS) ? (int)rng_range(4, 24) : (int)rng_range(1, 3);
+  return 1;
+}
+
+/* Send a segment, ACK older ones */
+static void
+conn_send(struct conn *c)
+{
+  /* copied data for a generated response, only the header otherwise */
+  u32_t size = BENCH_SEG_HDR + ((c->type == REQ_STATIONS) ? rng_range(200, TCP_MSS) : 0);
+  void *seg;
+  int acked = (int)(rng() % (u32_t)(c->num_segs + 1));
+  int i;
+
+  for (i = 0; i < acked; i++) {
+    mem_free(c->segs[i]);
+  }
+  memmove(c->segs, c->segs + acked, (c->num_segs - acked) * sizeof(c->segs[0]));
+  c->num_segs -= acked;
+  if (c->num_segs == BENCH_SEGS_MAX) {
+    return;
+  }
+  seg_mallocs++;
+  seg = mem_malloc((mem_size_t)size);
+  if (seg == NULL) {
+    /* tcp_write() fails: try again on the next step */
+    return;
+  }
+  c->segs[c->num_segs++] = seg;
+  c->send_steps--;
+}
+
+static void
+run(int arena, unsigned long requests, struct result *res)
+{
+  struct conn conns[BENCH_CONNS];
+  unsigned long started = 0, mallocs;
+  unsigned holes, largest, free_bytes;
+  int i;
+
+  memset(conns, 0, sizeof(conns));
+  memset(res, 0, sizeof(*res));
+  heap_init();
+  no_block = seg_mallocs = 0;
+  use_arena = arena;
+  rng_state = 0x2545f491;
+  res->largest_min = MEM_SIZE_ALIGNED;
+
+  while ((res->served + res->failed) < requests) {
+    struct conn *c = &conns[rng() % BENCH_CONNS];
+    if (!c->busy) {
+      if (started >= requests) {
+        continue;
+      }
+      started++;
+      if ((started % BENCH_SAMPLE) == 0) {
+        heap_walk(&holes, &largest, &free_bytes);
+        res->samples++;
+        res->holes_sum += holes;
+        res->holes_max = LWIP_MAX(res->holes_max, holes);
+        res->largest_min = LWIP_MIN(res->largest_min, largest);
+      }
+      if (!conn_start(c)) {
+        res->failed++;
+        conn_end(c);
+      }
+    } else if (c->send_steps > 0) {
+      conn_send(c);
+    } else {
+      res->served++;
+      conn_end(c);
+    }
+  }
+  mallocs = heap_mallocs - seg_mallocs;
+  for (i = 0; i < BENCH_CONNS; i++) {
+    if (conns[i].busy) {
+      conn_end(&conns[i]);
+    }
+  }
+  heap_walk(&res->holes_end, &res->largest_end, &res->free_end);
+  res->mallocs_per_req = (double)mallocs / requests;
+  res->no_block = no_block;
+}
+
+static void
+print_result(const char *name, const struct result *res)
+{
+  printf("%-9s %9lu %8lu %8lu %11.2f %9.1f %9u %12u\n", name, res->served, res->failed,
+         res->no_block, res->mallocs_per_req, res->samples ? (double)res->holes_sum / res->samples : 0.0,
+         res->holes_max, res->largest_min);
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned long requests = BENCH_DEFAULT_REQUESTS;
+  struct result separate, arena;
+
+  if (argc > 1) {
+    requests = strtoul(argv[1], NULL, 10);
+  }
+  run(0, requests, &separate);
+  run(1, requests, &arena);
+
+  printf("%lu requests, %d connections, %u byte heap, %u byte arena chunks\n",
+         requests, BENCH_CONNS, (unsigned)MEM_SIZE_ALIGNED, (unsigned)LWIP_HTTPD_ARENA_CHUNK);
+  printf("%-9s %9s %8s %8s %11s %9s %9s %12s\n", "scheme", "served", "failed",
+         "no block", "mallocs/req", "holes avg", "holes max", "largest min");
+  print_result("separate", &separate);
+  print_result("arena", &arena);
+  /* both must give the whole heap back */
+  if ((separate.holes_end != 1) || (arena.holes_end != 1)) {
+    fprintf(stderr, "bench_frag: heap not empty at the end (%u, %u free blocks)\n",
+            separate.holes_end, arena.holes_end);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * Delimiter scanning microbenchmark: splits captured browser request heads
+ * into their lines and tokens (CR, LF, space, ':') with every http_scan()
+ * variant compiled into this binary, and with the strnstr() passes the
+ * request parser used before (end of line, end of head, Content-Length).
+ *
+ * The SSE2 variant is always available on x86-64 hosts; build with
+ * SCAN_ARCH=-mavx2 (the default is -march=native) to include AVX2.
+ *
+ * Usage: bench_scan [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http_scan.h"
+
+#define BENCH_DEFAULT_ITERATIONS  200000
+
+/* Request heads as sent by current browsers and tools */
+static const char *bench_heads[] = {
+  /* Chrome, page load */
+  "GET /ssid?lang=en HTTP/1.1\r\n"
+  "Host: 192.168.4.1\r\n"
+  "Connection: keep-alive\r\n"
+  "Cache-Control: max-age=0\r\n"
+  "Upgrade-Insecure-Requests: 1\r\n"
+  "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+  "(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,"
+  "image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+  "Accept-Encoding: gzip, deflate\r\n"
+  "Accept-Language: en-US,en;q=0.9,de;q=0.8\r\n"
+  "\r\n",
+  /* Firefox, form submit */
+  "POST /ssid HTTP/1.1\r\n"
+  "Host: 192.168.4.1\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:121.0) Gecko/20100101 Firefox/121.0\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,"
+  "image/webp,*/*;q=0.8\r\n"
+  "Accept-Language: en-US,en;q=0.5\r\n"
+  "Accept-Encoding: gzip, deflate\r\n"
+  "Content-Type: application/x-www-form-urlencoded\r\n"
+  "Content-Length: 31\r\n"
+  "Origin: http://192.168.4.1\r\n"
+  "Connection: keep-alive\r\n"
+  "Referer: http://192.168.4.1/ssid\r\n"
+  "Upgrade-Insecure-Requests: 1\r\n"
+  "\r\n",
+  /* Safari, favicon */
+  "GET /favicon.ico HTTP/1.1\r\n"
+  "Host: 192.168.4.1\r\n"
+  "Accept: image/webp,image/avif,image/jxl,image/heic,image/heic-sequence,"
+  "video/*;q=0.8,image/png,image/svg+xml,image/*;q=0.8,*/*;q=0.5\r\n"
+  "Referer: http://192.168.4.1/\r\n"
+  "Accept-Language: en-GB,en;q=0.9\r\n"
+  "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 "
+  "(KHTML, like Gecko) Version/17.2 Safari/605.1.15\r\n"
+  "Accept-Encoding: gzip, deflate\r\n"
+  "Connection: keep-alive\r\n"
+  "\r\n",
+  /* curl */
+  "GET / HTTP/1.1\r\n"
+  "Host: 192.168.4.1\r\n"
+  "User-Agent: curl/8.5.0\r\n"
+  "Accept: */*\r\n"
+  "\r\n",
+};
+
+#define NUM_HEADS (sizeof(bench_heads) / sizeof(bench_heads[0]))
+
+typedef size_t (*scan_fn)(const char *s, size_t len, uint32_t set);
+
+/* Wrappers so every variant sees the same constant sets the parser uses */
+#define BENCH_SCAN_WRAP(name, fn) \
+  static size_t name##_eol(const char *s, size_t len, uint32_t set) \
+  { return fn(s, len, HTTP_SCAN_EOL); } \
+  static size_t name##_tok(const char *s, size_t len, uint32_t set) \
+  { return fn(s, len, HTTP_SCAN_EOL | HTTP_SCAN_SP | HTTP_SCAN_COLON); }
+
+BENCH_SCAN_WRAP(byte, http_scan_byte)
+BENCH_SCAN_WRAP(swar, http_scan_swar)
+#if defined(__SSE2__)
+BENCH_SCAN_WRAP(sse2, http_scan_sse2)
+#endif
+#if defined(__AVX2__)
+BENCH_SCAN_WRAP(avx2, http_scan_avx2)
+#endif
+
+static const struct {
+  const char *name;
+  scan_fn eol;
+  scan_fn tok;
+} bench_variants[] = {
+  {"byte", byte_eol, byte_tok},
+  {"swar", swar_eol, swar_tok},
+#if defined(__SSE2__)
+  {"sse2", sse2_eol, sse2_tok},
+#endif
+#if defined(__AVX2__)
+  {"avx2", avx2_eol, avx2_tok},
+#endif
+};
+
+#define NUM_VARIANTS (sizeof(bench_variants) / sizeof(bench_variants[0]))
+
+/* The private strnstr() httpd.c used to locate delimiters */
+static char *
+old_strnstr(const char *buffer, const char *token, size_t n)
+{
+  const char *p;
+  int tokenlen = (int)strlen(token);
+  if (tokenlen == 0) {
+    return (char *)buffer;
+  }
+  for (p = buffer; *p && (p + tokenlen <= buffer + n); p++) {
+    if ((*p == *token) && (strncmp(p, token, tokenlen) == 0)) {
+      return (char *)p;
+    }
+  }
+  return NULL;
+}
+
+/* What the old parser did per request: CRLF, then the spaces in the request
+ * line, then CRLFCRLF and Content-Length over the whole head */
+static size_t
+old_parse(const char *head, size_t len)
+{
+  const char *crlf = old_strnstr(head, "\r\n", len);
+  const char *sp1 = old_strnstr(head, " ", crlf - head);
+  const char *sp2 = old_strnstr(sp1 + 1, " ", crlf - sp1 - 1);
+  const char *end = old_strnstr(head, "\r\n\r\n", len);
+  const char *cl = old_strnstr(head, "Content-Length: ", end - head);
+  return (size_t)(sp2 - head) + (size_t)(end - head) + (cl ? (size_t)(cl - head) : 0);
+}
+
+/* One pass over the head stopping at every token boundary; returns a
+ * checksum of the positions found */
+static size_t
+tokenize(scan_fn tok, const char *head, size_t len)
+{
+  size_t off = 0, sum = 0;
+  while ((off += tok(head + off, len - off, 0)) < len) {
+    sum += off++;
+  }
+  return sum;
+}
+
+/* Line by line, the way the parser skips header values */
+static size_t
+lines(scan_fn eol, const char *head, size_t len)
+{
+  size_t off = 0, sum = 0;
+  while ((off += eol(head + off, len - off, 0)) < len) {
+    sum += off;
+    off += 2;
+  }
+  return sum;
+}
+
+static double
+now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned long iterations = BENCH_DEFAULT_ITERATIONS;
+  /* request heads live in writable buffers, as they do in the server */
+  static char heads[NUM_HEADS][1024];
+  size_t lens[NUM_HEADS], total = 0;
+  unsigned h, v;
+  unsigned long n;
+  volatile size_t sink = 0;
+  double t0, ns;
+
+  if (argc > 1) {
+    iterations = strtoul(argv[1], NULL, 10);
+  }
+
+  for (h = 0; h < NUM_HEADS; h++) {
+    lens[h] = strlen(bench_heads[h]);
+    total += lens[h];
+  }
+
+  /* all variants must agree with the bytewise scan from every offset,
+   * which also covers every alignment */
+  for (h = 0; h < NUM_HEADS; h++) {
+    size_t i;
+    memcpy(heads[h], bench_heads[h], lens[h] + 1);
+    for (i = 0; i <= lens[h]; i++) {
+      const char *s = heads[h] + i;
+      size_t len = lens[h] - i;
+      for (v = 1; v < NUM_VARIANTS; v++) {
+        if ((bench_variants[v].tok(s, len, 0) != byte_tok(s, len, 0)) ||
+            (bench_variants[v].eol(s, len, 0) != byte_eol(s, len, 0))) {
+          fprintf(stderr, "bench_scan: %s disagrees on head %u at %u\n",
+                  bench_variants[v].name, h, (unsigned)i);
+          return 1;
+        }
+      }
+    }
+  }
+
+  printf("%u request heads, %u bytes, %lu iterations\n", (unsigned)NUM_HEADS,
+         (unsigned)total, iterations);
+
+  t0 = now_ns();
+  for (n = 0; n < iterations; n++) {
+    h = n % NUM_HEADS;
+    sink += old_parse(heads[h], lens[h]);
+  }
+  ns = (now_ns() - t0) / iterations;
+  printf("strnstr passes    : %8.1f ns/head %6.2f ns/byte\n", ns, ns * NUM_HEADS / total);
+
+  for (v = 0; v < NUM_VARIANTS; v++) {
+    double tok_ns, eol_ns;
+    t0 = now_ns();
+    for (n = 0; n < iterations; n++) {
+      h = n % NUM_HEADS;
+      sink += tokenize(bench_variants[v].tok, heads[h], lens[h]);
+    }
+    tok_ns = (now_ns() - t0) / iterations;
+    t0 = now_ns();
+    for (n = 0; n < iterations; n++) {
+      h = n % NUM_HEADS;
+      sink += lines(bench_variants[v].eol, heads[h], lens[h]);
+    }
+    eol_ns = (now_ns() - t0) / iterations;
+    printf("%-4s tokens       : %8.1f ns/head %6.2f ns/byte\n", bench_variants[v].name,
+           tok_ns, tok_ns * NUM_HEADS / total);
+    printf("%-4s lines        : %8.1f ns/head %6.2f ns/byte\n", bench_variants[v].name,
+           eol_ns, eol_ns * NUM_HEADS / total);
+  }
+  return 0;
+}
@@ -0,0 +1,546 @@
+/*
+ * Reproducible HTTP benchmark for the host build of the httpd.
+ *
+ * Server and clients run in one process: the httpd listens on the lwIP
+ * loopback netif and the clients talk to it through the lwIP socket API
+ * from their own threads, so no tap device or root access is needed and
+ * the results do not depend on the host's network configuration.
+ *
+ * Every workload reports requests/sec, p50/p99 latency, bytes copied and
+ * TCP segments sent per response (from httpd_stats) and the peak lwIP heap
+ * usage. Note that the heap is shared with the client side, whose request
+ * pbufs are included.
+ *
+ * Usage: httpd_bench [-n requests] [-t tolerance%] [-b baseline] [-r record]
+ *   -b FILE   compare against FILE and exit with 1 on any regression, or
+ *             if FILE has no value for a measured workload and metric
+ *   -r FILE   write the results to FILE as a new baseline
+ *
+ * Built with LWIP_HTTPD_WORKERS ('make bench-workers'), the routes marked
+ * "worker" run in worker threads instead of the tcpip thread.
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lwip/opt.h"
+#include "lwip/def.h"
+#include "lwip/sockets.h"
+#include "lwip/stats.h"
+#include "lwip/sys.h"
+#include "lwip/tcpip.h"
+
+#include "httpd.h"
+
+/* Concurrent clients of the ramp workloads: each takes a client and a
+ * server pcb (MEMP_NUM_TCP_PCB) and one of LWIP_HTTPD_MAX_CONNS */
+#define BENCH_MAX_CLIENTS         10
+
+#define BENCH_DEFAULT_REQUESTS    2000
+#define BENCH_WARMUP_REQUESTS     20
+#define BENCH_RX_BUF_LEN          1024
+#define BENCH_MAX_WORKLOADS       (8 + BENCH_MAX_CLIENTS)
+#define BENCH_NAME_LEN            32
+
+struct bench_workload {
+  const char *name;
+  const char *request;
+  int expect_status;        /* 0: don't check */
+  int keepalive;            /* requests in 'request' (pipelined) when all of a
+                               client's are sent on one connection, else 0 */
+};
+
+static const struct bench_workload bench_workloads[] = {
+  { "get_index", "GET / HTTP/1.0\r\nHost: esp\r\n\r\n", 200 },
+  { "get_ssid_json", "GET /ssid HTTP/1.0\r\nHost: esp\r\n\r\n", 200 },
+  { "post_ssid_form",
+    "POST /ssid?para1=A HTTP/1.0\r\nHost: esp\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 29\r\n\r\n"
+    "postpara1=a1b2&postpara2=a2b2", 200 },
+  { "not_found", "GET /missing HTTP/1.0\r\nHost: esp\r\n\r\n", 404 },
+  /* generated a window at a time: the heap peak must not grow with it */
+  { "get_stations_csv", "GET /stations.csv HTTP/1.0\r\nHost: esp\r\n\r\n", 200 },
+  /* a dashboard polling over a persistent connection */
+  { "get_ssid_keepalive", "GET /ssid HTTP/1.1\r\nHost: esp\r\n\r\n", 200, 1 },
+  /* a fleet collector reading several API values per round-trip; timed
+     per batch of four */
+  { "get_ssid_pipelined",
+    "GET /ssid HTTP/1.1\r\nHost: esp\r\n\r\n"
+    "GET /ssid HTTP/1.1\r\nHost: esp\r\n\r\n"
+    "GET /ssid HTTP/1.1\r\nHost: esp\r\n\r\n"
+    "GET /ssid HTTP/1.1\r\nHost: esp\r\n\r\n", 200, 4 },
+};
+
+#define BENCH_RAMP_WORKLOAD       1   /* get_ssid_json */
+#define NUM_BENCH_WORKLOADS       (sizeof(bench_workloads) / sizeof(bench_workloads[0]))
+
+struct bench_result {
+  char name[BENCH_NAME_LEN];
+  double rps;
+  double p50_us;
+  double p99_us;
+  double copied_per_resp;
+  double segs_per_resp;
+  double peak_heap;
+  u32_t errors;
+};
+
+/* Baseline metrics: lower is better unless higher_better is set */
+struct bench_metric {
+  const char *name;
+  size_t offset;
+  u8_t higher_better;
+  u8_t timing;              /* subject to the timing tolerance */
+};
+
+static const struct bench_metric bench_metrics[] = {
+  { "rps",             offsetof(struct bench_result, rps),             1, 1 },
+  { "p50_us",          offsetof(struct bench_result, p50_us),          0, 1 },
+  { "p99_us",          offsetof(struct bench_result, p99_us),          0, 1 },
+  { "copied_per_resp", offsetof(struct bench_result, copied_per_resp), 0, 0 },
+  { "segs_per_resp",   offsetof(struct bench_result, segs_per_resp),   0, 0 },
+  { "peak_heap",       offsetof(struct bench_result, peak_heap),       0, 0 },
+};
+
+#define NUM_BENCH_METRICS         (sizeof(bench_metrics) / sizeof(bench_metrics[0]))
+/* Allowed growth of the non-timing metrics (heap peaks move a little with
+ * the interleaving of concurrent clients) */
+#define BENCH_MEMORY_TOLERANCE    0.05
+
+struct bench_client {
+  const struct bench_workload *workload;
+  u32_t count;
+  u32_t *latencies_us;
+  u32_t errors;
+  sys_sem_t *done;
+};
+
+static struct bench_result bench_results[BENCH_MAX_WORKLOADS];
+static int bench_num_results;
+
+static u32_t
+bench_now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u32_t)(ts.tv_sec * 1000000u + ts.tv_nsec / 1000);
+}
+
+/* Connect to the server, returns the socket or -1 */
+static int
+bench_connect(void)
+{
+  struct sockaddr_in addr;
+  int s;
+
+  s = lwip_socket(AF_INET, SOCK_STREAM, 0);
+  if (s < 0) {
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = PP_HTONS(80);
+  addr.sin_addr.s_addr = PP_HTONL(0x7f000001UL);
+  if (lwip_connect(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    lwip_close(s);
+    return -1;
+  }
+  return s;
+}
+
+static int
+bench_send(int s, const char *request, size_t request_len)
+{
+  size_t off = 0;
+  int n;
+
+  while (off < request_len) {
+    n = lwip_write(s, request + off, request_len - off);
+    if (n <= 0) {
+      return -1;
+    }
+    off += (size_t)n;
+  }
+  return 0;
+}
+
+/* Send one request on a fresh connection and read the response until the
+ * server closes. Returns the HTTP status or -1 on error. */
+static int
+bench_request(const char *request, size_t request_len)
+{
+  char rx[BENCH_RX_BUF_LEN];
+  int s, n, status = -1;
+  size_t got = 0;
+
+  s = bench_connect();
+  if (s < 0) {
+    return -1;
+  }
+  if (bench_send(s, request, request_len) < 0) {
+    lwip_close(s);
+    return -1;
+  }
+  while ((n = lwip_read(s, rx + got, sizeof(rx) - 1 - got)) > 0) {
+    if (status < 0) {
+      got += (size_t)n;
+      rx[got] = 0;
+      if ((got >= 12) && (strncmp(rx, "HTTP/1.", 7) == 0)) {
+        status = atoi(rx + 9);
+      }
+    }
+    if (got >= sizeof(rx) - 1) {
+      got = 0;
+    }
+  }
+  lwip_close(s);
+  return (n < 0) ? -1 : status;
+}
+
+/* Send the request(s) on the persistent connection *sp and read 'responses'
+ * responses, each framed by its Content-Length. Connects first if *sp is -1,
+ * and sets it back to -1 when the server closes. Returns the HTTP status
+ * (one that differs from the first, if any does) or -1. */
+static int
+bench_request_keepalive(int *sp, const char *request, size_t request_len, int responses)
+{
+  char rx[BENCH_RX_BUF_LEN];
+  char *end, *cl;
+  int n, first = -1, status = -1, closing = 0;
+  size_t got = 0, len;
+  long left;
+
+  if ((*sp < 0) && ((*sp = bench_connect()) < 0)) {
+    return -1;
+  }
+  if (bench_send(*sp, request, request_len) < 0) {
+    goto fail;
+  }
+  while (responses-- > 0) {
+    rx[got] = 0;
+    while (((end = strstr(rx, "\r\n\r\n")) == NULL) && (got < sizeof(rx) - 1)) {
+      n = lwip_read(*sp, rx + got, sizeof(rx) - 1 - got);
+      if (n <= 0) {
+        goto fail;
+      }
+      got += (size_t)n;
+      rx[got] = 0;
+    }
+    cl = strstr(rx, "Content-Length: ");
+    if ((end == NULL) || (cl == NULL) || (cl > end) || (strncmp(rx, "HTTP/1.", 7) != 0)) {
+      goto fail;
+    }
+    n = atoi(rx + 9);
+    if (first == -1) {
+      first = status = n;
+    } else if (n != first) {
+      status = n;
+    }
+    *end = 0;
+    if (strstr(rx, "Connection: Close") != NULL) {
+      /* the server's request cap: reconnect for the next one */
+      closing = 1;
+    }
+    /* drop this response, keeping what was read of the next one */
+    len = (size_t)(end + 4 - rx) + (size_t)atol(cl + 16);
+    if (got >= len) {
+      got -= len;
+      memmove(rx, rx + len, got);
+      continue;
+    }
+    left = (long)(len - got);
+    got = 0;
+    while (left > 0) {
+      n = lwip_read(*sp, rx, (left < (long)sizeof(rx)) ? (size_t)left : sizeof(rx));
+      if (n <= 0) {
+        goto fail;
+      }
+      left -= n;
+    }
+  }
+  if (closing) {
+    lwip_close(*sp);
+    *sp = -1;
+  }
+  return status;
+
+fail:
+  lwip_close(*sp);
+  *sp = -1;
+  return -1;
+}
+
+static void
+bench_client_thread(void *arg)
+{
+  struct bench_client *client = (struct bench_client *)arg;
+  size_t len = strlen(client->workload->request);
+  int s = -1;
+  u32_t i;
+
+  for (i = 0; i < client->count; i++) {
+    u32_t start = bench_now_us();
+    int status;
+    if (client->workload->keepalive) {
+      status = bench_request_keepalive(&s, client->workload->request, len,
+                                       client->workload->keepalive);
+    } else {
+      status = bench_request(client->workload->request, len);
+    }
+    client->latencies_us[i] = bench_now_us() - start;
+    if ((status < 0) ||
+        ((client->workload->expect_status != 0) && (status != client->workload->expect_status))) {
+      client->errors++;
+    }
+  }
+  if (s >= 0) {
+    lwip_close(s);
+  }
+  sys_sem_signal(client->done);
+}
+
+static int
+bench_cmp_u32(const void *a, const void *b)
+{
+  u32_t x = *(const u32_t *)a, y = *(const u32_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* Run 'requests' requests of 'workload' spread over 'conc' client threads */
+static void
+bench_run(const char *name, const struct bench_workload *workload, u32_t requests, int conc)
+{
+  struct bench_client clients[BENCH_MAX_CLIENTS];
+  struct bench_result *res = &bench_results[bench_num_results++];
+  struct httpd_stats before, after;
+  sys_sem_t done;
+  u32_t *latencies, total = 0, start, elapsed;
+  int i;
+
+  latencies = (u32_t *)calloc(requests, sizeof(u32_t));
+  LWIP_ASSERT("out of memory", latencies != NULL);
+  sys_sem_new(&done, 0);
+
+  httpd_get_stats(&before);
+  lwip_stats.mem.max = lwip_stats.mem.used;
+
+  start = bench_now_us();
+  for (i = 0; i < conc; i++) {
+    clients[i].workload = workload;
+    clients[i].count = requests / conc + ((u32_t)i < requests % conc ? 1 : 0);
+    clients[i].latencies_us = latencies + total;
+    clients[i].errors = 0;
+    clients[i].done = &done;
+    total += clients[i].count;
+    sys_thread_new("bench_client", bench_client_thread, &clients[i],
+                   DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+  }
+  for (i = 0; i < conc; i++) {
+    sys_arch_sem_wait(&done, 0);
+  }
+  elapsed = bench_now_us() - start;
+  httpd_get_stats(&after);
+  sys_sem_free(&done);
+
+  qsort(latencies, requests, sizeof(u32_t), bench_cmp_u32);
+  memset(res, 0, sizeof(*res));
+  snprintf(res->name, sizeof(res->name), "%s", name);
+  res->rps = requests * 1e6 / (elapsed ? elapsed : 1);
+  res->p50_us = latencies[requests / 2];
+  res->p99_us = latencies[(requests * 99) / 100];
+  if (after.responses != before.responses) {
+    res->copied_per_resp = (double)(after.bytes_copied - before.bytes_copied) /
+                           (after.responses - before.responses);
+    res->segs_per_resp = (double)(after.segments - before.segments) /
+                         (after.responses - before.responses);
+  }
+  res->peak_heap = lwip_stats.mem.max;
+  for (i = 0; i < conc; i++) {
+    res->errors += clients[i].errors;
+  }
+  free(latencies);
+
+  printf("%-16s %10.1f %10.0f %10.0f %10.1f %10.2f %10.0f %7"U32_F"\n", res->name, res->rps,
+         res->p50_us, res->p99_us, res->copied_per_resp, res->segs_per_resp, res->peak_heap,
+         res->errors);
+}
+
+static struct bench_result *
+bench_find_result(const char *name)
+{
+  int i;
+  for (i = 0; i < bench_num_results; i++) {
+    if (strcmp(bench_results[i].name, name) == 0) {
+      return &bench_results[i];
+    }
+  }
+  return NULL;
+}
+
+static int
+bench_record(const char *path)
+{
+  FILE *f = fopen(path, "w");
+  int i;
+  size_t m;
+
+  if (f == NULL) {
+    perror(path);
+    return 1;
+  }
+  fprintf(f, "# httpd_bench baseline: <workload> <metric> <value>\n");
+  for (i = 0; i < bench_num_results; i++) {
+    for (m = 0; m < NUM_BENCH_METRICS; m++) {
+      fprintf(f, "%s %s %.1f\n", bench_results[i].name, bench_metrics[m].name,
+              *(double *)((char *)&bench_results[i] + bench_metrics[m].offset));
+    }
+  }
+  fclose(f);
+  printf("baseline written to %s\n", path);
+  return 0;
+}
+
+/* Returns the number of regressions against the baseline in 'path'; a
+ * measured value without a baseline counts as one, so that an empty or
+ * stale baseline fails instead of checking nothing */
+static int
+bench_compare(const char *path, double timing_tolerance)
+{
+  char line[128], name[BENCH_NAME_LEN], metric[BENCH_NAME_LEN];
+  double base;
+  int regressions = 0, checked = 0, i;
+  u8_t seen[BENCH_MAX_WORKLOADS];  /* bit m: metric m has a baseline */
+  size_t m;
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL) {
+    perror(path);
+    return 1;
+  }
+  memset(seen, 0, sizeof(seen));
+  while (fgets(line, sizeof(line), f) != NULL) {
+    struct bench_result *res;
+
+    if ((line[0] == '#') || (sscanf(line, "%31s %31s %lf", name, metric, &base) != 3)) {
+      continue;
+    }
+    res = bench_find_result(name);
+    for (m = 0; m < NUM_BENCH_METRICS; m++) {
+      if (strcmp(bench_metrics[m].name, metric) == 0) {
+        break;
+      }
+    }
+    if ((res == NULL) || (m == NUM_BENCH_METRICS)) {
+      printf("WARN: baseline entry %s %s not measured\n", name, metric);
+      continue;
+    }
+    {
+      const struct bench_metric *bm = &bench_metrics[m];
+      double tol = bm->timing ? timing_tolerance : BENCH_MEMORY_TOLERANCE;
+      double val = *(double *)((char *)res + bm->offset);
+      int bad = bm->higher_better ? (val < base * (1.0 - tol)) : (val > base * (1.0 + tol));
+      checked++;
+      seen[res - bench_results] |= (u8_t)(1 << m);
+      if (bad) {
+        printf("FAIL: %s %s = %.1f, baseline %.1f (tolerance %.0f%%)\n",
+               name, metric, val, base, tol * 100);
+        regressions++;
+      }
+    }
+  }
+  fclose(f);
+  for (i = 0; i < bench_num_results; i++) {
+    for (m = 0; m < NUM_BENCH_METRICS; m++) {
+      if (!(seen[i] & (1 << m))) {
+        printf("FAIL: %s %s has no baseline value (make bench-record)\n",
+               bench_results[i].name, bench_metrics[m].name);
+        regressions++;
+      }
+    }
+    if (bench_results[i].errors != 0) {
+      printf("FAIL: %s had %"U32_F" failed requests\n", bench_results[i].name,
+             bench_results[i].errors);
+      regressions++;
+    }
+  }
+  if (checked == 0) {
+    printf("FAIL: no baseline values in %s\n", path);
+    regressions++;
+  }
+  printf("%d baseline values checked, %d regressions\n", checked, regressions);
+  return regressions;
+}
+
+static void
+bench_start_httpd(void *arg)
+{
+  httpd_init(NULL);
+  sys_sem_signal((sys_sem_t *)arg);
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *baseline = NULL, *record = NULL;
+  double tolerance = 0.20;
+  u32_t requests = BENCH_DEFAULT_REQUESTS;
+  sys_sem_t started;
+  size_t w;
+  int opt, c;
+
+  while ((opt = getopt(argc, argv, "n:t:b:r:")) != -1) {
+    switch (opt) {
+    case 'n': requests = (u32_t)strtoul(optarg, NULL, 10); break;
+    case 't': tolerance = atof(optarg) / 100.0; break;
+    case 'b': baseline = optarg; break;
+    case 'r': record = optarg; break;
+    default:
+      fprintf(stderr, "usage: %s [-n requests] [-t tolerance%%] [-b baseline] [-r record]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (requests < BENCH_MAX_CLIENTS) {
+    requests = BENCH_MAX_CLIENTS;
+  }
+
+  tcpip_init(NULL, NULL);
+  sys_sem_new(&started, 0);
+  tcpip_callback(bench_start_httpd, &started);
+  sys_arch_sem_wait(&started, 0);
+  sys_sem_free(&started);
+
+  /* warm up, then start counting from zero */
+  for (c = 0; c < BENCH_WARMUP_REQUESTS; c++) {
+    bench_request(bench_workloads[0].request, strlen(bench_workloads[0].request));
+  }
+  httpd_reset_stats();
+
+  printf("%-16s %10s %10s %10s %10s %10s %10s %7s\n", "workload", "req/s", "p50 us",
+         "p99 us", "copied", "segments", "peak heap", "errors");
+  for (w = 0; w < NUM_BENCH_WORKLOADS; w++) {
+    bench_run(bench_workloads[w].name, &bench_workloads[w], requests, 1);
+  }
+  for (c = 2; c <= BENCH_MAX_CLIENTS; c++) {
+    char name[BENCH_NAME_LEN];
+    snprintf(name, sizeof(name), "ramp_c%d", c);
+    bench_run(name, &bench_workloads[BENCH_RAMP_WORKLOAD], requests, c);
+  }
+  {
+    struct httpd_stats stats;
+    httpd_get_stats(&stats);
+    printf("tcp_write: %"U32_F" sized to the send buffer (ERR_MEM retries avoided), "
+           "%"U32_F" ERR_MEM\n", stats.writes_avoided, stats.write_errs);
+  }
+
+  if (record != NULL) {
+    return bench_record(record);
+  }
+  if (baseline != NULL) {
+    return bench_compare(baseline, tolerance) ? 1 : 0;
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Entry point of the host (Linux) build: brings up lwIP on a tap
+ * interface and starts the httpd exactly like user_init() does on the
+ * device.
+ *
+ * The tap device gets HOST_GW_ADDR on the Linux side, so the server is
+ * reachable from the dev box at http://HOST_IPADDR/ once it is running.
+ * Send SIGINT to print the lwIP heap statistics and exit.
+ */
+#include <signal.h>
+#include <unistd.h>
+
+#include "lwip/opt.h"
+#include "lwip/ip_addr.h"
+#include "lwip/netif.h"
+#include "lwip/stats.h"
+#include "lwip/sys.h"
+#include "lwip/tcpip.h"
+#include "netif/tapif.h"
+
+#include "httpd.h"
+
+#ifndef HOST_IPADDR
+#define HOST_IPADDR     "192.168.4.1"
+#endif
+#ifndef HOST_NETMASK
+#define HOST_NETMASK    "255.255.255.0"
+#endif
+#ifndef HOST_GW_ADDR
+#define HOST_GW_ADDR    "192.168.4.2"
+#endif
+
+static struct netif host_netif;
+static volatile sig_atomic_t host_stop;
+
+static void
+host_sigint(int sig)
+{
+    (void)sig;
+    host_stop = 1;
+}
+
+/* Runs in the tcpip thread: the raw API used by the httpd is not thread safe */
+static void
+host_start(void *arg)
+{
+    sys_sem_t *started = (sys_sem_t *)arg;
+    ip_addr_t ipaddr, netmask, gw;
+
+    ipaddr.addr = ipaddr_addr(HOST_IPADDR);
+    netmask.addr = ipaddr_addr(HOST_NETMASK);
+    gw.addr = ipaddr_addr(HOST_GW_ADDR);
+
+    netif_add(&host_netif, &ipaddr, &netmask, &gw, NULL, tapif_init, tcpip_input);
+    netif_set_default(&host_netif);
+    netif_set_up(&host_netif);
+
+    httpd_init(NULL);
+    sys_sem_signal(started);
+}
+
+int
+main(void)
+{
+    sys_sem_t started;
+
+    signal(SIGINT, host_sigint);
+
+    tcpip_init(NULL, NULL);
+    if (sys_sem_new(&started, 0) != ERR_OK) {
+        fprintf(stderr, "httpd_host: sys_sem_new failed\n");
+        return 1;
+    }
+    tcpip_callback(host_start, &started);
+    sys_arch_sem_wait(&started, 0);
+    sys_sem_free(&started);
+
+    printf("httpd_host: serving on http://%s/\n", HOST_IPADDR);
+    while (!host_stop)
+        pause();
+
+#if MEM_STATS
+    printf("httpd_host: heap used %u, peak %u of %u bytes, %u failed allocations\n",
+           (unsigned)lwip_stats.mem.used, (unsigned)lwip_stats.mem.max,
+           (unsigned)lwip_stats.mem.avail, (unsigned)lwip_stats.mem.err);
+#endif
+    return 0;
+}
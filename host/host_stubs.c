@@ -0,0 +1,128 @@
+/*
+ * Host stand-ins for the ESP8266 SDK functions used by the server core and
+ * the page_*.c handlers.
+ */
+#include "esp_common.h"
+#include "lwip/mem.h"
+#include "lwip/stats.h"
+#include "lwip/timers.h"
+
+static struct softap_config host_softap_config = {
+    "ESP_HOST",             /* ssid */
+    "",                     /* password */
+    8,                      /* ssid_len */
+    1,                      /* channel */
+    AUTH_OPEN,              /* authmode */
+    0,                      /* ssid_hidden */
+    4,                      /* max_connection */
+    100                     /* beacon_interval */
+};
+
+bool
+wifi_softap_get_config(struct softap_config *config)
+{
+    if (config == NULL)
+        return false;
+    memcpy(config, &host_softap_config, sizeof(struct softap_config));
+    return true;
+}
+
+bool
+wifi_softap_set_config(struct softap_config *config)
+{
+    if (config == NULL)
+        return false;
+    memcpy(&host_softap_config, config, sizeof(struct softap_config));
+    return true;
+}
+
+/* Enough stations for a response of several windows */
+#define HOST_STATIONS   100
+
+static struct station_info host_stations[HOST_STATIONS];
+
+struct station_info *
+wifi_softap_get_station_info(void)
+{
+    int i;
+
+    for (i = 0; i < HOST_STATIONS; i++) {
+        struct station_info *sta = &host_stations[i];
+        memset(sta->bssid, 0, sizeof(sta->bssid));
+        sta->bssid[0] = 0x02;
+        sta->bssid[5] = (uint8)i;
+        IP4_ADDR(&sta->ip, 192, 168, 4, 2 + i);
+        sta->next.stqe_next = (i + 1 < HOST_STATIONS) ? &host_stations[i + 1] : NULL;
+    }
+    return &host_stations[0];
+}
+
+void
+wifi_softap_free_station_info(void)
+{
+}
+
+/* A scan takes this long, and finds these access points */
+#define HOST_SCAN_MS    1500
+
+static struct bss_info host_bss[] = {
+    { { NULL }, { 0x02, 0, 0, 0, 1, 1 }, "ESP_HOST_NEIGHBOUR", 18, 6, -48, AUTH_WPA2_PSK, 0 },
+    { { NULL }, { 0x02, 0, 0, 0, 1, 2 }, "guest", 5, 11, -71, AUTH_OPEN, 0 },
+    { { NULL }, { 0x02, 0, 0, 0, 1, 3 }, "\"quoted\"", 8, 1, -83, AUTH_WPA_WPA2_PSK, 0 },
+};
+
+#define HOST_BSS_COUNT  (sizeof(host_bss) / sizeof(host_bss[0]))
+
+static scan_done_cb_t host_scan_cb;
+
+/* Runs in the tcpip thread, unlike the callback on the device */
+static void
+host_scan_done(void *arg)
+{
+    scan_done_cb_t cb = host_scan_cb;
+    size_t i;
+
+    (void)arg;
+    for (i = 0; i < HOST_BSS_COUNT; i++)
+        host_bss[i].next.stqe_next = (i + 1 < HOST_BSS_COUNT) ? &host_bss[i + 1] : NULL;
+    host_scan_cb = NULL;
+    cb(&host_bss[0], OK);
+}
+
+/* Called from the tcpip thread (by the handlers) */
+bool
+wifi_station_scan(struct scan_config *config, scan_done_cb_t cb)
+{
+    (void)config;
+    if (host_scan_cb != NULL)
+        return false;
+    host_scan_cb = cb;
+    sys_timeout(HOST_SCAN_MS, host_scan_done, NULL);
+    return true;
+}
+
+uint32
+system_get_free_heap_size(void)
+{
+#if MEM_STATS
+    return (uint32)(lwip_stats.mem.avail - lwip_stats.mem.used);
+#else
+    return 0;
+#endif
+}
+
+/* malloc()/free() of the server core objects, see the Makefile */
+void *
+host_malloc(size_t size)
+{
+    if (size > (mem_size_t)-1)
+        return NULL;
+    return mem_malloc((mem_size_t)size);
+}
+
+void
+host_free(void *ptr)
+{
+    if (ptr != NULL)
+        mem_free(ptr);
+}
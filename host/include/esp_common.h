@@ -0,0 +1,90 @@
+/*
+ * Stand-in for the ESP8266 SDK's esp_common.h, used by the host build.
+ *
+ * Only what the server core and the page_*.c handlers use is provided.
+ */
+#ifndef __ESP_COMMON_H__
+#define __ESP_COMMON_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include "lwip/opt.h"
+#include "lwip/ip_addr.h"
+
+typedef uint8_t  uint8;
+typedef int8_t   sint8;
+typedef uint16_t uint16;
+typedef int16_t  sint16;
+typedef uint32_t uint32;
+typedef int32_t  sint32;
+
+#define zalloc(size)  calloc(1, (size))
+
+typedef enum _auth_mode {
+    AUTH_OPEN = 0,
+    AUTH_WEP,
+    AUTH_WPA_PSK,
+    AUTH_WPA2_PSK,
+    AUTH_WPA_WPA2_PSK,
+    AUTH_MAX
+} AUTH_MODE;
+
+struct softap_config {
+    uint8 ssid[32];
+    uint8 password[64];
+    uint8 ssid_len;
+    uint8 channel;
+    AUTH_MODE authmode;
+    uint8 ssid_hidden;
+    uint8 max_connection;
+    uint16 beacon_interval;
+};
+
+struct station_info {
+    STAILQ_ENTRY(station_info) next;
+    uint8 bssid[6];
+    struct ip_addr ip;
+};
+
+typedef enum {
+    OK = 0,
+    FAIL,
+    PENDING,
+    BUSY,
+    CANCEL
+} STATUS;
+
+struct bss_info {
+    STAILQ_ENTRY(bss_info) next;
+    uint8 bssid[6];
+    uint8 ssid[32];
+    uint8 ssid_len;
+    uint8 channel;
+    sint8 rssi;
+    AUTH_MODE authmode;
+    uint8 is_hidden;
+};
+
+struct scan_config {
+    uint8 *ssid;
+    uint8 *bssid;
+    uint8 channel;
+    uint8 show_hidden;
+};
+
+typedef void (*scan_done_cb_t)(void *arg, STATUS status);
+
+/* host_stubs.c */
+bool wifi_softap_get_config(struct softap_config *config);
+bool wifi_softap_set_config(struct softap_config *config);
+struct station_info *wifi_softap_get_station_info(void);
+void wifi_softap_free_station_info(void);
+bool wifi_station_scan(struct scan_config *config, scan_done_cb_t cb);
+uint32 system_get_free_heap_size(void);
+
+#endif /* __ESP_COMMON_H__ */
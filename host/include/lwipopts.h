@@ -0,0 +1,80 @@
+/*
+ * lwIP options for the host (Linux) build of the httpd.
+ *
+ * The sizes below follow the ESP8266 SDK configuration closely enough for
+ * throughput and heap measurements taken on the host to be meaningful for
+ * the device: a small lwIP heap that is shared with the handlers (the
+ * server objects have malloc/free renamed to host_malloc/host_free by the
+ * objcopy rule in Makefile, host_stubs.c implements those on mem_malloc),
+ * few PCBs and a 2*MSS send buffer.
+ */
+#ifndef __LWIPOPTS_H__
+#define __LWIPOPTS_H__
+
+/* Attributes used by the firmware sources to place code and constants in
+ * flash; meaningless on the host. */
+#ifndef ICACHE_FLASH_ATTR
+#define ICACHE_FLASH_ATTR
+#endif
+#ifndef ICACHE_RODATA_ATTR
+#define ICACHE_RODATA_ATTR
+#endif
+
+#define NO_SYS                          0
+#define SYS_LIGHTWEIGHT_PROT            1
+#define LWIP_NETCONN                    1
+#define LWIP_SOCKET                     1
+#define LWIP_COMPAT_SOCKETS             0
+#define LWIP_POSIX_SOCKETS_IO_NAMES     0
+#define SO_REUSE                        1
+
+/* ---------- Memory options ---------- */
+#define MEM_ALIGNMENT                   4
+#define MEM_LIBC_MALLOC                 0
+/* Roughly the free heap left to the application on the ESP8266 */
+#ifndef MEM_SIZE
+#define MEM_SIZE                        (40 * 1024)
+#endif
+#define MEMP_NUM_PBUF                   16
+#define MEMP_NUM_UDP_PCB                4
+#ifndef MEMP_NUM_TCP_PCB
+#define MEMP_NUM_TCP_PCB                5
+#endif
+#define MEMP_NUM_TCP_PCB_LISTEN         2
+#define MEMP_NUM_TCP_SEG                32
+#define MEMP_NUM_NETBUF                 8
+#define MEMP_NUM_NETCONN                (MEMP_NUM_TCP_PCB + MEMP_NUM_UDP_PCB)
+#define PBUF_POOL_SIZE                  32
+
+/* ---------- TCP options ---------- */
+#define LWIP_TCP                        1
+#define TCP_MSS                         1460
+#define TCP_SND_BUF                     (2 * TCP_MSS)
+#define TCP_SND_QUEUELEN                ((4 * (TCP_SND_BUF) + (TCP_MSS - 1)) / (TCP_MSS))
+#define TCP_WND                         (4 * TCP_MSS)
+#define TCP_LISTEN_BACKLOG              1
+
+/* ---------- Interfaces ---------- */
+#define LWIP_ARP                        1
+#define LWIP_ETHERNET                   1
+#define LWIP_DHCP                       0
+#define LWIP_HAVE_LOOPIF                1
+#define LWIP_NETIF_LOOPBACK             1
+#define LWIP_LOOPBACK_MAX_PBUFS         32
+
+/* ---------- Thread options ---------- */
+#define TCPIP_THREAD_NAME               "tcpip"
+#define TCPIP_THREAD_STACKSIZE          8192
+#define TCPIP_THREAD_PRIO               3
+#define TCPIP_MBOX_SIZE                 32
+#define DEFAULT_RAW_RECVMBOX_SIZE       8
+#define DEFAULT_UDP_RECVMBOX_SIZE       8
+#define DEFAULT_TCP_RECVMBOX_SIZE       16
+#define DEFAULT_ACCEPTMBOX_SIZE         8
+
+/* ---------- Statistics ---------- */
+#define LWIP_STATS                      1
+#define MEM_STATS                       1
+#define LWIP_STATS_DISPLAY              1
+
+#endif /* __LWIPOPTS_H__ */
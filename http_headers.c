@@ -0,0 +1,153 @@
+/* Generated by tools/mkheaders from headers.def, do not edit. */
+
+#include "esp_common.h"
+#include "http_headers.h"
+
+#define HDR(s)	{ s, sizeof(s) - 1 }
+#define SERVER	"Server: " HTTPD_SERVER_AGENT "\r\n"
+
+static const uint32_t http_hdr_codes[] ICACHE_RODATA_ATTR = {
+	200, 400, 404, 413, 415, 417, 500, 501
+};
+
+/* [status][HTTP/1.1][keep-alive], each up to the framing */
+static const HTTPHdrString http_hdr_blocks[] ICACHE_RODATA_ATTR = {
+	HDR("HTTP/1.0 200 OK\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.0 200 OK\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.1 200 OK\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.1 200 OK\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.0 400 Bad Request\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.0 400 Bad Request\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.1 400 Bad Request\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.1 400 Bad Request\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.0 404 Not Found\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.0 404 Not Found\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.1 404 Not Found\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.1 404 Not Found\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.0 413 Payload Too Large\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.0 413 Payload Too Large\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.1 413 Payload Too Large\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.1 413 Payload Too Large\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.0 415 Unsupported Media Type\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.0 415 Unsupported Media Type\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.1 415 Unsupported Media Type\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.1 415 Unsupported Media Type\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.0 417 Expectation Failed\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.0 417 Expectation Failed\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.1 417 Expectation Failed\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.1 417 Expectation Failed\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.0 500 Internal Server Error\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.0 500 Internal Server Error\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.1 500 Internal Server Error\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.1 500 Internal Server Error\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.0 501 Not Implemented\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.0 501 Not Implemented\r\n" SERVER "Connection: keep-alive\r\n"),
+	HDR("HTTP/1.1 501 Not Implemented\r\n" SERVER "Connection: Close\r\n"),
+	HDR("HTTP/1.1 501 Not Implemented\r\n" SERVER "Connection: keep-alive\r\n"),
+};
+
+/* the content type and the blank line */
+static const HTTPHdrString http_hdr_types[] ICACHE_RODATA_ATTR = {
+	HDR("Content-type: text/plain\r\n\r\n"),
+	HDR("Content-type: application/json\r\n\r\n"),
+	HDR("Content-type: text/html\r\n\r\n"),
+	HDR("Content-type: text/css\r\n\r\n"),
+	HDR("Content-type: application/x-javascript\r\n\r\n"),
+	HDR("Content-type: text/xml\r\n\r\n"),
+	HDR("Content-type: text/csv\r\n\r\n"),
+	HDR("Content-type: image/gif\r\n\r\n"),
+	HDR("Content-type: image/png\r\n\r\n"),
+	HDR("Content-type: image/jpeg\r\n\r\n"),
+	HDR("Content-type: image/bmp\r\n\r\n"),
+	HDR("Content-type: image/x-icon\r\n\r\n"),
+	HDR("Content-type: application/octet-stream\r\n\r\n"),
+	HDR("Content-type: application/x-shockwave-flash\r\n\r\n"),
+};
+
+/* slot = router_hash(ext, len, seed) & mask: {hash, len << 16 | type + 1} */
+static const uint32_t http_hdr_slots[] ICACHE_RODATA_ATTR = {
+	0xf7d388e0u, 0x0003000eu, /* swf: application/x-shockwave-flash */
+	0xe54646a1u, 0x00030007u, /* csv: text/csv */
+	0, 0,
+	0x3c133063u, 0x0003000bu, /* bmp: image/bmp */
+	0, 0,
+	0xd06606e5u, 0x0003000du, /* cls: application/octet-stream */
+	0, 0,
+	0xe1707467u, 0x00050003u, /* shtml: text/html */
+	0, 0,
+	0x03c86349u, 0x00040003u, /* shtm: text/html */
+	0xbebd210au, 0x0005000du, /* class: application/octet-stream */
+	0xf70f0eebu, 0x00030003u, /* htm: text/html */
+	0, 0,
+	0x4ca3b6cdu, 0x00030006u, /* xml: text/xml */
+	0xe0467c4eu, 0x00030004u, /* css: text/css */
+	0, 0,
+	0, 0,
+	0xf9f952d1u, 0x0003000au, /* jpg: image/jpeg */
+	0, 0,
+	0x410103f3u, 0x00020005u, /* js: application/x-javascript */
+	0x8cb21274u, 0x0003000cu, /* ico: image/x-icon */
+	0xba61ea55u, 0x00030009u, /* png: image/png */
+	0x387d6196u, 0x00040002u, /* json: application/json */
+	0, 0,
+	0x13015c18u, 0x00030008u, /* gif: image/gif */
+	0, 0,
+	0, 0,
+	0, 0,
+	0x89870cdcu, 0x00030005u, /* ram: application/x-javascript */
+	0x7625a73du, 0x00040003u, /* html: text/html */
+	0, 0,
+	0x1cc930dfu, 0x00030003u, /* ssi: text/html */
+};
+
+static const char *const http_hdr_exts[] ICACHE_RODATA_ATTR = {
+	"swf",
+	"csv",
+	NULL,
+	"bmp",
+	NULL,
+	"cls",
+	NULL,
+	"shtml",
+	NULL,
+	"shtm",
+	"class",
+	"htm",
+	NULL,
+	"xml",
+	"css",
+	NULL,
+	NULL,
+	"jpg",
+	NULL,
+	"js",
+	"ico",
+	"png",
+	"json",
+	NULL,
+	"gif",
+	NULL,
+	NULL,
+	NULL,
+	"ram",
+	"html",
+	NULL,
+	"ssi",
+};
+
+const HTTPHdrTable http_hdr_table = {
+	http_hdr_codes,
+	8, /* statuses */
+	http_hdr_blocks,
+	http_hdr_types,
+	http_hdr_slots,
+	http_hdr_exts,
+	0x000005f8u, /* seed */
+	31, /* mask */
+	0, /* other extensions: text/plain */
+	1, /* no extension: application/json */
+	HDR("Content-Length: "),
+	HDR("Transfer-Encoding: chunked\r\n"),
+	sizeof("HTTP/1.1 415 Unsupported Media Type\r\n" SERVER "Connection: keep-alive\r\n") - 1 +
+		28 + 47 /* longest header */
+};
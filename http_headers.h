@@ -0,0 +1,40 @@
+/* Response header blocks and content types, generated into http_headers.c
+ * by tools/mkheaders from headers.def */
+
+#ifndef _HTTP_HEADERS_H
+#define _HTTP_HEADERS_H
+#include <stdint.h>
+
+/** This string is passed in the HTTP header as "Server: " */
+#ifndef HTTPD_SERVER_AGENT
+#define HTTPD_SERVER_AGENT "ESP8266/1.0"
+#endif
+
+typedef struct http_hdr_string
+{
+	const char *s;
+	uint32_t len;
+} HTTPHdrString;
+
+/* 32-bit fields only since the table is kept in flash */
+typedef struct http_hdr_table
+{
+	const uint32_t *codes;		/* status codes, in the order of the blocks */
+	uint32_t num_codes;
+	const HTTPHdrString *blocks;	/* [status][HTTP/1.1][keep-alive]: from the
+					   status line to the Connection header */
+	const HTTPHdrString *types;	/* "Content-type: ...\r\n\r\n" */
+	const uint32_t *slots;		/* 2 words per slot: {hash, len << 16 | type + 1} */
+	const char *const *exts;	/* the extension of each slot */
+	uint32_t seed;
+	uint32_t mask;			/* number of slots - 1 */
+	uint32_t type_default;		/* for extensions that are not listed */
+	uint32_t type_noext;		/* for URIs without an extension */
+	HTTPHdrString content_length;	/* "Content-Length: ", the digits and a CRLF follow */
+	HTTPHdrString chunked;		/* the Transfer-Encoding: chunked line */
+	uint32_t max_len;		/* longest header: block, framing and type */
+} HTTPHdrTable;
+
+extern const HTTPHdrTable http_hdr_table;
+
+#endif
@@ -1,9 +1,85 @@
 #ifndef _HTTP_REQUEST_H
 #define _HTTP_REQUEST_H
+
+/* request methods, also the index of the handler slots in URLRouter */
+#define HTTP_METHOD_GET		0
+#define HTTP_METHOD_POST	1
+#define HTTP_METHOD_PUT		2
+#define HTTP_METHOD_DELETE	3
+#define HTTP_METHOD_COUNT	4
+
+/* maximum number of ":param" and "*" matches kept for a request */
+#define HTTP_MAX_PATH_ARGS	4
+
+/* zero-copy reference to a part of the request, relative to uri */
+typedef struct http_slice {
+	uint16_t off;
+	uint16_t len;
+} HTTPSlice;
+
+/* request headers the parser records in HTTPRequest.hdr, for http_header() */
+#define HTTP_HDR_HOST			0
+#define HTTP_HDR_CONNECTION		1
+#define HTTP_HDR_ACCEPT_ENCODING	2
+#define HTTP_HDR_IF_NONE_MATCH		3
+#define HTTP_HDR_CONTENT_TYPE		4
+#define HTTP_HDR_RANGE			5
+#define HTTP_HDR_COUNT			6
+
+/* number of other headers recorded for http_header_find(), later ones
+   are skipped; 0 records none */
+#ifndef HTTP_MAX_HEADERS
+#define HTTP_MAX_HEADERS	4
+#endif
+
+/* a header other than the HTTP_HDR_* ones: its value follows the ':' */
+typedef struct http_header {
+	uint16_t name_off;	/* relative to uri */
+	uint16_t value_len;
+	uint8_t name_len;
+} HTTPHeader;
+
+/* Index of the key=value pairs of a query string or a form body, built by
+   the server before the handler runs (api.c). Keys and values are slices
+   of the indexed string; a pair is percent-decoded in place when the
+   handler first reads it. Followed in memory by 'count' HTTPParam and by
+   'mask + 1' hash slots holding a pair's index + 1 (0: free). */
+typedef struct http_param {
+	HTTPSlice key;
+	HTTPSlice value;
+} HTTPParam;
+
+typedef struct http_params {
+	uint32_t decoded;	/* bit n: pair n is decoded */
+	uint16_t len;		/* length of the indexed string */
+	uint8_t count;
+	uint8_t mask;		/* hash slots - 1 */
+	HTTPParam param[1];
+} HTTPParams;
+
+struct httpd_arena_chunk;
+
 typedef struct http_request {
 	char *uri;
-	char *post_data;
+	char *post_data;	/* NUL-terminated body, unless the route streams it */
+	uint32_t post_len;	/* body bytes received so far */
+	uint32_t content_len;	/* Content-Length of the body */
+	void *connection;	/* for httpd_post_data_recved() and httpd_defer() */
+	struct httpd_arena_chunk *arena;	/* http_alloc() memory, see httpd_arena.h */
 	uint8_t is_post;
+	uint8_t method;		/* HTTP_METHOD_* */
+	uint8_t path_argc;
+	uint8_t hdr_count;	/* entries of hdrs in use */
+	uint16_t status;	/* response status: 200, 404 for the 404 page,
+				   handlers may set another one */
 	char *params;
+	HTTPParams *query;	/* index of params, NULL if there are none */
+	HTTPParams *form;	/* index of post_data, NULL if there is none */
+	HTTPSlice path_args[HTTP_MAX_PATH_ARGS];	/* path parameters, in pattern order */
+	HTTPSlice hdr[HTTP_HDR_COUNT];	/* value of each HTTP_HDR_*, as received;
+					   off is 0 if the request has none */
+#if HTTP_MAX_HEADERS
+	HTTPHeader hdrs[HTTP_MAX_HEADERS];
+#endif
 } HTTPRequest;
 #endif
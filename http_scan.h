@@ -0,0 +1,160 @@
+/* Delimiter scanning kernel for the request parser.
+ *
+ * http_scan() returns the offset of the first byte of s[0..len) that is in
+ * the given set of delimiter classes, or len if there is none. The set is
+ * meant to be a compile time constant so each caller gets a kernel that
+ * only compares against the delimiters it asked for.
+ *
+ * The portable version (used on the ESP8266) tests four bytes per aligned
+ * 32-bit load. Host builds use SSE2, or AVX2 when compiled with -mavx2.
+ * All variants are available under their own names for host/bench. */
+
+#ifndef _HTTP_SCAN_H
+#define _HTTP_SCAN_H
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define HTTP_SCAN_CR	0x01
+#define HTTP_SCAN_LF	0x02
+#define HTTP_SCAN_SP	0x04
+#define HTTP_SCAN_QMARK	0x08
+#define HTTP_SCAN_AMP	0x10
+#define HTTP_SCAN_COLON	0x20
+
+#define HTTP_SCAN_EOL	(HTTP_SCAN_CR | HTTP_SCAN_LF)
+
+static inline int
+http_scan_is(uint8_t c, uint32_t set)
+{
+	return ((set & HTTP_SCAN_CR) && (c == '\r')) ||
+	       ((set & HTTP_SCAN_LF) && (c == '\n')) ||
+	       ((set & HTTP_SCAN_SP) && (c == ' ')) ||
+	       ((set & HTTP_SCAN_QMARK) && (c == '?')) ||
+	       ((set & HTTP_SCAN_AMP) && (c == '&')) ||
+	       ((set & HTTP_SCAN_COLON) && (c == ':'));
+}
+
+/* Reference version, one byte at a time */
+static inline size_t
+http_scan_byte(const char *s, size_t len, uint32_t set)
+{
+	size_t i;
+	for (i = 0; i < len; i++) {
+		if (http_scan_is((uint8_t)s[i], set))
+			break;
+	}
+	return i;
+}
+
+/* Nonzero if one of the bytes of w equals c. Borrows can only flag bytes
+ * above a real match, so a nonzero result is never a false positive. */
+#define HTTP_SCAN_HAS(w, c) \
+	((((w) ^ (0x01010101u * (uint8_t)(c))) - 0x01010101u) & \
+	 ~((w) ^ (0x01010101u * (uint8_t)(c))) & 0x80808080u)
+
+typedef uint32_t __attribute__((__may_alias__)) http_scan_word;
+
+/* SWAR version: aligned 32-bit loads only, the Xtensa core faults on
+ * unaligned ones */
+static inline size_t
+http_scan_swar(const char *s, size_t len, uint32_t set)
+{
+	size_t i = 0;
+	while ((i < len) && (((uintptr_t)(s + i) & 3) != 0)) {
+		if (http_scan_is((uint8_t)s[i], set))
+			return i;
+		i++;
+	}
+	for (; i + 4 <= len; i += 4) {
+		uint32_t w = *(const http_scan_word *)(s + i);
+		uint32_t hit = 0;
+		if (set & HTTP_SCAN_CR)
+			hit |= HTTP_SCAN_HAS(w, '\r');
+		if (set & HTTP_SCAN_LF)
+			hit |= HTTP_SCAN_HAS(w, '\n');
+		if (set & HTTP_SCAN_SP)
+			hit |= HTTP_SCAN_HAS(w, ' ');
+		if (set & HTTP_SCAN_QMARK)
+			hit |= HTTP_SCAN_HAS(w, '?');
+		if (set & HTTP_SCAN_AMP)
+			hit |= HTTP_SCAN_HAS(w, '&');
+		if (set & HTTP_SCAN_COLON)
+			hit |= HTTP_SCAN_HAS(w, ':');
+		if (hit)
+			break;
+	}
+	/* the match (or the tail) is within the next four bytes; finishing
+	 * bytewise keeps this independent of the byte order */
+	return i + http_scan_byte(s + i, len - i, set);
+}
+
+#if defined(__SSE2__)
+#define HTTP_SCAN_SSE2_EQ(m, v, set, cls, c) \
+	if ((set) & (cls)) \
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(c)))
+
+static inline size_t
+http_scan_sse2(const char *s, size_t len, uint32_t set)
+{
+	size_t i;
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i m = _mm_setzero_si128();
+		int bits;
+		HTTP_SCAN_SSE2_EQ(m, v, set, HTTP_SCAN_CR, '\r');
+		HTTP_SCAN_SSE2_EQ(m, v, set, HTTP_SCAN_LF, '\n');
+		HTTP_SCAN_SSE2_EQ(m, v, set, HTTP_SCAN_SP, ' ');
+		HTTP_SCAN_SSE2_EQ(m, v, set, HTTP_SCAN_QMARK, '?');
+		HTTP_SCAN_SSE2_EQ(m, v, set, HTTP_SCAN_AMP, '&');
+		HTTP_SCAN_SSE2_EQ(m, v, set, HTTP_SCAN_COLON, ':');
+		bits = _mm_movemask_epi8(m);
+		if (bits)
+			return i + (size_t)__builtin_ctz((unsigned)bits);
+	}
+	return i + http_scan_swar(s + i, len - i, set);
+}
+#endif
+
+#if defined(__AVX2__)
+#define HTTP_SCAN_AVX2_EQ(m, v, set, cls, c) \
+	if ((set) & (cls)) \
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)))
+
+static inline size_t
+http_scan_avx2(const char *s, size_t len, uint32_t set)
+{
+	size_t i;
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i m = _mm256_setzero_si256();
+		unsigned bits;
+		HTTP_SCAN_AVX2_EQ(m, v, set, HTTP_SCAN_CR, '\r');
+		HTTP_SCAN_AVX2_EQ(m, v, set, HTTP_SCAN_LF, '\n');
+		HTTP_SCAN_AVX2_EQ(m, v, set, HTTP_SCAN_SP, ' ');
+		HTTP_SCAN_AVX2_EQ(m, v, set, HTTP_SCAN_QMARK, '?');
+		HTTP_SCAN_AVX2_EQ(m, v, set, HTTP_SCAN_AMP, '&');
+		HTTP_SCAN_AVX2_EQ(m, v, set, HTTP_SCAN_COLON, ':');
+		bits = (unsigned)_mm256_movemask_epi8(m);
+		if (bits)
+			return i + (size_t)__builtin_ctz(bits);
+	}
+	return i + http_scan_sse2(s + i, len - i, set);
+}
+#endif
+
+static inline size_t
+http_scan(const char *s, size_t len, uint32_t set)
+{
+#if defined(__AVX2__)
+	return http_scan_avx2(s, len, set);
+#elif defined(__SSE2__)
+	return http_scan_sse2(s, len, set);
+#else
+	return http_scan_swar(s, len, set);
+#endif
+}
+
+#endif
@@ -83,8 +83,14 @@
 #include "httpd_structs.h"
 #include "lwip/tcp.h"
 #include "fs.h"
-#include "api_struct.h"
+#include "api.h"
 #include "http_request.h"
+#include "http_scan.h"
+#include "router_hash.h"
+#include "httpd_worker.h"
+#include "httpd_state.h"
+#include "httpd_arena.h"
+#include "httpd_multipart.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -95,15 +101,6 @@
 #define HTTPD_DEBUG         LWIP_DBG_OFF
 #endif
 
-/** Set this to 1 and add the next line to lwippools.h to use a memp pool
- * for allocating struct http_state instead of the heap:
- *
- * LWIP_MEMPOOL(HTTPD_STATE, 20, 100, "HTTPD_STATE")
- */
-#ifndef HTTPD_USE_MEM_POOL
-#define HTTPD_USE_MEM_POOL  0
-#endif
-
 /** The server port for HTTPD to use */
 #ifndef HTTPD_SERVER_PORT
 #define HTTPD_SERVER_PORT                   80
@@ -129,19 +126,10 @@
 #define HTTPD_TCP_PRIO                      TCP_PRIO_MIN
 #endif
 
-/** Set this to 1 to enabled timing each file sent */
-#ifndef LWIP_HTTPD_TIMING
-#define LWIP_HTTPD_TIMING                   0
-#endif
 #ifndef HTTPD_DEBUG_TIMING
 #define HTTPD_DEBUG_TIMING                  LWIP_DBG_OFF
 #endif
 
-/** Set this to 1 on platforms where strnstr is not available */
-#ifndef LWIP_HTTPD_STRNSTR_PRIVATE
-#define LWIP_HTTPD_STRNSTR_PRIVATE          1
-#endif
-
 /** Set this to one to show error pages when parsing a request fails instead
     of simply closing the connection. */
 #ifndef LWIP_HTTPD_SUPPORT_EXTSTATUS
@@ -153,31 +141,43 @@
 #define LWIP_HTTPD_SUPPORT_V09              1
 #endif
 
-/** Set this to 1 to support HTTP request coming in in multiple packets/pbufs */
-#ifndef LWIP_HTTPD_SUPPORT_REQUESTLIST
-#define LWIP_HTTPD_SUPPORT_REQUESTLIST      0
-#endif
-
-#if LWIP_HTTPD_SUPPORT_REQUESTLIST
-/** Number of rx pbufs to enqueue to parse an incoming request (up to the first
-    newline) */
+/** Number of rx pbufs to enqueue while the head of a request (request line
+    and headers) is incomplete */
 #ifndef LWIP_HTTPD_REQ_QUEUELEN
 #define LWIP_HTTPD_REQ_QUEUELEN             10
 #endif
 
-/** Number of (TCP payload-) bytes (in pbufs) to enqueue to parse and incoming
-    request (up to the first double-newline) */
-#ifndef LWIP_HTTPD_REQ_BUFSIZE
-#define LWIP_HTTPD_REQ_BUFSIZE              LWIP_HTTPD_MAX_REQ_LENGTH
+/** Maximum length of the head of a request (request line and headers).
+    Heads that arrive in one pbuf are parsed in place; only a head split
+    across pbufs is copied, once, into a buffer of its own. */
+#ifndef LWIP_HTTPD_MAX_REQ_LENGTH
+#define LWIP_HTTPD_MAX_REQ_LENGTH           2048
 #endif
 
-/** Defines the maximum length of a HTTP request line (up to the first CRLF,
-    copied from pbuf into this a global buffer when pbuf- or packet-queues
-    are received - otherwise the input pbuf is used directly) */
-#ifndef LWIP_HTTPD_MAX_REQ_LENGTH
-#define LWIP_HTTPD_MAX_REQ_LENGTH           1023
+/** Number of poll intervals (HTTPD_POLL_INTERVAL) a persistent connection
+    may stay idle between two requests before it is closed */
+#ifndef HTTPD_KEEPALIVE_IDLE_POLLS
+#define HTTPD_KEEPALIVE_IDLE_POLLS          5
+#endif
+
+/** Number of requests served on one persistent connection: the response to
+    the last one closes it, so no client can hold a pcb forever */
+#ifndef LWIP_HTTPD_MAX_KEEPALIVE_REQUESTS
+#define LWIP_HTTPD_MAX_KEEPALIVE_REQUESTS   100
+#endif
+
+/** Number of bytes of pipelined requests (sent before the response to the
+    current one is done) to keep on a persistent connection. If a client is
+    further ahead, the connection is closed after the current response. */
+#ifndef LWIP_HTTPD_MAX_PIPELINED_LEN
+#define LWIP_HTTPD_MAX_PIPELINED_LEN        1024
+#endif
+
+/** Number of poll intervals (HTTPD_POLL_INTERVAL) a deferred response (see
+    httpd_defer) may take before it is completed with a 500 */
+#ifndef LWIP_HTTPD_DEFER_TIMEOUT_POLLS
+#define LWIP_HTTPD_DEFER_TIMEOUT_POLLS      10
 #endif
-#endif /* LWIP_HTTPD_SUPPORT_REQUESTLIST */
 
 /** Maximum length of the filename to send as response to a POST request,
  * filled in by the application when a POST is finished.
@@ -186,6 +186,20 @@
 #define LWIP_HTTPD_POST_MAX_RESPONSE_URI_LEN 63
 #endif
 
+/** Maximum length of a response header. The header is assembled on the
+    stack from the blocks generated from headers.def (see
+    http_hdr_table.max_len) and written in one piece. */
+#ifndef LWIP_HTTPD_MAX_HDR_LEN
+#define LWIP_HTTPD_MAX_HDR_LEN              192
+#endif
+
+/** Largest POST body buffered into req->post_data for routes without a
+ * body handler (larger ones are refused). The buffer is allocated per
+ * connection, to the Content-Length. */
+#ifndef LWIP_HTTPD_POST_MAX_PAYLOAD_LEN
+#define LWIP_HTTPD_POST_MAX_PAYLOAD_LEN     512
+#endif
+
 /** Set this to 0 to not send the SSI tag (default is on, so the tag will
  * be sent in the HTML page */
 #ifndef LWIP_HTTPD_SSI_INCLUDE_TAG
@@ -217,17 +231,21 @@
 /** This was TI's check whether to let TCP copy data or not
 #define HTTP_IS_DATA_VOLATILE(hs) ((hs->file < (char *)0x20000000) ? 0 : TCP_WRITE_FLAG_COPY)*/
 #ifndef HTTP_IS_DATA_VOLATILE
-#if LWIP_HTTPD_SSI
-/* Copy for SSI files, no copy for non-SSI files */
-#define HTTP_IS_DATA_VOLATILE(hs)   ((hs)->tag_check ? TCP_WRITE_FLAG_COPY : 0)
-#else /* LWIP_HTTPD_SSI */
 /** Default: don't copy if the data is sent from file-system directly */
-#define HTTP_IS_DATA_VOLATILE(hs) (((hs->file != NULL) && (hs->handle != NULL) && (hs->file == \
+#define HTTP_IS_DATA_VOLATILE(hs) (((hs->file != NULL) && (hs->handle != NULL) && \
+                                   (hs->handle->data != NULL) && (hs->file == \
                                    (char*)hs->handle->data + hs->handle->len - hs->left)) \
                                    ? 0 : TCP_WRITE_FLAG_COPY)
-#endif /* LWIP_HTTPD_SSI */
 #endif
 
+/** Data written without TCP_WRITE_FLAG_COPY is referenced by the pcb's
+ * segments until they are ACKed (or dropped) */
+#define HTTP_DATA_IN_FLIGHT(pcb) (((pcb)->unsent != NULL) || ((pcb)->unacked != NULL))
+
+/** tcp_close() resets and frees the pcb right away if received data was
+ * not taken (see tcp_close_shutdown()), dropping the queued segments */
+#define HTTP_CLOSE_RESETS(pcb) (((pcb)->refused_data != NULL) || ((pcb)->rcv_wnd != TCP_WND))
+
 /** Default: headers are sent from ROM */
 #ifndef HTTP_IS_HDR_VOLATILE
 #define HTTP_IS_HDR_VOLATILE(hs, ptr) 0
@@ -253,78 +271,149 @@ const default_filename g_psDefaultFilenames[] = {
 #define NUM_DEFAULT_FILENAMES (sizeof(g_psDefaultFilenames) /   \
                                sizeof(default_filename))
 
-#if LWIP_HTTPD_SUPPORT_REQUESTLIST
-/** HTTP request is copied here from pbufs for simple parsing */
-static char httpd_req_buf[LWIP_HTTPD_MAX_REQ_LENGTH+1];
-#endif /* LWIP_HTTPD_SUPPORT_REQUESTLIST */
+#if LWIP_HTTPD_STATS
+static struct httpd_stats httpd_stats_data;
+#define HTTPD_STATS_INC(x)     (httpd_stats_data.x++)
+#define HTTPD_STATS_ADD(x, n)  (httpd_stats_data.x += (u32_t)(n))
+#else /* LWIP_HTTPD_STATS */
+#define HTTPD_STATS_INC(x)
+#define HTTPD_STATS_ADD(x, n)
+#endif /* LWIP_HTTPD_STATS */
+
+#if LWIP_HTTPD_MAX_DEFERRED
+/** A response deferred by its handler, see httpd_defer() */
+struct http_deferred {
+  struct http_state *hs;  /* NULL: the entry is free */
+  struct tcp_pcb *pcb;    /* NULL until the handler has returned */
+  httpd_defer_t token;
+};
+
+static struct http_deferred http_deferred_tab[LWIP_HTTPD_MAX_DEFERRED];
+static httpd_defer_t http_deferred_last;
+#endif /* LWIP_HTTPD_MAX_DEFERRED */
 
 /** Filename for response file to send when POST is finished */
 static char http_post_response_filename[LWIP_HTTPD_POST_MAX_RESPONSE_URI_LEN+1];
 
-/* The number of individual strings that comprise the headers sent before each
- * requested file.
- */
-#define NUM_FILE_HDR_STRINGS 3
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+#define HTTP_KEEPALIVE(hs) ((hs)->keepalive)
+#else /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+#define HTTP_KEEPALIVE(hs) 0
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+
+#if LWIP_HTTPD_SUPPORT_POST
+/** Body bytes of the current request still to come */
+#define HTTP_POST_LEFT(hs) (((hs)->post != NULL) ? (hs)->post->content_len_left : 0)
+/** http_post_state.content_len_left of a chunked body */
+#define HTTP_POST_CHUNKED  0xffffffffUL
+#if LWIP_HTTPD_SUPPORT_REQ_CHUNKED
+/** Most body bytes the request may have (and the size of req->post_data):
+ * the Content-Length, or what httpd_post_begin() allows a chunked body */
+#define HTTP_POST_MAX_LEN(hs) (((hs)->req_info.content_len != 0) ? \
+                               (hs)->req_info.content_len : (hs)->post->chunk_max)
+#else /* LWIP_HTTPD_SUPPORT_REQ_CHUNKED */
+#define HTTP_POST_MAX_LEN(hs) ((hs)->req_info.content_len)
+#endif /* LWIP_HTTPD_SUPPORT_REQ_CHUNKED */
+#if LWIP_HTTPD_POST_MANUAL_WND
+/** Body bytes received but not taken by the application yet */
+#define HTTP_POST_UNRECVED(hs) (((hs)->post != NULL) ? (hs)->post->unrecved_bytes : 0)
+#endif /* LWIP_HTTPD_POST_MANUAL_WND */
+#else /* LWIP_HTTPD_SUPPORT_POST */
+#define HTTP_POST_LEFT(hs) 0
+#endif /* LWIP_HTTPD_SUPPORT_POST */
 
+/* Framing of a response body whose length is not known up front (see
+ * http_stream_handler) */
+#define HTTP_CHUNKED_NONE   0
+#define HTTP_CHUNKED_BODY   1 /* sending "size CRLF data CRLF" chunks */
+#define HTTP_CHUNKED_LAST   2 /* the last (empty) chunk is queued */
 
-struct http_state {
-  struct webfs_file *handle;
-  char *file;       /* Pointer to first unsent byte in buf. */
+/* "XXXX\r\n" before and "\r\n" after the data of a chunk */
+#define HTTP_CHUNK_HDR_LEN  6
+#define HTTP_CHUNK_OVERHEAD (HTTP_CHUNK_HDR_LEN + 2)
 
-#if LWIP_HTTPD_SUPPORT_REQUESTLIST
-  struct pbuf *req;
-#endif /* LWIP_HTTPD_SUPPORT_REQUESTLIST */
+static const char http_last_chunk[] = "0\r\n\r\n";
 
-#if LWIP_HTTPD_SSI || LWIP_HTTPD_DYNAMIC_HEADERS
-  char *buf;        /* File read buffer. */
-  int buf_len;      /* Size of file read buffer, buf. */
-#endif /* LWIP_HTTPD_SSI || LWIP_HTTPD_DYNAMIC_HEADERS */
-  u32_t left;       /* Number of unsent bytes in buf. */
-  u8_t retries;
-#if LWIP_HTTPD_SSI
-  const char *parsed;     /* Pointer to the first unparsed byte in buf. */
-#if !LWIP_HTTPD_SSI_INCLUDE_TAG
-  const char *tag_started;/* Poitner to the first opening '<' of the tag. */
-#endif /* !LWIP_HTTPD_SSI_INCLUDE_TAG */
-  const char *tag_end;    /* Pointer to char after the closing '>' of the tag. */
-  u32_t parse_left; /* Number of unparsed bytes in buf. */
-  u16_t tag_index;   /* Counter used by tag parsing state machine */
-  u16_t tag_insert_len; /* Length of insert in string tag_insert */
-#if LWIP_HTTPD_SSI_MULTIPART
-  u16_t tag_part; /* Counter passed to and changed by tag insertion function to insert multiple times */
-#endif /* LWIP_HTTPD_SSI_MULTIPART */
-  u8_t tag_check;   /* true if we are processing a .shtml file else false */
-  u8_t tag_name_len; /* Length of the tag name in string tag_name */
-  char tag_name[LWIP_HTTPD_MAX_TAG_NAME_LEN + 1]; /* Last tag name extracted */
-  char tag_insert[LWIP_HTTPD_MAX_TAG_INSERT_LEN + 1]; /* Insert string for tag_name */
-  enum tag_check_state tag_state; /* State of the tag processor */
-#endif /* LWIP_HTTPD_SSI */
-  char *params[LWIP_HTTPD_MAX_CGI_PARAMETERS]; /* Params extracted from the request URI */
-  char *param_vals[LWIP_HTTPD_MAX_CGI_PARAMETERS]; /* Values for each extracted param */
-#if LWIP_HTTPD_DYNAMIC_HEADERS
-  const char *hdrs[NUM_FILE_HDR_STRINGS]; /* HTTP headers to be sent. */
-  u16_t hdr_pos;     /* The position of the first unsent header byte in the
-                        current string */
-  u16_t hdr_index;   /* The index of the hdr string currently being sent. */
-#endif /* LWIP_HTTPD_DYNAMIC_HEADERS */
-#if LWIP_HTTPD_TIMING
-  u32_t time_started;
-#endif /* LWIP_HTTPD_TIMING */
 #if LWIP_HTTPD_SUPPORT_POST
-  u32_t post_content_len_left;
-#if LWIP_HTTPD_POST_MANUAL_WND
-  u32_t unrecved_bytes;
-  struct tcp_pcb *pcb;
-  u8_t no_auto_wnd;
-#endif /* LWIP_HTTPD_POST_MANUAL_WND */
-  /* HTTP POST FIELD*/
-  HTTPRequest req_info;
-#endif /* LWIP_HTTPD_SUPPORT_POST*/
-};
+/** Interim response to "Expect: 100-continue" */
+static const char http_100_continue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+#endif /* LWIP_HTTPD_SUPPORT_POST */
+
+/* A response sent without copying keeps its http_state (and so the data)
+ * until the peer has ACKed it, see http_close_conn() */
+#define HTTP_LINGER_NONE    0
+#define HTTP_LINGER_WAIT    1 /* not closed yet, close when all is ACKed */
+#define HTTP_LINGER_CLOSED  2 /* closed, free when all is ACKed */
+#define HTTP_LINGER_REUSE   3 /* kept alive, reset when all is ACKed */
+
+/* States of the request head parser */
+#define HTTP_PARSE_METHOD     0
+#define HTTP_PARSE_URI        1
+#define HTTP_PARSE_VERSION    2
+#define HTTP_PARSE_LINE_LF    3
+#define HTTP_PARSE_HDR_START  4
+#define HTTP_PARSE_HDR_NAME   5
+#define HTTP_PARSE_HDR_VALUE  6
+#define HTTP_PARSE_HDR_LF     7
+#define HTTP_PARSE_END_LF     8
+#define HTTP_PARSE_DONE       9
+
+/* Headers the parser knows by name, see http_parse_hdrs: the HTTP_HDR_*
+   ones it records for http_header(), Content-Length, Transfer-Encoding and
+   Expect. The values of Content-Length and of the token lists (Connection,
+   Transfer-Encoding, Expect) are evaluated as they come in, the others are
+   skipped over. */
+#define HTTP_PARSE_HDR_CONTENT_LEN  HTTP_HDR_COUNT
+#define HTTP_PARSE_HDR_TRANSFER_ENC (HTTP_HDR_COUNT + 1)
+#define HTTP_PARSE_HDR_EXPECT       (HTTP_HDR_COUNT + 2)
+#define HTTP_PARSE_HDR_CONNECTION   HTTP_HDR_CONNECTION
+#define HTTP_PARSE_HDR_NONE         0xff
+#define HTTP_PARSE_HDR_LIST(h)      (((h) == HTTP_PARSE_HDR_CONNECTION) || \
+                                     ((h) == HTTP_PARSE_HDR_TRANSFER_ENC) || \
+                                     ((h) == HTTP_PARSE_HDR_EXPECT))
+#define HTTP_PARSE_HDR_EVALUATED(h) (((h) == HTTP_PARSE_HDR_CONTENT_LEN) || \
+                                     HTTP_PARSE_HDR_LIST(h))
+
+/* http_parser.hdr_slot of a header recorded in req_info.hdrs */
+#define HTTP_PARSE_SLOT_OTHER       0x80
+
+/* Connection header of the request */
+#define HTTP_CONN_DEFAULT     0 /* none: the default of the HTTP version */
+#define HTTP_CONN_CLOSE       1
+#define HTTP_CONN_KEEP_ALIVE  2
+
+/* Transfer-Encoding header of the request */
+#define HTTP_TE_NONE          0
+#define HTTP_TE_CHUNKED       1 /* chunked, and nothing else */
+#define HTTP_TE_OTHER         2 /* a coding the server does not decode */
+#define HTTP_TE_BAD           3 /* chunked, but not as the last coding */
+
+/* Expect header of the request */
+#define HTTP_EXPECT_NONE      0
+#define HTTP_EXPECT_CONTINUE  1 /* 100-continue, and nothing else */
+#define HTTP_EXPECT_OTHER     2 /* an expectation the server cannot meet */
+
+/* States of the decoder of a chunked request body */
+#define HTTP_REQ_CHUNK_NONE       0 /* the body has a Content-Length */
+#define HTTP_REQ_CHUNK_SIZE0      1 /* first digit of the chunk size */
+#define HTTP_REQ_CHUNK_SIZE       2
+#define HTTP_REQ_CHUNK_EXT        3 /* chunk extension, skipped */
+#define HTTP_REQ_CHUNK_SIZE_LF    4
+#define HTTP_REQ_CHUNK_DATA       5
+#define HTTP_REQ_CHUNK_DATA_CR    6
+#define HTTP_REQ_CHUNK_DATA_LF    7
+#define HTTP_REQ_CHUNK_TRAILER0   8 /* start of a trailer line, or the end */
+#define HTTP_REQ_CHUNK_TRAILER    9 /* trailer field, skipped */
+#define HTTP_REQ_CHUNK_END_LF     10
+#define HTTP_REQ_CHUNK_DONE       11
 
 static err_t http_find_file(struct http_state *hs, const char *uri, int is_09);
 static err_t http_init_file(struct http_state *hs, struct webfs_file *file, int is_09, const char *uri);
+#if LWIP_HTTPD_SUPPORT_POST
+static err_t http_post_data(struct http_state *hs, const char *data, u32_t len);
+#endif /* LWIP_HTTPD_SUPPORT_POST */
 static err_t http_poll(void *arg, struct tcp_pcb *pcb);
+static void http_recv_request(struct tcp_pcb *pcb, struct http_state *hs, struct pbuf *p);
 
 #if LWIP_HTTPD_SSI
 /* SSI insert handler function pointer. */
@@ -345,46 +434,118 @@ const tCGI *g_pCGIs = NULL;
 int g_iNumCGIs = 0;
 #endif /* LWIP_HTTPD_CGI */
 
-#if LWIP_HTTPD_STRNSTR_PRIVATE
-/** Like strstr but does not need 'buffer' to be NULL-terminated */
-static char* ICACHE_FLASH_ATTR
-strnstr(const char* buffer, const char* token, size_t n)
+/** Connection states, handed out from a free list threaded through the
+ * unused ones: O(1), and no heap fragmentation however long the uptime */
+static struct http_state http_state_pool[LWIP_HTTPD_MAX_CONNS];
+static u8_t http_state_free_list; /* pool index + 1, 0: none left */
+
+/** Put every connection state on the free list */
+static void ICACHE_FLASH_ATTR
+http_state_pool_init(void)
 {
-  const char* p;
-  int tokenlen = (int)strlen(token);
-  if (tokenlen == 0) {
-    return (char *)buffer;
-  }
-  for (p = buffer; *p && (p + tokenlen <= buffer + n); p++) {
-    if ((*p == *token) && (strncmp(p, token, tokenlen) == 0)) {
-      return (char *)p;
-    }
+  int i;
+  http_state_free_list = 0;
+  for (i = LWIP_HTTPD_MAX_CONNS - 1; i >= 0; i--) {
+    http_state_pool[i].next_free = http_state_free_list;
+    http_state_free_list = (u8_t)(i + 1);
   }
-  return NULL;
-} 
-#endif /* LWIP_HTTPD_STRNSTR_PRIVATE */
+}
+
+/** Initialize a struct http_state for a new request. */
+static void ICACHE_FLASH_ATTR
+http_state_init(struct http_state *hs)
+{
+  memset(hs, 0, sizeof(struct http_state));
+  hs->req_info.connection = hs;
+}
 
-/** Allocate a struct http_state. */
+/** Allocate a struct http_state from the pool, NULL if all
+ * LWIP_HTTPD_MAX_CONNS are in use. */
 static struct http_state* ICACHE_FLASH_ATTR
 http_state_alloc(void)
 {
   struct http_state *ret;
-#if HTTPD_USE_MEM_POOL
-  ret = (struct http_state *)memp_malloc(MEMP_HTTPD_STATE);
-#else /* HTTPD_USE_MEM_POOL */
-  ret = (struct http_state *)mem_malloc(sizeof(struct http_state));
-#endif /* HTTPD_USE_MEM_POOL */
-  if (ret != NULL) {
-    /* Initialize the structure. */
-    memset(ret, 0, sizeof(struct http_state));
-#if LWIP_HTTPD_DYNAMIC_HEADERS
-    /* Indicate that the headers are not yet valid */
-    ret->hdr_index = NUM_FILE_HDR_STRINGS;
-#endif /* LWIP_HTTPD_DYNAMIC_HEADERS */
+  if (http_state_free_list == 0) {
+    return NULL;
   }
+  ret = &http_state_pool[http_state_free_list - 1];
+  http_state_free_list = ret->next_free;
+  http_state_init(ret);
   return ret;
 }
 
+#if LWIP_HTTPD_MAX_DEFERRED
+/** Look up the deferred response of a token, NULL if there is none (any
+ * more) */
+static struct http_deferred * ICACHE_FLASH_ATTR
+http_defer_find(httpd_defer_t token)
+{
+  int i;
+  for (i = 0; i < LWIP_HTTPD_MAX_DEFERRED; i++) {
+    if ((http_deferred_tab[i].hs != NULL) && (http_deferred_tab[i].token == token)) {
+      return &http_deferred_tab[i];
+    }
+  }
+  return NULL;
+}
+
+/** Free the table entry of the response hs waits for */
+static void ICACHE_FLASH_ATTR
+http_defer_release(struct http_state *hs)
+{
+  struct http_deferred *d = http_defer_find(hs->deferred);
+  if (d != NULL) {
+    d->hs = NULL;
+    d->pcb = NULL;
+  }
+  hs->deferred = 0;
+}
+#endif /* LWIP_HTTPD_MAX_DEFERRED */
+
+/** Release everything a struct http_state holds for the current request,
+ * including the file data if dynamic. Data received for the next request
+ * (hs->req) is kept.
+ */
+static void ICACHE_FLASH_ATTR
+http_state_eof(struct http_state *hs)
+{
+#if LWIP_HTTPD_MAX_DEFERRED
+  if (hs->deferred != 0) {
+    /* gone before the handler completed: its token is void now */
+    http_defer_release(hs);
+  }
+#endif /* LWIP_HTTPD_MAX_DEFERRED */
+  if(hs->handle) {
+#if LWIP_HTTPD_TIMING
+    u32_t ms_needed = sys_now() - hs->time_started;
+    u32_t needed = LWIP_MAX(1, (ms_needed/100));
+    LWIP_DEBUGF(HTTPD_DEBUG_TIMING, ("httpd: needed %"U32_F" ms to send file of %d bytes -> %"U32_F" bytes/sec\n",
+      ms_needed, hs->handle->len, ((((u32_t)hs->handle->len) * 10) / needed)));
+#endif /* LWIP_HTTPD_TIMING */
+    /* webfs_close() frees the handler's response, the file is part of hs */
+    webfs_close(hs->handle);
+    hs->handle = NULL;
+  }
+#if LWIP_HTTPD_SUPPORT_POST
+  if ((hs->post != NULL) && (hs->post->req != NULL)) {
+    pbuf_free(hs->post->req);
+  }
+  hs->post = NULL;
+  hs->req_info.post_data = NULL;
+#endif /* LWIP_HTTPD_SUPPORT_POST */
+  if (hs->req_head != NULL) {
+    mem_free(hs->req_head);
+    hs->req_head = NULL;
+  }
+  /* the send buffer and everything else of the request */
+#if LWIP_HTTPD_DYNAMIC_HEADERS
+  hs->buf = NULL;
+#endif /* LWIP_HTTPD_DYNAMIC_HEADERS */
+  hs->req_info.query = NULL;
+  hs->req_info.form = NULL;
+  httpd_arena_free(&hs->req_info.arena);
+}
+
 /** Free a struct http_state.
  * Also frees the file data if dynamic.
  */
@@ -392,76 +553,279 @@ static void ICACHE_FLASH_ATTR
 http_state_free(struct http_state *hs)
 {
   if (hs != NULL) {
-    if(hs->handle) {
-#if LWIP_HTTPD_TIMING
-      u32_t ms_needed = sys_now() - hs->time_started;
-      u32_t needed = LWIP_MAX(1, (ms_needed/100));
-      LWIP_DEBUGF(HTTPD_DEBUG_TIMING, ("httpd: needed %"U32_F" ms to send file of %d bytes -> %"U32_F" bytes/sec\n",
-        ms_needed, hs->handle->len, ((((u32_t)hs->handle->len) * 10) / needed)));
-#endif /* LWIP_HTTPD_TIMING */
-      printf("[*] FREE hs->file \n");
-      if (hs->handle->data)
-          free((char*)hs->handle->data);
-      webfs_close(hs->handle);
-      hs->handle = NULL;
+    http_state_eof(hs);
+    if (hs->req != NULL) {
+      pbuf_free(hs->req);
+      hs->req = NULL;
     }
-#if LWIP_HTTPD_SSI || LWIP_HTTPD_DYNAMIC_HEADERS
-    if (hs->buf != NULL) {
-      mem_free(hs->buf);
-      hs->buf = NULL;
+    hs->next_free = http_state_free_list;
+    http_state_free_list = (u8_t)(hs - http_state_pool + 1);
+  }
+}
+
+/** Drop the first len bytes of a pbuf chain.
+ *
+ * @return what is left of p, NULL if that is nothing
+ */
+static struct pbuf * ICACHE_FLASH_ATTR
+http_pbuf_skip(struct pbuf *p, u16_t len)
+{
+  while ((p != NULL) && (p->len <= len)) {
+    struct pbuf *head = p;
+    len -= p->len;
+    p = p->next;
+    /* free the head pbuf */
+    head->next = NULL;
+    pbuf_free(head);
+  }
+  if (p != NULL) {
+    pbuf_header(p, -(s16_t)len);
+  }
+  return p;
+}
+
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+/** Cut a pbuf chain after len bytes. The bytes after that (the start of
+ * a pipelined request, usually a few dozen) are copied.
+ *
+ * @return the bytes after len in a pbuf of their own, NULL if there was no
+ *         memory for them
+ */
+static struct pbuf * ICACHE_FLASH_ATTR
+http_pbuf_split(struct pbuf *p, u16_t len)
+{
+  struct pbuf *rest = pbuf_alloc(PBUF_RAW, (u16_t)(p->tot_len - len), PBUF_RAM);
+  if (rest != NULL) {
+    pbuf_copy_partial(p, rest->payload, rest->len, len);
+    HTTPD_STATS_ADD(bytes_copied, rest->len);
+  }
+  pbuf_realloc(p, len);
+  return rest;
+}
+
+/** Nonzero until the response to the current request is done (written and,
+ * if sent without copying, ACKed): data received before that belongs to
+ * the next request(s).
+ */
+static int ICACHE_FLASH_ATTR
+http_response_pending(struct http_state *hs)
+{
+  if ((hs->handle != NULL) || (hs->linger != HTTP_LINGER_NONE)) {
+    return 1;
+  }
+#if LWIP_HTTPD_DYNAMIC_HEADERS
+  if (hs->hdr_pending) {
+    return 1;
+  }
+#endif /* LWIP_HTTPD_DYNAMIC_HEADERS */
+#if LWIP_HTTPD_SUPPORT_POST && LWIP_HTTPD_POST_MANUAL_WND
+  if (HTTP_POST_UNRECVED(hs) != 0) {
+    /* a POST body the application has not taken yet */
+    return 1;
+  }
+#endif /* LWIP_HTTPD_SUPPORT_POST && LWIP_HTTPD_POST_MANUAL_WND */
+  return 0;
+}
+
+/** Keep data received for the next (pipelined) request(s) in hs->req until
+ * http_next_request() parses it. A client more than
+ * LWIP_HTTPD_MAX_PIPELINED_LEN bytes (or too many pbufs) ahead loses what
+ * is held and the connection is closed after the current response.
+ */
+static void ICACHE_FLASH_ATTR
+http_hold_request(struct http_state *hs, struct pbuf *p)
+{
+  if (hs->req == NULL) {
+    hs->req = p;
+  } else {
+    pbuf_cat(hs->req, p);
+  }
+  if ((hs->req->tot_len > LWIP_HTTPD_MAX_PIPELINED_LEN) ||
+      (pbuf_clen(hs->req) > LWIP_HTTPD_REQ_QUEUELEN)) {
+    LWIP_DEBUGF(HTTPD_DEBUG, ("http_hold_request: client too far ahead\n"));
+    pbuf_free(hs->req);
+    hs->req = NULL;
+    hs->keepalive = 0;
+    if (hs->linger == HTTP_LINGER_REUSE) {
+      hs->linger = HTTP_LINGER_WAIT;
     }
-#endif /* LWIP_HTTPD_SSI || LWIP_HTTPD_DYNAMIC_HEADERS */
-#if HTTPD_USE_MEM_POOL
-    memp_free(MEMP_HTTPD_STATE, hs);
-#else /* HTTPD_USE_MEM_POOL */
-    mem_free(hs);
-#endif /* HTTPD_USE_MEM_POOL */
   }
 }
 
-/** Call tcp_write() in a loop trying smaller and smaller length
+/** Prepare a persistent connection for its next request: free what the
+ * last one used and start over, keeping the request count. The caller
+ * takes data received for the next request (hs->req) out first.
+ */
+static void ICACHE_FLASH_ATTR
+http_state_reset(struct tcp_pcb *pcb, struct http_state *hs)
+{
+  u16_t requests = hs->requests;
+  u16_t snd_limit = hs->snd_limit;
+
+  LWIP_ASSERT("hs->req == NULL", hs->req == NULL);
+#if LWIP_HTTPD_SUPPORT_POST && LWIP_HTTPD_POST_MANUAL_WND
+  if (HTTP_POST_UNRECVED(hs) != 0) {
+    /* do not leave the window shrunk by a body that was never taken */
+    tcp_recved(pcb, (u16_t)HTTP_POST_UNRECVED(hs));
+  }
+#else /* LWIP_HTTPD_SUPPORT_POST && LWIP_HTTPD_POST_MANUAL_WND */
+  LWIP_UNUSED_ARG(pcb);
+#endif /* LWIP_HTTPD_SUPPORT_POST && LWIP_HTTPD_POST_MANUAL_WND */
+  http_state_eof(hs);
+  http_state_init(hs);
+  hs->requests = requests;
+  hs->snd_limit = snd_limit;
+}
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+
+/**
+ * Queue data with tcp_write(), sized to what the pcb can take instead of
+ * trying smaller and smaller lengths: at most tcp_sndbuf() bytes and no
+ * more than hs->snd_limit. A write that cannot take everything is cut to
+ * whole segments, or deferred while data is in flight, so the send buffer
+ * is refilled in MSS units as ACKs come in. Nothing is retried here: when
+ * the queue is full or tcp_write() runs out of memory, http_sent()
+ * continues once the peer has ACKed data.
  *
  * @param pcb tcp_pcb to send
+ * @param hs connection state
  * @param ptr Data to send
  * @param length Length of data to send (in/out: on return, contains the
  *        amount of data sent)
- * @param apiflags directly passed to tcp_write
- * @return the return value of tcp_write
+ * @param apiflags passed to tcp_write, with TCP_WRITE_FLAG_MORE added
+ *        when not all of the data is written
+ * @return the return value of tcp_write, or ERR_MEM if nothing was written
  */
 static err_t ICACHE_FLASH_ATTR
-http_write(struct tcp_pcb *pcb, const void* ptr, u16_t *length, u8_t apiflags)
+http_write(struct tcp_pcb *pcb, struct http_state *hs, const void* ptr, u16_t *length,
+           u8_t apiflags)
 {
-   printf("[*] http_write invoked, content=%s\n", ptr);
-   u16_t len;
+   u16_t len, room, mss;
    err_t err;
    LWIP_ASSERT("length != NULL", length != NULL);
    len = *length;
-   do {
-     LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("Trying to send %d bytes\n", len));
-     printf("WRITE %d bytes, content: %s", len,ptr);
-     err = tcp_write(pcb, ptr, len, apiflags);
-     if (err == ERR_MEM) {
-       if ((tcp_sndbuf(pcb) == 0) ||
-           (tcp_sndqueuelen(pcb) >= TCP_SND_QUEUELEN)) {
-         /* no need to try smaller sizes */
-         len = 1;
-       } else {
-         len /= 2;
-       }
-       LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, 
-                   ("Send failed, trying less (%d bytes)\n", len));
+   room = (tcp_sndqueuelen(pcb) < TCP_SND_QUEUELEN) ? tcp_sndbuf(pcb) : 0;
+   if ((hs->snd_limit != 0) && (room > hs->snd_limit)) {
+     room = hs->snd_limit;
+   }
+   if (len > room) {
+     mss = tcp_mss(pcb);
+     if (room >= mss) {
+       len = room - (room % mss);
+     } else if (HTTP_DATA_IN_FLIGHT(pcb)) {
+       /* wait for the ACK rather than queueing a short segment */
+       len = 0;
+     } else {
+       len = room;
      }
-   } while ((err == ERR_MEM) && (len > 1));
+     /* a write the halving loop would have retried */
+     HTTPD_STATS_INC(writes_avoided);
+     if (len == 0) {
+       LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("Send buffer full, waiting for ACKs\n"));
+       *length = 0;
+       return ERR_MEM;
+     }
+     apiflags |= TCP_WRITE_FLAG_MORE;
+   }
+   LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("Trying to send %d bytes\n", len));
+   err = tcp_write(pcb, ptr, len, apiflags);
    if (err == ERR_OK) {
      LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("Sent %d bytes\n", len));
+     HTTPD_STATS_ADD(bytes_sent, len);
+     if (apiflags & TCP_WRITE_FLAG_COPY) {
+       HTTPD_STATS_ADD(bytes_copied, len);
+     }
    } else {
      LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("Send failed with err %d (\"%s\")\n", err, lwip_strerr(err)));
+     if (err == ERR_MEM) {
+       /* out of pbufs or segments rather than send buffer: try half of it
+          (whole segments if possible) after the next ACK */
+       HTTPD_STATS_INC(write_errs);
+       mss = tcp_mss(pcb);
+       hs->snd_limit = (len / 2 >= mss) ? (u16_t)((len / 2) - ((len / 2) % mss)) :
+                       (u16_t)LWIP_MAX(len / 2, 1);
+     }
+     len = 0;
    }
 
    *length = len;
    return err;
 }
 
+#if LWIP_HTTPD_STATS
+/** Count the segments queued on pcb that have not been sent yet */
+static u16_t ICACHE_FLASH_ATTR
+http_unsent_segs(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg;
+  u16_t n = 0;
+
+  for (seg = pcb->unsent; seg != NULL; seg = seg->next) {
+    n++;
+  }
+  return n;
+}
+#endif /* LWIP_HTTPD_STATS */
+
+/**
+ * Send what has been queued with tcp_write(): responses are corked (written
+ * with TCP_WRITE_FLAG_MORE, Nagle disabled) and flushed here once complete
+ * or when the send buffer is full. Closing flushes through tcp_close(), so
+ * that the FIN is set on the last data segment instead of following in a
+ * segment of its own.
+ *
+ * @param close 1 to close the connection (the pcb must not reset on close)
+ */
+static err_t ICACHE_FLASH_ATTR
+http_flush(struct tcp_pcb *pcb, u8_t close)
+{
+  err_t err;
+#if LWIP_HTTPD_STATS
+  u16_t queued = http_unsent_segs(pcb);
+  u16_t unsent;
+#endif /* LWIP_HTTPD_STATS */
+
+  err = close ? tcp_close(pcb) : tcp_output(pcb);
+#if LWIP_HTTPD_STATS
+  /* a FIN without data may have been queued by tcp_close(): not counted */
+  unsent = http_unsent_segs(pcb);
+  if ((err == ERR_OK) && (unsent < queued)) {
+    HTTPD_STATS_ADD(segments, queued - unsent);
+  }
+#endif /* LWIP_HTTPD_STATS */
+  return err;
+}
+
+/**
+ * Close a connection whose response is still referenced by unACKed
+ * segments: the sent-, err- and poll-callbacks stay installed so that
+ * hs is freed from http_sent() once the peer has ACKed everything, or
+ * from http_err() if the pcb goes away first.
+ */
+static err_t ICACHE_FLASH_ATTR
+http_close_linger(struct tcp_pcb *pcb, struct http_state *hs)
+{
+  err_t err;
+
+  tcp_recv(pcb, NULL);
+  if (pcb->state == CLOSE_WAIT) {
+    /* The peer has closed already: the ACK of our FIN would free the pcb
+       in LAST_ACK without any callback, so close only when that ACK
+       cannot carry data ACKs any more. */
+    hs->linger = HTTP_LINGER_WAIT;
+    return ERR_OK;
+  }
+  err = http_flush(pcb, 1);
+  if (err != ERR_OK) {
+    LWIP_DEBUGF(HTTPD_DEBUG, ("Error %d closing %p\n", err, (void*)pcb));
+    /* try again later in sent or poll */
+    hs->linger = HTTP_LINGER_WAIT;
+    return err;
+  }
+  hs->linger = HTTP_LINGER_CLOSED;
+  return ERR_OK;
+}
+
 /**
  * The connection shall be actively closed.
  * Reset the sent- and recv-callbacks.
@@ -477,9 +841,9 @@ http_close_conn(struct tcp_pcb *pcb, struct http_state *hs)
 
 #if LWIP_HTTPD_SUPPORT_POST
   if (hs != NULL) {
-    if ((hs->post_content_len_left != 0)
+    if ((HTTP_POST_LEFT(hs) != 0)
 #if LWIP_HTTPD_POST_MANUAL_WND
-       || ((hs->no_auto_wnd != 0) && (hs->unrecved_bytes != 0))
+       || (HTTP_POST_UNRECVED(hs) != 0)
 #endif /* LWIP_HTTPD_POST_MANUAL_WND */
        ) {
       /* make sure the post code knows that the connection is closed */
@@ -489,6 +853,11 @@ http_close_conn(struct tcp_pcb *pcb, struct http_state *hs)
   }
 #endif /* LWIP_HTTPD_SUPPORT_POST*/
 
+  if ((hs != NULL) && (hs->handle != NULL) && HTTP_DATA_IN_FLIGHT(pcb) &&
+      !HTTP_CLOSE_RESETS(pcb)) {
+    /* the response was handed to tcp_write() without copying */
+    return http_close_linger(pcb, hs);
+  }
 
   tcp_arg(pcb, NULL);
   tcp_recv(pcb, NULL);
@@ -499,7 +868,12 @@ http_close_conn(struct tcp_pcb *pcb, struct http_state *hs)
     http_state_free(hs);
   }
 
-  err = tcp_close(pcb);
+  if (HTTP_CLOSE_RESETS(pcb)) {
+    /* the pcb is gone when this returns */
+    err = tcp_close(pcb);
+  } else {
+    err = http_flush(pcb, 1);
+  }
   if (err != ERR_OK) {
     LWIP_DEBUGF(HTTPD_DEBUG, ("Error %d closing %p\n", err, (void*)pcb));
     /* error closing, try again later in poll */
@@ -508,90 +882,207 @@ http_close_conn(struct tcp_pcb *pcb, struct http_state *hs)
   return err;
 }
 
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
 /**
- * Generate the relevant HTTP headers for the given filename and write
- * them into the supplied buffer.
+ * Start over on a persistent connection and handle the next request if it
+ * has (partly) arrived while the last response was being sent.
  */
 static void ICACHE_FLASH_ATTR
-get_http_headers(struct http_state *pState, char *pszURI)
+http_next_request(struct tcp_pcb *pcb, struct http_state *hs)
 {
-  unsigned int iLoop;
-  char *pszWork;
-  char *pszExt;
-  char *pszVars;
+  struct pbuf *p = hs->req;
+
+  LWIP_DEBUGF(HTTPD_DEBUG, ("Waiting for request %"U16_F" on %p\n",
+    (u16_t)(hs->requests + 1), (void*)pcb));
+  hs->req = NULL;
+  http_state_reset(pcb, hs);
+  if (p != NULL) {
+    http_recv_request(pcb, hs, p);
+  }
+}
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
 
-  /* Ensure that we initialize the loop counter. */
-  iLoop = 0;
+/**
+ * The whole response has been passed to tcp_write(): close the connection
+ * or, if it is kept alive, get ready for the next request. hs may be freed
+ * when this returns.
+ */
+static void ICACHE_FLASH_ATTR
+http_end_response(struct tcp_pcb *pcb, struct http_state *hs)
+{
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+  if (hs->keepalive) {
+    http_flush(pcb, 0);
+    if ((hs->handle != NULL) && HTTP_DATA_IN_FLIGHT(pcb)) {
+      /* the response was handed to tcp_write() without copying */
+      hs->linger = HTTP_LINGER_REUSE;
+    } else {
+      http_next_request(pcb, hs);
+    }
+    return;
+  }
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+  http_close_conn(pcb, hs);
+}
 
-  /* In all cases, the second header we send is the server identification
-     so set it here. */
-  pState->hdrs[1] = g_psHTTPHeaderStrings[HTTP_HDR_SERVER];
+/**
+ * Finish closing (or resetting) a lingering connection once the pcb no
+ * longer references its response.
+ *
+ * @return 1 if the linger is over: hs has been freed or reset
+ */
+static u8_t ICACHE_FLASH_ATTR
+http_linger_check(struct tcp_pcb *pcb, struct http_state *hs)
+{
+  if (HTTP_DATA_IN_FLIGHT(pcb)) {
+    return 0;
+  }
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+  if (hs->linger == HTTP_LINGER_REUSE) {
+    http_next_request(pcb, hs);
+    return 1;
+  }
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+  if (hs->linger == HTTP_LINGER_WAIT) {
+    /* nothing referenced any more: the usual close, which frees hs */
+    http_close_conn(pcb, hs);
+    return 1;
+  }
+  LWIP_DEBUGF(HTTPD_DEBUG, ("Response ACKed, freeing state of %p\n", (void*)pcb));
+  tcp_arg(pcb, NULL);
+  tcp_err(pcb, NULL);
+  tcp_poll(pcb, NULL, 0);
+  tcp_sent(pcb, NULL);
+  http_state_free(hs);
+  return 1;
+}
 
-  /* Is this a normal file or the special case we use to send back the
-     default "404: Page not found" response? */
-  if (pszURI == NULL) {
-    pState->hdrs[0] = g_psHTTPHeaderStrings[HTTP_HDR_NOT_FOUND];
-    pState->hdrs[2] = g_psHTTPHeaderStrings[DEFAULT_404_HTML];
+/** Index of the header blocks for an HTTP status: the status listed in
+ * headers.def, else 500. */
+static u8_t ICACHE_FLASH_ATTR
+http_hdr_status(u16_t code)
+{
+  u32_t i, fallback = 0;
 
-    /* Set up to send the first header string. */
-    pState->hdr_index = 0;
-    pState->hdr_pos = 0;
-    return;
-  } else {
-    /* We are dealing with a particular filename. Look for one other
-       special case.  We assume that any filename with "404" in it must be
-       indicative of a 404 server error whereas all other files require
-       the 200 OK header. */
-    if (strstr(pszURI, "404")) {
-      pState->hdrs[0] = g_psHTTPHeaderStrings[HTTP_HDR_NOT_FOUND];
-    } else if (strstr(pszURI, "400")) {
-      pState->hdrs[0] = g_psHTTPHeaderStrings[HTTP_HDR_BAD_REQUEST];
-    } else if (strstr(pszURI, "501")) {
-      pState->hdrs[0] = g_psHTTPHeaderStrings[HTTP_HDR_NOT_IMPL];
-    } else {
-      pState->hdrs[0] = g_psHTTPHeaderStrings[HTTP_HDR_OK];
+  for (i = 0; i < http_hdr_table.num_codes; i++) {
+    if (http_hdr_table.codes[i] == code) {
+      return (u8_t)i;
     }
-
-    /* Determine if the URI has any variables and, if so, temporarily remove 
-       them. */
-    pszVars = strchr(pszURI, '?');
-    if(pszVars) {
-      *pszVars = '\0';
+    if (http_hdr_table.codes[i] == 500) {
+      fallback = i;
     }
+  }
+  LWIP_DEBUGF(HTTPD_DEBUG, ("No header for status %"U16_F"\n", code));
+  return (u8_t)fallback;
+}
 
-    /* Get a pointer to the file extension.  We find this by looking for the
-       last occurrence of "." in the filename passed. */
-    pszExt = NULL;
-    pszWork = strchr(pszURI, '.');
-    while(pszWork) {
-      pszExt = pszWork + 1;
-      pszWork = strchr(pszExt, '.');
-    }
+/** Content type of a URI by its extension: one hash, a length check and at
+ * most one compare. */
+static u8_t ICACHE_FLASH_ATTR
+http_hdr_type(const char *uri)
+{
+  const HTTPHdrTable *t = &http_hdr_table;
+  size_t end = strcspn(uri, "?");
+  size_t dot = end;
+  u32_t len, hash, meta;
+  const u32_t *slot;
+
+  while ((dot > 0) && (uri[dot - 1] != '.') && (uri[dot - 1] != '/')) {
+    dot--;
+  }
+  if ((dot == 0) || (uri[dot - 1] != '.')) {
+    return (u8_t)t->type_noext;
+  }
+  len = (u32_t)(end - dot);
+  hash = router_hash(uri + dot, len, t->seed);
+  /* slots live in flash: only aligned 32-bit reads */
+  slot = &t->slots[(hash & t->mask) * 2];
+  meta = slot[1];
+  if ((meta != 0) && (slot[0] == hash) && ((meta >> 16) == len) &&
+      (memcmp(t->exts[hash & t->mask], uri + dot, len) == 0)) {
+    return (u8_t)((meta & 0xffff) - 1);
+  }
+  return (u8_t)t->type_default;
+}
 
-    if (pszExt != NULL)
-    {
-        /* Now determine the content type and add the relevant header for that. */
-        for(iLoop = 0; (iLoop < NUM_HTTP_HEADERS) && pszExt; iLoop++) {
-          /* Have we found a matching extension? */
-          if(!strcmp(g_psHTTPHeaders[iLoop].extension, pszExt)) {
-            pState->hdrs[2] =
-              g_psHTTPHeaderStrings[g_psHTTPHeaders[iLoop].headerIndex];
-            break;
-          }
-        }
-    } else {
-        pState->hdrs[2] = g_psHTTPHeaderStrings[HTTP_HDR_JSON];
-    }
+/**
+ * Choose the header of the response: the status the handler has set (404
+ * for the built-in 404 page, uri == NULL), the connection mode, the framing
+ * and the content type for the extension of uri. A generated response
+ * (hs->handle->stream) is chunked for HTTP/1.1 clients and ends with the
+ * connection for the others.
+ */
+static void ICACHE_FLASH_ATTR
+get_http_headers(struct http_state *hs, const char *uri)
+{
+  u8_t status;
 
-    /* Reinstate the parameter marker if there was one in the original URI. */
-    if(pszVars) {
-      *pszVars = '?';
+  if (hs->handle == NULL) {
+    status = http_hdr_status(404);
+    hs->hdr_type = http_hdr_type(".html");
+  } else {
+    status = http_hdr_status(hs->handle->status);
+    if (uri != NULL) {
+      /* else a deferred response: the type was chosen by http_find_file() */
+      hs->hdr_type = http_hdr_type(uri);
+    }
+    if (hs->handle->stream != NULL) {
+      if (hs->parser.is_11) {
+        hs->chunked = HTTP_CHUNKED_BODY;
+      }
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+      else {
+        hs->keepalive = 0;
+      }
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
     }
   }
+  /* the connection mode is fixed here: the header may be written in
+     pieces, each assembled again */
+  hs->hdr_block = (u8_t)(((status * 2) + hs->parser.is_11) * 2 + (HTTP_KEEPALIVE(hs) ? 1 : 0));
+  hs->hdr_pos = 0;
+  hs->hdr_pending = 1;
+}
 
-  pState->hdr_index = 0;
-  pState->hdr_pos = 0;
-  printf("[*] HEADER \n %s \n %s \n %s \n", pState->hdrs[0], pState->hdrs[1] ,pState->hdrs[2]);
+/**
+ * Assemble the header chosen by get_http_headers(): a copy of the
+ * generated block, the Content-Length (or Transfer-Encoding: chunked, or
+ * nothing when the end of the connection ends the body) and the content
+ * type, which ends the header.
+ *
+ * @param buf receives the header, LWIP_HTTPD_MAX_HDR_LEN bytes
+ * @return the length of the header
+ */
+static u16_t ICACHE_FLASH_ATTR
+http_build_headers(struct http_state *hs, char *buf)
+{
+  const HTTPHdrString *block = &http_hdr_table.blocks[hs->hdr_block];
+  const HTTPHdrString *type = &http_hdr_table.types[hs->hdr_type];
+  char digits[10];
+  /* the body is not sent before all of the header: left is its length */
+  u32_t n = hs->left;
+  u16_t len = (u16_t)block->len;
+  int i = 0;
+
+  MEMCPY(buf, block->s, len);
+  if (hs->chunked != HTTP_CHUNKED_NONE) {
+    MEMCPY(buf + len, http_hdr_table.chunked.s, http_hdr_table.chunked.len);
+    len += (u16_t)http_hdr_table.chunked.len;
+  } else if ((hs->handle == NULL) || (hs->handle->stream == NULL)) {
+    MEMCPY(buf + len, http_hdr_table.content_length.s, http_hdr_table.content_length.len);
+    len += (u16_t)http_hdr_table.content_length.len;
+    do {
+      digits[i++] = (char)('0' + (n % 10));
+      n /= 10;
+    } while (n != 0);
+    while (i > 0) {
+      buf[len++] = digits[--i];
+    }
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+  }
+  MEMCPY(buf + len, type->s, type->len);
+  return (u16_t)(len + type->len);
 }
 
 
@@ -607,7 +1098,6 @@ http_send_data(struct tcp_pcb *pcb, struct http_state *hs)
   printf("[*] http_send_data invoked\n");
   err_t err;
   u16_t len;
-  u16_t mss;
   u8_t data_to_send = false;
   u16_t hdrlen, sendlen;
 
@@ -620,156 +1110,188 @@ http_send_data(struct tcp_pcb *pcb, struct http_state *hs)
   if (hs == NULL) {
     return 0;
   }
+#if LWIP_HTTPD_MAX_DEFERRED
+  if (hs->deferred != 0) {
+    /* nothing to send before httpd_complete(), which needs the pcb */
+    struct http_deferred *d = http_defer_find(hs->deferred);
+    if (d != NULL) {
+      d->pcb = pcb;
+    }
+    return 0;
+  }
+#endif /* LWIP_HTTPD_MAX_DEFERRED */
 
   /* Assume no error until we find otherwise */
   err = ERR_OK;
-  printf("hs->hdr_index=%d, NUM_FILE_HDR_STRINGS=%d", hs->hdr_index, NUM_FILE_HDR_STRINGS);
   /* Do we have any more header data to send for this file? */
-  if(hs->hdr_index < NUM_FILE_HDR_STRINGS) {
-    /* How much data can we send? */
-    len = tcp_sndbuf(pcb);
-    sendlen = len;
-    printf("[*] http_send_data after tcp_sndbuf, len=%d, sendlen=%d\n", len, sendlen);
-
-    while(len && (hs->hdr_index < NUM_FILE_HDR_STRINGS) && sendlen) {
-      const void *ptr;
-      u16_t old_sendlen;
-      /* How much do we have to send from the current header? */
-      hdrlen = (u16_t)strlen(hs->hdrs[hs->hdr_index]);
-
-      /* How much of this can we send? */
-      sendlen = (len < (hdrlen - hs->hdr_pos)) ? len : (hdrlen - hs->hdr_pos);
-
-      /* Send this amount of data or as much as we can given memory
-      * constraints. */
-      ptr = (const void *)(hs->hdrs[hs->hdr_index] + hs->hdr_pos);
-      old_sendlen = sendlen;
-      printf("FUCK!!!! %s %d\n\n", ptr, sendlen);
-      err = http_write(pcb, ptr, &sendlen, HTTP_IS_HDR_VOLATILE(hs, ptr));
-      if ((err == ERR_OK) && (old_sendlen != sendlen)) {
-        /* Remember that we added some more data to be transmitted. */
-        data_to_send = true;
-      } else if (err != ERR_OK) {
-         /* special case: http_write does not try to send 1 byte */
-        sendlen = 0;
-      }
-
-      /* Fix up the header position for the next time round. */
+  if (hs->hdr_pending) {
+    char hdr[LWIP_HTTPD_MAX_HDR_LEN];
+
+    hdrlen = http_build_headers(hs, hdr);
+    /* one write, copied: the body that follows fills up the same segment */
+    sendlen = hdrlen - hs->hdr_pos;
+    err = http_write(pcb, hs, hdr + hs->hdr_pos, &sendlen,
+      TCP_WRITE_FLAG_COPY | ((hs->left != 0) ? TCP_WRITE_FLAG_MORE : 0));
+    if (err == ERR_OK) {
+      data_to_send = true;
       hs->hdr_pos += sendlen;
-      len -= sendlen;
-
-      /* Have we finished sending this string? */
-      if(hs->hdr_pos == hdrlen) {
-        /* Yes - move on to the next one */
-        hs->hdr_index++;
-        hs->hdr_pos = 0;
-      }
     }
-
-    /* If we get here and there are still header bytes to send, we send
-    * the header information we just wrote immediately.  If there are no
-    * more headers to send, but we do have file data to send, drop through
-    * to try to send some file data too. */
-    if((hs->hdr_index < NUM_FILE_HDR_STRINGS) || !hs->file) {
-      LWIP_DEBUGF(HTTPD_DEBUG, ("tcp_output\n"));
-      return 1;
+    if (hs->hdr_pos < hdrlen) {
+      /* no room for all of it: the rest follows from http_sent() */
+      http_flush(pcb, 0);
+      return data_to_send;
     }
+    hs->hdr_pending = 0;
   }
 
 /* end of sending header*/
 
-  /* Have we run out of file data to send? If so, we need to read the next
-   * block from the file. */
-  if (hs->left == 0) {
-#if LWIP_HTTPD_SSI || LWIP_HTTPD_DYNAMIC_HEADERS
-    int count;
-#endif /* LWIP_HTTPD_SSI || LWIP_HTTPD_DYNAMIC_HEADERS */
-
-    /* Do we have a valid file handle? */
-    if (hs->handle == NULL) {
-      /* No - close the connection. */
-      printf("[*] http_send_data nothing to send, closed\n");
-      http_close_conn(pcb, hs);
-      return 0;
-    }
-    if (webfs_bytes_left(hs->handle) <= 0) {
-      /* We reached the end of the file so this request is done.
-       * @todo: don't close here for HTTP/1.1? */
-      LWIP_DEBUGF(HTTPD_DEBUG, ("End of file.\n"));
-      printf("[*] http_send_data EOF\n");
-      http_close_conn(pcb, hs);
-      return 0;
-    }
+  /* Queue as much of the body as the send buffer takes; it is sent by
+   * http_flush() when the response is complete or the buffer is full. */
+  for (;;) {
+    u8_t apiflags;
+
+    /* Have we run out of file data to send? If so, we need to read the next
+     * block from the file. */
+    if (hs->left == 0) {
+      int count;
+
+      /* Do we have a valid file handle? */
+      if (hs->handle == NULL) {
+        /* No - close the connection. */
+        printf("[*] http_send_data nothing to send, closed\n");
+        http_close_conn(pcb, hs);
+        return 0;
+      }
+      if (webfs_bytes_left(hs->handle) <= 0) {
+        /* We reached the end of the file so this request is done. */
+        LWIP_DEBUGF(HTTPD_DEBUG, ("End of file.\n"));
+        printf("[*] http_send_data EOF\n");
+        http_end_response(pcb, hs);
+        return 0;
+      }
 
-    /* Do we already have a send buffer allocated? */
-    if(hs->buf) {
-      /* Yes - get the length of the buffer */
-      count = hs->buf_len;
-    } else {
-      /* We don't have a send buffer so allocate one up to 2mss bytes long. */
-      count = 2 * tcp_mss(pcb);
-      do {
-        hs->buf = (char*)mem_malloc((mem_size_t)count);
-        if (hs->buf != NULL) {
-          hs->buf_len = count;
+      /* Do we already have a send buffer allocated? */
+      if(hs->buf) {
+        /* Yes - get the length of the buffer */
+        count = hs->buf_len;
+      } else {
+        /* We don't have a send buffer so allocate one up to 2mss bytes long. */
+        count = 2 * tcp_mss(pcb);
+        do {
+          hs->buf = (char*)httpd_arena_alloc(&hs->req_info.arena, (u32_t)count);
+          if (hs->buf != NULL) {
+            hs->buf_len = (u16_t)count;
+            break;
+          }
+          count = count / 2;
+        } while (count > 100);
+
+        /* Did we get a send buffer? If not, return immediately. */
+        if (hs->buf == NULL) {
+          LWIP_DEBUGF(HTTPD_DEBUG, ("No buff\n"));
           break;
         }
-        count = count / 2;
-      } while (count > 100);
+      }
 
-      /* Did we get a send buffer? If not, return immediately. */
-      if (hs->buf == NULL) {
-        LWIP_DEBUGF(HTTPD_DEBUG, ("No buff\n"));
-        return 0;
+      if ((hs->handle->stream != NULL) && (count > tcp_sndbuf(pcb))) {
+        /* generate no more than the send buffer takes right now, so that
+           only this window is kept per response */
+        if ((tcp_sndbuf(pcb) >= HTTP_STREAM_WINDOW_MIN + HTTP_CHUNK_OVERHEAD) ||
+            !HTTP_DATA_IN_FLIGHT(pcb)) {
+          count = LWIP_MAX(tcp_sndbuf(pcb), HTTP_STREAM_WINDOW_MIN + HTTP_CHUNK_OVERHEAD);
+        } else {
+          /* too little room: call the generator again from http_sent() */
+          break;
+        }
       }
-    }
 
-    /* Read a block of data from the file. */
-    printf("[*] http_send_data trying to read %d bytes\n", count);
-    LWIP_DEBUGF(HTTPD_DEBUG, ("Trying to read %d bytes.\n", count));
+      /* Read a block of data from the file. */
+      printf("[*] http_send_data trying to read %d bytes\n", count);
+      LWIP_DEBUGF(HTTPD_DEBUG, ("Trying to read %d bytes.\n", count));
 
-    count = webfs_read(hs->handle, hs->buf, count);
-    if(count < 0) {
-      /* We reached the end of the file so this request is done.
-       * @todo: don't close here for HTTP/1.1? */
-      LWIP_DEBUGF(HTTPD_DEBUG, ("End of file.\n"));
-      http_close_conn(pcb, hs);
-      return 1;
+      if (hs->chunked == HTTP_CHUNKED_BODY) {
+        /* leave room for the chunk size line and the CRLF after the data */
+        count = webfs_read(hs->handle, hs->buf + HTTP_CHUNK_HDR_LEN, count - HTTP_CHUNK_OVERHEAD);
+      } else {
+        count = webfs_read(hs->handle, hs->buf, count);
+      }
+      if (count == WEBFS_ERR) {
+        /* the generator failed: close without completing the response
+           (without the last chunk, the client knows it was cut short) */
+        LWIP_DEBUGF(HTTPD_DEBUG, ("Generator failed, closing.\n"));
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+        hs->keepalive = 0;
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+        http_close_conn(pcb, hs);
+        return 0;
+      }
+      if ((count < 0) && (hs->chunked == HTTP_CHUNKED_BODY)) {
+        /* end of a generated response: send the last chunk */
+        hs->chunked = HTTP_CHUNKED_LAST;
+        hs->file = (char *)http_last_chunk;
+        hs->left = sizeof(http_last_chunk) - 1;
+      } else if(count < 0) {
+        /* We reached the end of the file so this request is done. */
+        LWIP_DEBUGF(HTTPD_DEBUG, ("End of file.\n"));
+        http_end_response(pcb, hs);
+        return 0;
+      } else {
+        /* Set up to send the block of data we just read */
+        LWIP_DEBUGF(HTTPD_DEBUG, ("Read %d bytes.\n", count));
+        HTTPD_STATS_ADD(bytes_copied, count);
+        hs->left = count;
+        hs->file = hs->buf;
+        if (hs->chunked == HTTP_CHUNKED_BODY) {
+          static const char hex[] = "0123456789abcdef";
+          hs->buf[0] = hex[(count >> 12) & 0xf];
+          hs->buf[1] = hex[(count >> 8) & 0xf];
+          hs->buf[2] = hex[(count >> 4) & 0xf];
+          hs->buf[3] = hex[count & 0xf];
+          hs->buf[4] = '\r';
+          hs->buf[5] = '\n';
+          hs->buf[HTTP_CHUNK_HDR_LEN + count] = '\r';
+          hs->buf[HTTP_CHUNK_HDR_LEN + count + 1] = '\n';
+          hs->left += HTTP_CHUNK_OVERHEAD;
+        }
+      }
     }
 
-    /* Set up to send the block of data we just read */
-    LWIP_DEBUGF(HTTPD_DEBUG, ("Read %d bytes.\n", count));
-    hs->left = count;
-    hs->file = hs->buf;
-  }
-
     printf("hs->left: %d\n", hs->left);
-    if (tcp_sndbuf(pcb) < hs->left) {
-      len = tcp_sndbuf(pcb);
-    } else {
-      len = (u16_t)hs->left;
-      LWIP_ASSERT("hs->left did not fit into u16_t!", (len == hs->left));
-    }
-    mss = tcp_mss(pcb);
-    if(len > (2 * mss)) {
-      len = 2 * mss;
+    /* http_write() cuts this down to what the send buffer takes */
+    len = (hs->left > 0xffff) ? 0xffff : (u16_t)hs->left;
+    /* PSH only on the last segment of the response */
+    apiflags = HTTP_IS_DATA_VOLATILE(hs);
+    if ((len < hs->left) ||
+        ((hs->handle != NULL) && (webfs_bytes_left(hs->handle) > 0))) {
+      apiflags |= TCP_WRITE_FLAG_MORE;
     }
-    err = http_write(pcb, hs->file, &len, HTTP_IS_DATA_VOLATILE(hs));
-    if (err == ERR_OK) {
-      data_to_send = true;
-      hs->file += len;
-      hs->left -= len;
+    sendlen = len;
+    err = http_write(pcb, hs, hs->file, &len, apiflags);
+    if (err != ERR_OK) {
+      break;
     }
+    data_to_send = true;
+    hs->file += len;
+    hs->left -= len;
 
-  if((hs->left == 0) && (webfs_bytes_left(hs->handle) <= 0)) {
-    /* We reached the end of the file so this request is done.
-     * This adds the FIN flag right into the last data segment.
-     * @todo: don't close here for HTTP/1.1? */
-    LWIP_DEBUGF(HTTPD_DEBUG, ("End of file.\n"));
+    if ((hs->left == 0) && ((hs->handle == NULL) || (webfs_bytes_left(hs->handle) <= 0))) {
+      /* We reached the end of the file so this request is done.
+       * When closing, this adds the FIN flag right into the last data
+       * segment. */
+      LWIP_DEBUGF(HTTPD_DEBUG, ("End of file.\n"));
 
-    http_close_conn(pcb, hs);
-    return 0;
+      http_end_response(pcb, hs);
+      return 0;
+    }
+    if (len < sendlen) {
+      /* the send buffer is full */
+      break;
+    }
   }
+
+  /* the send buffer is full: send what is queued, http_sent() continues */
+  http_flush(pcb, 0);
   LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("send_data end.\n"));
   return data_to_send;
 }
@@ -786,7 +1308,7 @@ static err_t ICACHE_FLASH_ATTR
 http_find_error_file(struct http_state *hs, u16_t error_nr)
 {
   const char *uri1, *uri2, *uri3;
-  struct webfs_file *file;
+  struct webfs_file *file = &hs->webfs;
 
   if (error_nr == 501) {
     uri1 = "/501.html";
@@ -798,70 +1320,264 @@ http_find_error_file(struct http_state *hs, u16_t error_nr)
     uri2 = "/400.htm";
     uri3 = "/400.shtml";
   }
-  file = webfs_open(uri1, hs->req_info);
-  if (file == NULL) {
-    file = webfs_open(uri2, hs->req_info);
-    if (file == NULL) {
-      file = webfs_open(uri3, hs->req_info);
-      if (file == NULL) {
+  if (!webfs_open(file, uri1, &hs->req_info)) {
+    if (!webfs_open(file, uri2, &hs->req_info)) {
+      if (!webfs_open(file, uri3, &hs->req_info)) {
         LWIP_DEBUGF(HTTPD_DEBUG, ("Error page for error %"U16_F" not found\n",
           error_nr));
         return ERR_ARG;
       }
     }
   }
-  return http_init_file(hs, file, 0, NULL);
+  /* whatever the error page's route says */
+  file->status = error_nr;
+  return http_init_file(hs, file, 0, uri1);
 }
 #else /* LWIP_HTTPD_SUPPORT_EXTSTATUS */
 #define http_find_error_file(hs, error_nr) ERR_ARG
 #endif /* LWIP_HTTPD_SUPPORT_EXTSTATUS */
 
+#if LWIP_HTTPD_SUPPORT_POST
+/** Initialize a http connection with a response that is only a status,
+ * without a body
+ *
+ * @param hs http connection state
+ * @param status HTTP status of the response (one listed in headers.def)
+ * @param uri the HTTP header URI
+ * @return ERR_OK
+ */
+static err_t ICACHE_FLASH_ATTR
+http_init_status(struct http_state *hs, u16_t status, const char *uri)
+{
+  struct webfs_file *file = &hs->webfs;
+
+  memset(file, 0, sizeof(struct webfs_file));
+  file->status = status;
+  return http_init_file(hs, file, 0, uri);
+}
+#endif /* LWIP_HTTPD_SUPPORT_POST */
+
 /**
- * Get the file struct for a 404 error page.
+ * Open the 404 error page into hs->webfs.
  * Tries some file names and returns NULL if none found.
  *
+ * @param hs the connection state
  * @param uri pointer that receives the actual file name URI
  * @return file struct for the error page or NULL no matching file was found
  */
 static struct webfs_file * ICACHE_FLASH_ATTR
-http_get_404_file(const char **uri)
+http_get_404_file(struct http_state *hs, const char **uri)
 {
   printf("[*] http_get_404: uri=%s\n", *uri);
-  struct webfs_file *file;
 
   *uri = "/404.html";
-  file = webfs_open(*uri, NULL);
-  if(file == NULL) {
+  if(!webfs_open(&hs->webfs, *uri, NULL)) {
     /* 404.html doesn't exist. Try 404.htm instead. */
     *uri = "/404.htm";
-    file = webfs_open(*uri, NULL);
-    if(file == NULL) {
+    if(!webfs_open(&hs->webfs, *uri, NULL)) {
       /* 404.htm doesn't exist either. Try 404.shtml instead. */
       *uri = "/404.shtml";
-      file = webfs_open(*uri, NULL);
-      if(file == NULL) {
+      if(!webfs_open(&hs->webfs, *uri, NULL)) {
         /* 404.htm doesn't exist either. Indicate to the caller that it should
          * send back a default 404 page.
          */
         *uri = NULL;
+        return NULL;
       }
     }
   }
 
-  return file;
+  return &hs->webfs;
 }
 
 #if LWIP_HTTPD_SUPPORT_POST
 static err_t ICACHE_FLASH_ATTR
 http_handle_post_finished(struct http_state *hs)
 {
+  err_t err;
   /* application error or POST finished */
-  /* NULL-terminate the buffer */
-  //http_post_response_filename[0] = 0;
+  http_post_response_filename[0] = 0;
   httpd_post_finished(hs, http_post_response_filename, LWIP_HTTPD_POST_MAX_RESPONSE_URI_LEN);
-  printf("[*] httpd_post_finished done, http_post_response_filename=%s\n", http_post_response_filename);
-  return http_find_file(hs, hs->req_info.uri, 0);
+  if ((hs->post != NULL) && (hs->post->multipart != NULL) &&
+      !httpd_multipart_done(hs->post->multipart)) {
+    /* the body ended before its closing delimiter */
+    err = http_init_status(hs, 400, hs->req_info.uri);
+  } else if (http_post_response_filename[0] != 0) {
+    err = http_find_file(hs, http_post_response_filename, 0);
+  } else {
+    /* the route's handler answers */
+    err = http_find_file(hs, hs->req_info.uri, 0);
+  }
+  /* the uri is not needed any more */
+  if ((hs->post != NULL) && (hs->post->req != NULL)) {
+    pbuf_free(hs->post->req);
+    hs->post->req = NULL;
+  }
+  if (hs->req_head != NULL) {
+    mem_free(hs->req_head);
+    hs->req_head = NULL;
+  }
+  return err;
+}
+
+#if LWIP_HTTPD_SUPPORT_REQ_CHUNKED
+/** Decode received data of a chunked body: the chunk data is passed on
+ * where it lies in the pbufs, the framing (sizes, extensions, trailers)
+ * is dropped. The decoder keeps its state across pbufs, so the framing
+ * may be split anywhere. When the body is complete, what follows it is
+ * kept for the next request like after a Content-Length body.
+ *
+ * @param hs http connection state, hs->post->chunk_state is not NONE
+ * @param p received data, freed here
+ * @return ERR_OK, or an error if the framing is broken or the data was
+ *         refused
+ */
+static err_t ICACHE_FLASH_ATTR
+http_post_rxchunked(struct http_state *hs, struct pbuf *p)
+{
+  struct http_post_state *post = hs->post;
+  struct pbuf *q;
+  u16_t used = 0;   /* bytes of p that belong to the body */
+  u16_t data_len = 0;
+  err_t err = ERR_OK;
+
+  for (q = p; (q != NULL) && (err == ERR_OK) &&
+       (post->chunk_state != HTTP_REQ_CHUNK_DONE); q = q->next) {
+    const char *data = (const char *)q->payload;
+    u16_t i = 0;
+    while ((i < q->len) && (err == ERR_OK) && (post->chunk_state != HTTP_REQ_CHUNK_DONE)) {
+      char c;
+      int digit;
+      if (post->chunk_state == HTTP_REQ_CHUNK_DATA) {
+        u16_t n = (u16_t)LWIP_MIN((u32_t)(q->len - i), post->chunk_left);
+        err = http_post_data(hs, data + i, n);
+        post->chunk_left -= n;
+        data_len += n;
+        i += n;
+        if (post->chunk_left == 0) {
+          post->chunk_state = HTTP_REQ_CHUNK_DATA_CR;
+        }
+        continue;
+      }
+      c = data[i++];
+      switch (post->chunk_state) {
+      case HTTP_REQ_CHUNK_SIZE0:
+        /* the bound is per chunk-size line; the trailers, after the last
+           one, share a single total */
+        post->chunk_meta = 0;
+        /* fall through */
+      case HTTP_REQ_CHUNK_SIZE:
+        digit = ((c >= '0') && (c <= '9')) ? (c - '0') :
+                (((c | 0x20) >= 'a') && ((c | 0x20) <= 'f')) ? ((c | 0x20) - 'a' + 10) : -1;
+        if (digit >= 0) {
+          if (post->chunk_left > 0x07ffffff) {
+            err = ERR_ARG;
+            break;
+          }
+          post->chunk_left = (post->chunk_left << 4) | (u32_t)digit;
+          post->chunk_state = HTTP_REQ_CHUNK_SIZE;
+        } else if (post->chunk_state == HTTP_REQ_CHUNK_SIZE0) {
+          err = ERR_ARG;
+        } else if ((c == ';') || (c == ' ') || (c == '\t')) {
+          post->chunk_state = HTTP_REQ_CHUNK_EXT;
+        } else if (c == '\r') {
+          post->chunk_state = HTTP_REQ_CHUNK_SIZE_LF;
+        } else if (c == '\n') {
+          post->chunk_state = (post->chunk_left != 0) ? HTTP_REQ_CHUNK_DATA : HTTP_REQ_CHUNK_TRAILER0;
+        } else {
+          err = ERR_ARG;
+        }
+        break;
+      case HTTP_REQ_CHUNK_EXT:
+      case HTTP_REQ_CHUNK_TRAILER:
+        /* bounded like a request head, they are not looked at */
+        if (++post->chunk_meta > LWIP_HTTPD_MAX_REQ_LENGTH) {
+          err = ERR_ARG;
+        } else if (c == '\n') {
+          post->chunk_state = (post->chunk_state == HTTP_REQ_CHUNK_TRAILER) ? HTTP_REQ_CHUNK_TRAILER0 :
+                              (post->chunk_left != 0) ? HTTP_REQ_CHUNK_DATA : HTTP_REQ_CHUNK_TRAILER0;
+        }
+        break;
+      case HTTP_REQ_CHUNK_SIZE_LF:
+        if (c != '\n') {
+          err = ERR_ARG;
+        } else {
+          post->chunk_state = (post->chunk_left != 0) ? HTTP_REQ_CHUNK_DATA : HTTP_REQ_CHUNK_TRAILER0;
+        }
+        break;
+      case HTTP_REQ_CHUNK_DATA_CR:
+        if (c == '\r') {
+          post->chunk_state = HTTP_REQ_CHUNK_DATA_LF;
+        } else if (c == '\n') {
+          post->chunk_state = HTTP_REQ_CHUNK_SIZE0;
+        } else {
+          err = ERR_ARG;
+        }
+        break;
+      case HTTP_REQ_CHUNK_DATA_LF:
+        if (c != '\n') {
+          err = ERR_ARG;
+        } else {
+          post->chunk_state = HTTP_REQ_CHUNK_SIZE0;
+        }
+        break;
+      case HTTP_REQ_CHUNK_TRAILER0:
+        if (c == '\r') {
+          post->chunk_state = HTTP_REQ_CHUNK_END_LF;
+        } else if (c == '\n') {
+          post->chunk_state = HTTP_REQ_CHUNK_DONE;
+        } else {
+          post->chunk_meta++;
+          post->chunk_state = HTTP_REQ_CHUNK_TRAILER;
+        }
+        break;
+      case HTTP_REQ_CHUNK_END_LF:
+        if (c != '\n') {
+          err = ERR_ARG;
+        } else {
+          post->chunk_state = HTTP_REQ_CHUNK_DONE;
+        }
+        break;
+      default:
+        break;
+      }
+    }
+    used += i;
+  }
+#if LWIP_HTTPD_POST_MANUAL_WND
+  if (post->no_auto_wnd) {
+    /* the application only reports the data it took: open the window for
+       the framing, and for what follows the body, here */
+    u16_t other = (u16_t)(p->tot_len - data_len);
+    post->unrecved_bytes -= other;
+    tcp_recved(post->pcb, other);
+  }
+#endif /* LWIP_HTTPD_POST_MANUAL_WND */
+  if ((err == ERR_OK) && (post->chunk_state == HTTP_REQ_CHUNK_DONE)) {
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+    if (hs->keepalive && (used < p->tot_len)) {
+      /* what follows the body is the next (pipelined) request */
+      struct pbuf *next = http_pbuf_split(p, used);
+      if (next != NULL) {
+        http_hold_request(hs, next);
+      } else {
+        hs->keepalive = 0;
+      }
+    }
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+    post->content_len_left = 0;
+    if (hs->req_info.post_data != NULL) {
+      /* give back what the buffer did not need */
+      httpd_arena_trim(&hs->req_info.arena, hs->req_info.post_data, hs->req_info.post_len + 1);
+    }
+  }
+  pbuf_free(p);
+  if (hs->req_info.post_data != NULL) {
+    hs->req_info.post_data[hs->req_info.post_len] = '\0';
+  }
+  return err;
 }
+#endif /* LWIP_HTTPD_SUPPORT_REQ_CHUNKED */
 
 /** Pass received POST body data to the application and correctly handle
  * returning a response document or closing the connection.
@@ -869,26 +1585,61 @@ http_handle_post_finished(struct http_state *hs)
  *
  * @param hs http connection state
  * @param p pbuf to pass to the application
- * @return ERR_OK if passed successfully, another err_t if the response file
- *         hasn't been found (after POST finished)
+ * @return ERR_OK if passed successfully, ERR_ARG if the data was refused,
+ *         another err_t if the response file hasn't been found (after POST
+ *         finished)
  */
 static err_t ICACHE_FLASH_ATTR
 http_post_rxpbuf(struct http_state *hs, struct pbuf *p)
 {
-  printf("[*] http_post_rxpbuf\n");
+  struct http_post_state *post = hs->post;
   err_t err;
 
-  /* adjust remaining Content-Length */
-  if (hs->post_content_len_left < p->tot_len) {
-    hs->post_content_len_left = 0;
-  } else {
-    hs->post_content_len_left -= p->tot_len;
+#if LWIP_HTTPD_SUPPORT_REQ_CHUNKED
+  if (post->chunk_state != HTTP_REQ_CHUNK_NONE) {
+    err = http_post_rxchunked(hs, p);
+  } else
+#endif /* LWIP_HTTPD_SUPPORT_REQ_CHUNKED */
+  {
+    /* adjust remaining Content-Length */
+    if (post->content_len_left < p->tot_len) {
+      /* what follows the body is the next (pipelined) request */
+      u16_t rest = (u16_t)(p->tot_len - post->content_len_left);
+#if LWIP_HTTPD_POST_MANUAL_WND
+      if (post->no_auto_wnd) {
+        /* the application only reports what it took of the body */
+        post->unrecved_bytes -= rest;
+        tcp_recved(post->pcb, rest);
+      }
+#endif /* LWIP_HTTPD_POST_MANUAL_WND */
+      LWIP_UNUSED_ARG(rest);
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+      if (hs->keepalive) {
+        struct pbuf *next = http_pbuf_split(p, (u16_t)post->content_len_left);
+        if (next != NULL) {
+          http_hold_request(hs, next);
+        } else {
+          hs->keepalive = 0;
+        }
+      }
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+      post->content_len_left = 0;
+    } else {
+      post->content_len_left -= p->tot_len;
+    }
+    err = httpd_post_receive_data(hs, p);
   }
-  err = httpd_post_receive_data(hs, p);
-  if ((err != ERR_OK) || (hs->post_content_len_left == 0)) {
+  if (err != ERR_OK) {
+    /* refused by the body handler: no response, ignore the rest */
+    post->content_len_left = 0;
+    return ERR_ARG;
+  }
+  if (post->content_len_left == 0) {
 #if LWIP_HTTPD_SUPPORT_POST && LWIP_HTTPD_POST_MANUAL_WND
-    if (hs->unrecved_bytes != 0) {
-       return ERR_OK;
+    if ((post->unrecved_bytes != 0) || (hs->handle != NULL)) {
+      /* not all taken yet, or httpd_post_data_recved() called from the
+         body handler has finished the POST already */
+      return ERR_OK;
     }
 #endif /* LWIP_HTTPD_SUPPORT_POST && LWIP_HTTPD_POST_MANUAL_WND */
     /* application error or POST finished */
@@ -898,224 +1649,879 @@ http_post_rxpbuf(struct http_state *hs, struct pbuf *p)
   return ERR_OK;
 }
 
-/** Handle a post request. Called from http_parse_request when method 'POST'
- * is found.
+/** Handle a post request. Called from http_process_request when the head
+ * of a POST (or PUT) request is complete.
  *
  * @param pcb The tcp_pcb which received this packet.
- * @param p The input pbuf (containing the POST header and body).
- * @param hs The http connection state.
- * @param data HTTP request (header and part of body) from input pbuf(s).
- * @param data_len Size of 'data'.
- * @param uri The HTTP URI parsed from input pbuf(s).
- * @param uri_end Pointer to the end of 'uri' (here, the rest of the HTTP
- *                header starts).
+ * @param hs The http connection state; hs->req holds the head and
+ *        possibly the start of the body.
+ * @param data The head of the request, contiguous.
+ * @param uri The HTTP URI, NULL-terminated, inside 'data'.
  * @return ERR_OK: POST correctly parsed and accepted by the application.
- *         ERR_INPROGRESS: POST not completely parsed (no error yet)
  *         another err_t: Error parsing POST or denied by the application
  */
 static err_t ICACHE_FLASH_ATTR
-http_post_request(struct tcp_pcb *pcb, struct pbuf **inp, struct http_state *hs,
-                  char *data, u16_t data_len, char *uri, char *uri_end)
+http_post_request(struct tcp_pcb *pcb, struct http_state *hs, char *data, char *uri)
 {
-  printf("[*] HTTP POST REQUEST uri=%s\n", uri);
+  struct http_parser *ps = &hs->parser;
+  const char *hdr_start_after_uri = uri + ps->uri_len + 1;
+  u16_t hdr_data_len = ps->len - (u16_t)(hdr_start_after_uri - data);
+  struct http_post_state *post;
+  u8_t post_auto_wnd = 1;
+  u32_t content_len = hs->req_info.content_len;
   err_t err;
-  /* search for end-of-header (first double-CRLF) */
-  char* crlfcrlf = strnstr(uri_end + 1, CRLF CRLF, data_len - (uri_end + 1 - data));
 
+  if ((ps->te != HTTP_TE_CHUNKED) &&
+      (!ps->has_content_len || (content_len == 0) || (content_len > 0x7fffffff))) {
+    LWIP_DEBUGF(HTTPD_DEBUG, ("POST received invalid Content-Length: %"U32_F"\n",
+      content_len));
+    return ERR_ARG;
+  }
+  post = (struct http_post_state *)httpd_arena_alloc(&hs->req_info.arena,
+    sizeof(struct http_post_state));
+  if (post == NULL) {
+    LWIP_DEBUGF(HTTPD_DEBUG, ("http_post_request: out of memory\n"));
+    return ERR_ARG;
+  }
+  memset(post, 0, sizeof(struct http_post_state));
+  hs->post = post;
 #if LWIP_HTTPD_POST_MANUAL_WND
-  hs->pcb = pcb;
+  post->pcb = pcb;
 #else /* LWIP_HTTPD_POST_MANUAL_WND */
   LWIP_UNUSED_ARG(pcb); /* only used for LWIP_HTTPD_POST_MANUAL_WND */
 #endif /*  LWIP_HTTPD_POST_MANUAL_WND */
 
-  if (crlfcrlf != NULL) {
-    /* search for "Content-Length: " */
-#define HTTP_HDR_CONTENT_LEN                "Content-Length: "
-#define HTTP_HDR_CONTENT_LEN_LEN            16
-#define HTTP_HDR_CONTENT_LEN_DIGIT_MAX_LEN  10
-    char *scontent_len = strnstr(uri_end + 1, HTTP_HDR_CONTENT_LEN, crlfcrlf - (uri_end + 1));
-    if (scontent_len != NULL) {
-      char *scontent_len_end = strnstr(scontent_len + HTTP_HDR_CONTENT_LEN_LEN, CRLF, HTTP_HDR_CONTENT_LEN_DIGIT_MAX_LEN);
-      if (scontent_len_end != NULL) {
-        int content_len;
-        char *conten_len_num = scontent_len + HTTP_HDR_CONTENT_LEN_LEN;
-        *scontent_len_end = 0;
-        content_len = atoi(conten_len_num);
-        if (content_len > 0) {
-          /* adjust length of HTTP header passed to application */
-          const char *hdr_start_after_uri = uri_end + 1;
-          u16_t hdr_len = LWIP_MIN(data_len, crlfcrlf + 4 - data);
-          u16_t hdr_data_len = LWIP_MIN(data_len, crlfcrlf + 4 - hdr_start_after_uri);
-          u8_t post_auto_wnd = 1;
-          http_post_response_filename[0] = 0;
-          hs->req_info.uri = uri;
-          err = httpd_post_begin(hs, uri, hdr_start_after_uri, hdr_data_len, content_len,
-            http_post_response_filename, LWIP_HTTPD_POST_MAX_RESPONSE_URI_LEN, &post_auto_wnd);
-          if (err == ERR_OK) {
-            /* try to pass in data of the first pbuf(s) */
-            struct pbuf *q = *inp;
-            u16_t start_offset = hdr_len;
+  http_post_response_filename[0] = 0;
+  hs->req_info.uri = uri;
+  err = httpd_post_begin(hs, uri, hdr_start_after_uri, hdr_data_len, (int)content_len,
+    http_post_response_filename, LWIP_HTTPD_POST_MAX_RESPONSE_URI_LEN, &post_auto_wnd);
+  if (err == ERR_OK) {
+    /* try to pass in data of the first pbuf(s) */
+    struct pbuf *q = hs->req;
+    hs->req = NULL;
+    if (hs->req_head == NULL) {
+      /* uri points into the first pbuf: keep it until the body is in */
+      pbuf_ref(q);
+      post->req = q;
+    }
+#if LWIP_HTTPD_POST_MANUAL_WND
+    post->no_auto_wnd = !post_auto_wnd;
+#endif /* LWIP_HTTPD_POST_MANUAL_WND */
+    /* set the Content-Length to be received for this POST */
+    post->content_len_left = content_len;
+#if LWIP_HTTPD_SUPPORT_REQ_CHUNKED
+    if (ps->te == HTTP_TE_CHUNKED) {
+      /* decoded until the last chunk, whatever its length */
+      post->content_len_left = HTTP_POST_CHUNKED;
+      post->chunk_state = HTTP_REQ_CHUNK_SIZE0;
+    }
+#endif /* LWIP_HTTPD_SUPPORT_REQ_CHUNKED */
+
+    /* get to the pbuf where the body starts */
+    q = http_pbuf_skip(q, ps->len);
+    if ((q == NULL) && ps->is_11 && (ps->expect == HTTP_EXPECT_CONTINUE)) {
+      /* the client waits for this before it sends the body */
+      if (tcp_write(pcb, http_100_continue, sizeof(http_100_continue) - 1,
+                    TCP_WRITE_FLAG_COPY) == ERR_OK) {
+        tcp_output(pcb);
+      } else {
+        LWIP_DEBUGF(HTTPD_DEBUG, ("No memory to send 100 Continue\n"));
+      }
+    }
+    if (q != NULL) {
+#if LWIP_HTTPD_POST_MANUAL_WND
+      if (!post_auto_wnd) {
+        /* already tcp_recved() this data... */
+        post->unrecved_bytes = q->tot_len;
+      }
+#endif /* LWIP_HTTPD_POST_MANUAL_WND */
+      return http_post_rxpbuf(hs, q);
+    } else {
+      return ERR_OK;
+    }
+  } else if (http_post_response_filename[0] != 0) {
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+    /* the body that follows would be taken for the next request */
+    hs->keepalive = 0;
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+    /* return file passed from application */
+    return http_find_file(hs, http_post_response_filename, 0);
+  } else if (err == ERR_VAL) {
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+    /* the client may send the body anyway */
+    hs->keepalive = 0;
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+    /* refused by the route: answered before the body arrives */
+    return http_init_status(hs, hs->req_info.status, uri);
+  } else {
+    /* refused without a response file: bad request */
+    return ERR_ARG;
+  }
+}
+
+/**
+ * Decide on a request body from the head alone, before any of it is
+ * received: an expectation the server cannot meet, the Content-Length
+ * the Content-Type a multipart route needs, the Content-Length against the
+ * route's limit, then the route's accept handler.
+ *
+ * @param hs http connection state, hs->post->body is set
+ * @param m the route's method, NULL if there is none
+ * @param max_len most body bytes the route takes
+ * @return 0 to take the body, else the status to refuse the request with
+ */
+static u16_t ICACHE_FLASH_ATTR
+http_post_accept(struct http_state *hs, const RouteMethod *m, u32_t max_len)
+{
+  HTTPRequest *req = &hs->req_info;
+  u8_t boundary_len;
+
+  /* HTTP/1.0 clients do not know about expectations, RFC 7231 5.1.1 */
+  if (hs->parser.is_11 && (hs->parser.expect == HTTP_EXPECT_OTHER)) {
+    return 417;
+  }
+  if ((m != NULL) && (m->part != NULL) && (httpd_multipart_boundary(req, &boundary_len) == NULL)) {
+    return 415;
+  }
+  if (req->content_len > max_len) {
+    LWIP_DEBUGF(HTTPD_DEBUG, ("POST body of %"U32_F" bytes too large\n", req->content_len));
+    return 413;
+  }
+  if ((m != NULL) && (m->accept != NULL)) {
+    int status = m->accept(req, NULL);
+    if (status != 0) {
+      LWIP_DEBUGF(HTTPD_DEBUG, ("POST refused with %d\n", status));
+      return (u16_t)status;
+    }
+  }
+  return 0;
+}
+
+/* Refuses a request with ERR_VAL, req_info.status being the status to
+   answer it with, see http_post_accept() */
+err_t ICACHE_FLASH_ATTR
+httpd_post_begin(void *connection, const char *uri, const char *http_request,
+                 u16_t http_request_len, int content_len, char *response_uri,
+                 u16_t response_uri_len, u8_t *post_auto_wnd)
+{
+  struct http_state *hs = (struct http_state *)connection;
+  const URLRouter *route;
+  const RouteMethod *m = NULL;
+  u32_t max_len = 0x7fffffff;
+  http_part_handler part = NULL;
+  u16_t status;
+  char *params;
+
+  LWIP_UNUSED_ARG(http_request);
+  LWIP_UNUSED_ARG(http_request_len);
+  LWIP_UNUSED_ARG(response_uri);
+  LWIP_UNUSED_ARG(response_uri_len);
+  if (!uri || (uri[0] == '\0')) {
+    return ERR_ARG;
+  }
+
+  /* find out how the route takes its body, without the parameters */
+  params = strchr(uri, '?');
+  if (params != NULL) {
+    *params = '\0';
+  }
+  route = router_lookup(&router_table, uri, &hs->req_info);
+  if (params != NULL) {
+    *params = '?';
+  }
+  hs->post->body = NULL;
+  if (route != NULL) {
+    m = &route->func[hs->req_info.method];
+    hs->post->body = m->body;
+    part = m->part;
+    if (m->max_body != 0) {
+      max_len = LWIP_MIN(m->max_body, max_len);
+    }
+#if LWIP_HTTPD_POST_MANUAL_WND
+    if ((m->body != NULL) && (m->flags & ROUTE_MANUAL_WND)) {
+      *post_auto_wnd = 0;
+    }
+#endif /* LWIP_HTTPD_POST_MANUAL_WND */
+  }
+#if !LWIP_HTTPD_POST_MANUAL_WND
+  LWIP_UNUSED_ARG(post_auto_wnd);
+#endif /* !LWIP_HTTPD_POST_MANUAL_WND */
+
+  if ((hs->post->body == NULL) && (part == NULL)) {
+    max_len = LWIP_MIN(LWIP_HTTPD_POST_MAX_PAYLOAD_LEN, max_len);
+  }
+  hs->req_info.content_len = (uint32_t)content_len;
+  hs->req_info.post_len = 0;
+  hs->req_info.post_data = NULL;
+  status = http_post_accept(hs, m, max_len);
+  if (status != 0) {
+    hs->req_info.status = status;
+    return ERR_VAL;
+  }
+#if LWIP_HTTPD_SUPPORT_REQ_CHUNKED
+  /* a chunked body is only known to be too large once it is */
+  hs->post->chunk_max = max_len;
+#endif /* LWIP_HTTPD_SUPPORT_REQ_CHUNKED */
+  if (part != NULL) {
+    /* parsed as it comes, nothing of it is buffered */
+    hs->post->multipart = httpd_multipart_new(&hs->req_info, part);
+    if (hs->post->multipart == NULL) {
+      return ERR_MEM;
+    }
+  } else if (hs->post->body == NULL) {
+    /* a chunked body (content_len 0) may take up all of the limit, the
+       rest is given back once it is complete */
+    hs->req_info.post_data = (char *)httpd_arena_alloc(&hs->req_info.arena,
+      HTTP_POST_MAX_LEN(hs) + 1);
+    if (hs->req_info.post_data == NULL) {
+      return ERR_MEM;
+    }
+  }
+  return ERR_OK;
+}
+
+/** Pass body data to the route's body handler or multipart parser, or
+ * append it to req->post_data.
+ *
+ * @return ERR_OK, ERR_ABRT if the body handler refused it (or the
+ *         multipart body is malformed), ERR_MEM if the body gets larger
+ *         than the request may have
+ */
+static err_t ICACHE_FLASH_ATTR
+http_post_data(struct http_state *hs, const char *data, u32_t len)
+{
+  HTTPRequest *req = &hs->req_info;
+
+  if (len > HTTP_POST_MAX_LEN(hs) - req->post_len) {
+    LWIP_DEBUGF(HTTPD_DEBUG, ("POST body too large\n"));
+    return ERR_MEM;
+  }
+  if (hs->post->body != NULL) {
+    if (hs->post->body(req, data, (int)len, NULL) < 0) {
+      return ERR_ABRT;
+    }
+  } else if (hs->post->multipart != NULL) {
+    if (httpd_multipart_feed(hs->post->multipart, req, data, len) != ERR_OK) {
+      return ERR_ABRT;
+    }
+  } else {
+    MEMCPY(req->post_data + req->post_len, data, len);
+    HTTPD_STATS_ADD(bytes_copied, len);
+  }
+  req->post_len += len;
+  return ERR_OK;
+}
+
+err_t ICACHE_FLASH_ATTR
+httpd_post_receive_data(void *connection, struct pbuf *p)
+{
+  struct http_state *hs = (struct http_state *)connection;
+  HTTPRequest *req = &hs->req_info;
+  struct pbuf *q;
+  err_t err = ERR_OK;
+
+  for (q = p; q != NULL; q = q->next) {
+    /* Content-Length bounds the body, whatever else the peer sends */
+    u32_t len = LWIP_MIN(q->len, req->content_len - req->post_len);
+    if (len == 0) {
+      break;
+    }
+    err = http_post_data(hs, (const char *)q->payload, len);
+    if (err != ERR_OK) {
+      break;
+    }
+  }
+  pbuf_free(p);
+
+  if ((hs->post->body == NULL) && (req->post_data != NULL)) {
+    req->post_data[req->post_len] = '\0';
+  }
+  return err;
+}
+
+void ICACHE_FLASH_ATTR
+httpd_post_finished(void *connection, char *response_uri, u16_t response_uri_len)
+{
+  /* leave response_uri empty: the route's handler builds the response */
+  LWIP_UNUSED_ARG(connection);
+  LWIP_UNUSED_ARG(response_uri);
+  LWIP_UNUSED_ARG(response_uri_len);
+}
+
 #if LWIP_HTTPD_POST_MANUAL_WND
-            hs->no_auto_wnd = !post_auto_wnd;
+/** A POST implementation can call this function to update the TCP window.
+ * This can be used to throttle data reception (e.g. when received data is
+ * programmed to flash and data is received faster than programmed).
+ *
+ * @param connection A connection handle passed to httpd_post_begin for which
+ *        httpd_post_finished has *NOT* been called yet!
+ * @param recved_len Length of data received (for window update)
+ */
+void ICACHE_FLASH_ATTR
+httpd_post_data_recved(void *connection, u16_t recved_len)
+{
+  printf("[*] httpd_post_data_recved invoked\n");
+  struct http_state *hs = (struct http_state*)connection;
+  if ((hs != NULL) && (hs->post != NULL)) {
+    struct http_post_state *post = hs->post;
+    if (post->no_auto_wnd) {
+      u16_t len = recved_len;
+      if (post->unrecved_bytes >= recved_len) {
+        post->unrecved_bytes -= recved_len;
+      } else {
+        LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_LEVEL_WARNING, ("httpd_post_data_recved: recved_len too big\n"));
+        len = (u16_t)post->unrecved_bytes;
+        post->unrecved_bytes = 0;
+      }
+      if (post->pcb != NULL) {
+        struct tcp_pcb *pcb = post->pcb;
+        if (len != 0) {
+          tcp_recved(pcb, len);
+        }
+        if ((post->content_len_left == 0) && (post->unrecved_bytes == 0)) {
+          /* finished handling POST */
+          http_handle_post_finished(hs);
+          http_send_data(pcb, hs);
+        }
+      }
+    }
+  }
+}
 #endif /* LWIP_HTTPD_POST_MANUAL_WND */
-            /* set the Content-Length to be received for this POST */
-            hs->post_content_len_left = (u32_t)content_len;
-
-            /* get to the pbuf where the body starts */
-            while((q != NULL) && (q->len <= start_offset)) {
-              struct pbuf *head = q;
-              start_offset -= q->len;
-              q = q->next;
-              /* free the head pbuf */
-              head->next = NULL;
-              pbuf_free(head);
+
+#endif /* LWIP_HTTPD_SUPPORT_POST */
+
+/** Names of the headers the parser knows (HTTP_PARSE_HDR_*), in lower
+ * case */
+static const char * const http_parse_hdrs[] = {
+  "host",
+  "connection",
+  "accept-encoding",
+  "if-none-match",
+  "content-type",
+  "range",
+  "content-length",
+  "transfer-encoding",
+  "expect"
+};
+#define HTTP_PARSE_NUM_HDRS  (sizeof(http_parse_hdrs) / sizeof(http_parse_hdrs[0]))
+#define HTTP_PARSE_HDRS_ALL  ((1 << HTTP_PARSE_NUM_HDRS) - 1)
+
+/**
+ * Record where the value of a header starts, the parser having just taken
+ * its ':'. A header known by name gets its HTTP_HDR_* slot (the first time
+ * it comes), any other one an entry in req_info.hdrs while they last.
+ * Offsets are relative to the URI, which is where the handler finds it.
+ */
+static void ICACHE_FLASH_ATTR
+http_parse_hdr_begin(struct http_state *hs)
+{
+  struct http_parser *ps = &hs->parser;
+  HTTPRequest *req = &hs->req_info;
+  u16_t value_off = (u16_t)(ps->len - ps->uri_off);
+
+  ps->hdr_slot = 0;
+  if (ps->hdr < HTTP_HDR_COUNT) {
+    if (req->hdr[ps->hdr].off == 0) {
+      req->hdr[ps->hdr].off = value_off;
+      ps->hdr_slot = (u8_t)(ps->hdr + 1);
+      return;
+    }
+  } else if (HTTP_PARSE_HDR_EVALUATED(ps->hdr)) {
+    /* evaluated by the parser, see req_info.content_len */
+    return;
+  }
+#if HTTP_MAX_HEADERS
+  /* a name of 0xff bytes may be longer, name_len stops counting there */
+  if ((req->hdr_count < HTTP_MAX_HEADERS) && (ps->name_len < 0xff)) {
+    HTTPHeader *h = &req->hdrs[req->hdr_count];
+    h->name_off = (u16_t)(value_off - 1 - ps->name_len);
+    h->name_len = ps->name_len;
+    h->value_len = 0;
+    ps->hdr_slot = (u8_t)(HTTP_PARSE_SLOT_OTHER | req->hdr_count);
+    req->hdr_count++;
+  }
+#endif /* HTTP_MAX_HEADERS */
+}
+
+/**
+ * Record the length of a header value, the parser being at the end of its
+ * line.
+ */
+static void ICACHE_FLASH_ATTR
+http_parse_hdr_end(struct http_state *hs)
+{
+  struct http_parser *ps = &hs->parser;
+  HTTPRequest *req = &hs->req_info;
+  u16_t end = (u16_t)(ps->len - 1 - ps->uri_off);
+
+  if (ps->hdr_slot == 0) {
+    return;
+  }
+#if HTTP_MAX_HEADERS
+  if (ps->hdr_slot & HTTP_PARSE_SLOT_OTHER) {
+    HTTPHeader *h = &req->hdrs[ps->hdr_slot & ~HTTP_PARSE_SLOT_OTHER];
+    h->value_len = (u16_t)(end - (h->name_off + h->name_len + 1));
+    return;
+  }
+#endif /* HTTP_MAX_HEADERS */
+  req->hdr[ps->hdr_slot - 1].len = (u16_t)(end - req->hdr[ps->hdr_slot - 1].off);
+}
+
+/** Compare len bytes of two header names, ignoring case */
+static int ICACHE_FLASH_ATTR
+http_header_name_eq(const char *a, const char *b, size_t len)
+{
+  while (len-- > 0) {
+    char ca = *a++, cb = *b++;
+    if ((ca >= 'A') && (ca <= 'Z')) {
+      ca = (char)(ca + ('a' - 'A'));
+    }
+    if ((cb >= 'A') && (cb <= 'Z')) {
+      cb = (char)(cb + ('a' - 'A'));
+    }
+    if (ca != cb) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/** Value of a recorded header without the whitespace around it */
+static const char * ICACHE_FLASH_ATTR
+http_header_value(const HTTPRequest *req, u16_t off, u16_t len, u16_t *value_len)
+{
+  const char *v = req->uri + off;
+
+  while ((len > 0) && ((*v == ' ') || (*v == '\t'))) {
+    v++;
+    len--;
+  }
+  while ((len > 0) && ((v[len - 1] == ' ') || (v[len - 1] == '\t'))) {
+    len--;
+  }
+  *value_len = len;
+  return v;
+}
+
+/**
+ * Look up one of the HTTP_HDR_* headers of a request, without scanning.
+ * The value points into the received request (it is not NUL-terminated)
+ * and, like req->uri, is only valid until the handler returns.
+ *
+ * @param req the request passed to the handler
+ * @param id HTTP_HDR_*
+ * @param len receives the length of the value
+ * @return the value of the first such header, NULL if there is none
+ */
+const char * ICACHE_FLASH_ATTR
+http_header(const HTTPRequest *req, u8_t id, u16_t *len)
+{
+  if ((id >= HTTP_HDR_COUNT) || (req->hdr[id].off == 0)) {
+    return NULL;
+  }
+  return http_header_value(req, req->hdr[id].off, req->hdr[id].len, len);
+}
+
+/**
+ * Look up a header by name (case-insensitive): the HTTP_HDR_* ones, and
+ * the first HTTP_MAX_HEADERS others the request had. Content-Length,
+ * Transfer-Encoding and Expect are not recorded, the server takes care of
+ * the body.
+ *
+ * @param req the request passed to the handler
+ * @param name name of the header
+ * @param len receives the length of the value
+ * @return the value of the first such header, NULL if none was recorded
+ */
+const char * ICACHE_FLASH_ATTR
+http_header_find(const HTTPRequest *req, const char *name, u16_t *len)
+{
+  size_t name_len = strlen(name);
+  u8_t i;
+
+  for (i = 0; i < HTTP_HDR_COUNT; i++) {
+    if ((strlen(http_parse_hdrs[i]) == name_len) &&
+        http_header_name_eq(name, http_parse_hdrs[i], name_len)) {
+      return http_header(req, i, len);
+    }
+  }
+#if HTTP_MAX_HEADERS
+  for (i = 0; i < req->hdr_count; i++) {
+    const HTTPHeader *h = &req->hdrs[i];
+    if ((h->name_len == name_len) && http_header_name_eq(req->uri + h->name_off, name, name_len)) {
+      return http_header_value(req, (u16_t)(h->name_off + h->name_len + 1), h->value_len, len);
+    }
+  }
+#endif /* HTTP_MAX_HEADERS */
+  return NULL;
+}
+
+/**
+ * Evaluate a token of the Connection, Transfer-Encoding or Expect header
+ * (collected in ps->token).
+ * "close" wins over "keep-alive" if a confused client sends both. Of the
+ * transfer codings, only "chunked" on its own is decoded, and of the
+ * expectations only "100-continue" is met.
+ */
+static void ICACHE_FLASH_ATTR
+http_parse_token(struct http_parser *ps)
+{
+  if (ps->hdr == HTTP_PARSE_HDR_TRANSFER_ENC) {
+    if (ps->token_len == 0) {
+      /* empty list element */
+    } else if ((ps->token_len == 7) && !memcmp(ps->token, "chunked", 7)) {
+      ps->te = (ps->te == HTTP_TE_NONE) ? HTTP_TE_CHUNKED :
+               (ps->te == HTTP_TE_OTHER) ? HTTP_TE_OTHER : HTTP_TE_BAD;
+    } else {
+      ps->te = (ps->te == HTTP_TE_CHUNKED) ? HTTP_TE_BAD :
+               (ps->te == HTTP_TE_BAD) ? HTTP_TE_BAD : HTTP_TE_OTHER;
+    }
+  } else if (ps->hdr == HTTP_PARSE_HDR_EXPECT) {
+    if (ps->token_len == 0) {
+      /* empty list element */
+    } else if ((ps->token_len == 12) && !memcmp(ps->token, "100-continue", 12)) {
+      if (ps->expect == HTTP_EXPECT_NONE) {
+        ps->expect = HTTP_EXPECT_CONTINUE;
+      }
+    } else {
+      ps->expect = HTTP_EXPECT_OTHER;
+    }
+  } else if ((ps->token_len == 5) && !memcmp(ps->token, "close", 5)) {
+    ps->conn = HTTP_CONN_CLOSE;
+  } else if ((ps->token_len == 10) && !memcmp(ps->token, "keep-alive", 10) &&
+             (ps->conn != HTTP_CONN_CLOSE)) {
+    ps->conn = HTTP_CONN_KEEP_ALIVE;
+  }
+  ps->token_len = 0;
+}
+
+/**
+ * Set the method of the request from the first word of the request line.
+ *
+ * @return ERR_OK, or ERR_VAL for a method that is not implemented
+ */
+static err_t ICACHE_FLASH_ATTR
+http_parse_method(struct http_state *hs)
+{
+  struct http_parser *ps = &hs->parser;
+
+  ps->method[ps->method_len] = 0;
+  if (!strcmp(ps->method, "GET")) {
+    hs->req_info.method = HTTP_METHOD_GET;
+  } else if (!strcmp(ps->method, "DELETE")) {
+    hs->req_info.method = HTTP_METHOD_DELETE;
+#if LWIP_HTTPD_SUPPORT_POST
+  } else if (!strcmp(ps->method, "POST")) {
+    hs->req_info.method = HTTP_METHOD_POST;
+  } else if (!strcmp(ps->method, "PUT")) {
+    /* PUT carries a body just like POST */
+    hs->req_info.method = HTTP_METHOD_PUT;
+#endif /* LWIP_HTTPD_SUPPORT_POST */
+  } else {
+    LWIP_DEBUGF(HTTPD_DEBUG, ("Unsupported request method (not implemented): \"%s\"\n",
+      ps->method));
+    return ERR_VAL;
+  }
+  LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("Received %s request\n", ps->method));
+  return ERR_OK;
+}
+
+/**
+ * Feed newly received data to the request head parser.
+ *
+ * @param hs the connection state
+ * @param p the received pbuf (chain), not seen by the parser before
+ * @return ERR_OK if the head is complete (hs->parser.len is its length)
+ *         ERR_INPROGRESS if more data is needed
+ *         ERR_VAL if the method is not implemented
+ *         ERR_ARG if the request is malformed or its head too long
+ */
+static err_t ICACHE_FLASH_ATTR
+http_parse_head(struct http_state *hs, struct pbuf *p)
+{
+  struct http_parser *ps = &hs->parser;
+  struct pbuf *q;
+  err_t err;
+
+  for (q = p; q != NULL; q = q->next) {
+    const char *data = (const char *)q->payload;
+    u16_t i;
+    for (i = 0; i < q->len; i++) {
+      char c;
+      /* skip the runs of bytes that only end at a delimiter in one go */
+      u16_t avail = LWIP_MIN(q->len - i, LWIP_HTTPD_MAX_REQ_LENGTH - ps->len);
+      u16_t n = 0;
+      if (ps->state == HTTP_PARSE_URI) {
+        n = (u16_t)http_scan(data + i, avail, HTTP_SCAN_SP | HTTP_SCAN_EOL);
+      } else if ((ps->state == HTTP_PARSE_HDR_VALUE) && !HTTP_PARSE_HDR_EVALUATED(ps->hdr)) {
+        n = (u16_t)http_scan(data + i, avail, HTTP_SCAN_EOL);
+      } else if ((ps->state == HTTP_PARSE_HDR_NAME) && !ps->name_match) {
+        n = (u16_t)http_scan(data + i, avail, HTTP_SCAN_COLON | HTTP_SCAN_EOL);
+        /* the length is still needed to record the header */
+        ps->name_len = (u8_t)LWIP_MIN(0xff, ps->name_len + n);
+      }
+      ps->len += n;
+      i += n;
+      if (i == q->len) {
+        break;
+      }
+      c = data[i];
+      if (ps->len == LWIP_HTTPD_MAX_REQ_LENGTH) {
+        LWIP_DEBUGF(HTTPD_DEBUG, ("Request head too long\n"));
+        return ERR_ARG;
+      }
+      ps->len++;
+      switch (ps->state) {
+      case HTTP_PARSE_METHOD:
+        if (c == ' ') {
+          err = http_parse_method(hs);
+          if (err != ERR_OK) {
+            return err;
+          }
+          ps->uri_off = ps->len;
+          ps->state = HTTP_PARSE_URI;
+        } else if ((c == '\r') || (c == '\n')) {
+          return ERR_ARG;
+        } else if (ps->method_len < sizeof(ps->method) - 1) {
+          ps->method[ps->method_len++] = c;
+        } else {
+          /* longer than any method we know */
+          return ERR_VAL;
+        }
+        break;
+      case HTTP_PARSE_URI:
+        if ((c == ' ') || (c == '\r') || (c == '\n')) {
+          ps->uri_len = ps->len - 1 - ps->uri_off;
+          if (ps->uri_len == 0) {
+            return ERR_ARG;
+          }
+          if (c == ' ') {
+            ps->state = HTTP_PARSE_VERSION;
+          } else {
+#if LWIP_HTTPD_SUPPORT_V09
+            /* HTTP/0.9: no version and no headers */
+            ps->is_09 = 1;
+            ps->state = (c == '\r') ? HTTP_PARSE_LINE_LF : HTTP_PARSE_DONE;
+#else /* LWIP_HTTPD_SUPPORT_V09 */
+            return ERR_ARG;
+#endif /* LWIP_HTTPD_SUPPORT_V09 */
+          }
+        }
+        break;
+      case HTTP_PARSE_VERSION:
+        if (c == '\r') {
+          ps->state = HTTP_PARSE_LINE_LF;
+        } else if (c == '\n') {
+          ps->state = HTTP_PARSE_HDR_START;
+        } else {
+          /* "HTTP/1.1": major at 5, minor at 7 */
+          if (ps->name_len == 5) {
+            ps->is_11 = (c == '1');
+          } else if (ps->name_len == 7) {
+            ps->is_11 = ps->is_11 && (c >= '1') && (c <= '9');
+          }
+          if (ps->name_len < 0xff) {
+            ps->name_len++;
+          }
+        }
+        break;
+      case HTTP_PARSE_LINE_LF:
+        if (c != '\n') {
+          return ERR_ARG;
+        }
+        ps->state = ps->is_09 ? HTTP_PARSE_DONE : HTTP_PARSE_HDR_START;
+        break;
+      case HTTP_PARSE_HDR_START:
+        if (c == '\r') {
+          ps->state = HTTP_PARSE_END_LF;
+          break;
+        } else if (c == '\n') {
+          ps->state = HTTP_PARSE_DONE;
+          break;
+        }
+        ps->name_len = 0;
+        ps->name_match = HTTP_PARSE_HDRS_ALL;
+        ps->state = HTTP_PARSE_HDR_NAME;
+        /* fall through */
+      case HTTP_PARSE_HDR_NAME:
+        if (c == ':') {
+          u8_t h;
+          ps->hdr = HTTP_PARSE_HDR_NONE;
+          for (h = 0; h < HTTP_PARSE_NUM_HDRS; h++) {
+            if ((ps->name_match & (1 << h)) && (http_parse_hdrs[h][ps->name_len] == 0)) {
+              ps->hdr = h;
             }
-            *inp = NULL;
-            if (q != NULL) {
-              /* hide the remaining HTTP header */
-              pbuf_header(q, -(s16_t)start_offset);
-#if LWIP_HTTPD_POST_MANUAL_WND
-              if (!post_auto_wnd) {
-                /* already tcp_recved() this data... */
-                hs->unrecved_bytes = q->tot_len;
-              }
-#endif /* LWIP_HTTPD_POST_MANUAL_WND */
-              return http_post_rxpbuf(hs, q);
-            } else {
-              return ERR_OK;
+          }
+          if (ps->hdr == HTTP_PARSE_HDR_CONTENT_LEN) {
+            if (ps->has_content_len) {
+              return ERR_ARG;
             }
-          } else {
-            /* return file passed from application */
-            return http_find_file(hs, http_post_response_filename, 0);
+            ps->has_content_len = 1;
           }
+          http_parse_hdr_begin(hs);
+          ps->state = HTTP_PARSE_HDR_VALUE;
+        } else if ((c == '\r') || (c == '\n')) {
+          return ERR_ARG;
         } else {
-          LWIP_DEBUGF(HTTPD_DEBUG, ("POST received invalid Content-Length: %s\n",
-            conten_len_num));
+          u8_t h;
+          /* c | 0x20 lowers letters and leaves '-' alone; a name longer
+             than a candidate fails at the candidate's NUL */
+          for (h = 0; h < HTTP_PARSE_NUM_HDRS; h++) {
+            if ((ps->name_match & (1 << h)) &&
+                ((c | 0x20) != http_parse_hdrs[h][ps->name_len])) {
+              ps->name_match &= ~(1 << h);
+            }
+          }
+          if (ps->name_len < 0xff) {
+            ps->name_len++;
+          }
+        }
+        break;
+      case HTTP_PARSE_HDR_VALUE:
+        if ((c == '\r') || (c == '\n')) {
+          if (HTTP_PARSE_HDR_LIST(ps->hdr)) {
+            http_parse_token(ps);
+          }
+          http_parse_hdr_end(hs);
+          ps->state = (c == '\r') ? HTTP_PARSE_HDR_LF : HTTP_PARSE_HDR_START;
+        } else if ((c == ' ') || (c == '\t')) {
+          /* ignore whitespace */
+        } else if (ps->hdr == HTTP_PARSE_HDR_CONTENT_LEN) {
+          /* straight into the request: the parser has no copy of it */
+          u32_t len = hs->req_info.content_len;
+          if ((c < '0') || (c > '9') || (len > 0x7fffffff / 10)) {
+            return ERR_ARG;
+          }
+          hs->req_info.content_len = len * 10 + (u32_t)(c - '0');
+        } else if (HTTP_PARSE_HDR_LIST(ps->hdr)) {
+          if (c == ',') {
+            http_parse_token(ps);
+          } else {
+            if (ps->token_len < sizeof(ps->token)) {
+              ps->token[ps->token_len] = c | 0x20;
+            }
+            if (ps->token_len < 0xff) {
+              ps->token_len++;
+            }
+          }
+        }
+        break;
+      case HTTP_PARSE_HDR_LF:
+      case HTTP_PARSE_END_LF:
+        if (c != '\n') {
           return ERR_ARG;
         }
+        ps->state = (ps->state == HTTP_PARSE_END_LF) ? HTTP_PARSE_DONE : HTTP_PARSE_HDR_START;
+        break;
+      default:
+        break;
+      }
+      if (ps->state == HTTP_PARSE_DONE) {
+        return ERR_OK;
       }
     }
   }
-  /* if we come here, the POST is incomplete */
-#if LWIP_HTTPD_SUPPORT_REQUESTLIST
   return ERR_INPROGRESS;
-#else /* LWIP_HTTPD_SUPPORT_REQUESTLIST */
-  return ERR_ARG;
-#endif /* LWIP_HTTPD_SUPPORT_REQUESTLIST */
-}
-#if LWIP_HTTPD_SUPPORT_POST
-err_t httpd_post_begin(void *connection, const char *uri, const char *http_request,
-                       u16_t http_request_len, int content_len, char *response_uri,
-                       u16_t response_uri_len, u8_t *post_auto_wnd)
-{
-  printf("[*] http_post_begin: uri=%s\n", uri);
-struct http_state *hs = (struct http_state *)connection;
-
- if(!uri || (uri[0] == '\0')) {
-    return ERR_ARG;
- }
-  return ERR_OK;
 }
 
-#define LWIP_HTTPD_POST_MAX_PAYLOAD_LEN     512
-static char http_post_payload[LWIP_HTTPD_POST_MAX_PAYLOAD_LEN];
-static u16_t http_post_payload_len = 0;
-
-err_t httpd_post_receive_data(void *connection, struct pbuf *p)
+/**
+ * Dispatch a request whose head is complete.
+ *
+ * @param hs the connection state, hs->req holds the head
+ * @param pcb the tcp_pcb which received the request
+ * @return ERR_OK if request was OK and hs has been initialized correctly
+ *         another err_t otherwise
+ */
+static err_t ICACHE_FLASH_ATTR
+http_process_request(struct http_state *hs, struct tcp_pcb *pcb)
 {
-    printf("[*] httpd_post_receive_data invoked \n");
-    struct http_state *hs = (struct http_state *)connection;
-    struct pbuf *q = p;
-    int count;
-    u32_t http_post_payload_full_flag = 0;
-    while(q != NULL)  // 缓存接收的数据至http_post_payload
-    {
-      if(http_post_payload_len + q->len <= LWIP_HTTPD_POST_MAX_PAYLOAD_LEN) {
-          MEMCPY(http_post_payload+http_post_payload_len, q->payload, q->len);
-          http_post_payload_len += q->len;
-      }
-      else {  // 缓存溢出 置溢出标志位
-        http_post_payload_full_flag = 1;
-        break;
-      }
-      q = q->next;
-    }
-
-    pbuf_free(p); // 释放pbuf
+  struct http_parser *ps = &hs->parser;
+  char *data;
+  char *uri;
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+  err_t err;
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
 
-    if(http_post_payload_full_flag) // 缓存溢出 则丢弃数据
-    {
-        http_post_payload_full_flag = 0;
-        http_post_payload_len = 0;
-    }else if(hs->post_content_len_left == 0) {  // POST数据已经接收完毕 则处理
-        printf("[*] payload=%s \n", http_post_payload);
-        hs->req_info.post_data = http_post_payload;
-        //count = extract_uri_parameters(hs, http_post_payload);  // 解析
-        printf("[*] POST PARAMETERS: %s, %s, payload=%s", hs->params, hs->param_vals, http_post_payload);
-        http_post_payload_len = 0;
+  if (hs->req->len >= ps->len) {
+    /* the usual case: the head came in one pbuf, use it in place */
+    data = (char *)hs->req->payload;
+  } else {
+    /* the head spans pbufs: copy it, once, into a buffer of its own */
+    data = (char *)mem_malloc((mem_size_t)(ps->len + 1));
+    if (data == NULL) {
+      LWIP_DEBUGF(HTTPD_DEBUG, ("No memory for a request head of %"U16_F" bytes\n", ps->len));
+      return ERR_ARG;
     }
-    return ERR_OK;
-}
-
- 
-void httpd_post_finished(void *connection, char *response_uri, u16_t response_uri_len)
-{
-    printf("[*] httpd_post_finished invoked, uri=%s", response_uri);
-    struct http_state *hs = (struct http_state *)connection;
-    printf("[*] httpd_post_finished, uri=%s", hs->req_info.uri);
-}
-
-/* LWIP_HTTPD_SUPPORT_POST END */
-#endif 
-
+    pbuf_copy_partial(hs->req, data, ps->len, 0);
+    HTTPD_STATS_ADD(bytes_copied, ps->len);
+    hs->req_head = data;
+  }
+  uri = data + ps->uri_off;
+  uri[ps->uri_len] = 0;
+  LWIP_DEBUGF(HTTPD_DEBUG, ("Received \"%s\" request for URI: \"%s\"\n",
+              ps->method, uri));
+  if (ps->te != HTTP_TE_NONE) {
+    /* only the chunked framing tells where such a body ends */
+    if ((ps->te == HTTP_TE_OTHER) || !LWIP_HTTPD_SUPPORT_REQ_CHUNKED) {
+      return ERR_VAL;
+    }
+    if ((ps->te == HTTP_TE_BAD) || ps->has_content_len || !ps->is_11) {
+      return ERR_ARG;
+    }
+  }
 
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+  hs->requests++;
+  if (ps->is_11) {
+    hs->keepalive = (ps->conn != HTTP_CONN_CLOSE);
+  } else {
+    hs->keepalive = !ps->is_09 && (ps->conn == HTTP_CONN_KEEP_ALIVE);
+  }
+  if (hs->requests >= LWIP_HTTPD_MAX_KEEPALIVE_REQUESTS) {
+    hs->keepalive = 0;
+  }
+  if (hs->keepalive) {
+    /* no FIN pushes out the last segment of a response any more: do not
+       let it wait for the ACK of the one before */
+    tcp_nagle_disable(pcb);
+  }
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
 
-#if LWIP_HTTPD_POST_MANUAL_WND
-/** A POST implementation can call this function to update the TCP window.
- * This can be used to throttle data reception (e.g. when received data is
- * programmed to flash and data is received faster than programmed).
- *
- * @param connection A connection handle passed to httpd_post_begin for which
- *        httpd_post_finished has *NOT* been called yet!
- * @param recved_len Length of data received (for window update)
- */
-void ICACHE_FLASH_ATTR
-httpd_post_data_recved(void *connection, u16_t recved_len)
-{
-  printf("[*] httpd_post_data_recved invoked\n");
-  struct http_state *hs = (struct http_state*)connection;
-  if (hs != NULL) {
-    if (hs->no_auto_wnd) {
-      u16_t len = recved_len;
-      if (hs->unrecved_bytes >= recved_len) {
-        hs->unrecved_bytes -= recved_len;
-      } else {
-        LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_LEVEL_WARNING, ("httpd_post_data_recved: recved_len too big\n"));
-        len = (u16_t)hs->unrecved_bytes;
-        hs->unrecved_bytes = 0;
-      }
-      if (hs->pcb != NULL) {
-        if (len != 0) {
-          tcp_recved(hs->pcb, len);
-        }
-        if ((hs->post_content_len_left == 0) && (hs->unrecved_bytes == 0)) {
-          /* finished handling POST */
-          http_handle_post_finished(hs);
-          http_send_data(hs->pcb, hs);
-        }
-      }
+#if LWIP_HTTPD_SUPPORT_POST
+  if ((hs->req_info.method == HTTP_METHOD_POST) || (hs->req_info.method == HTTP_METHOD_PUT)) {
+    if (ps->is_09) {
+      /* HTTP/0.9 does not support POST */
+      return ERR_ARG;
     }
+    hs->req_info.is_post = (hs->req_info.method == HTTP_METHOD_POST);
+    return http_post_request(pcb, hs, data, uri);
   }
-}
-#endif /* LWIP_HTTPD_POST_MANUAL_WND */
-
+#else /* LWIP_HTTPD_SUPPORT_POST */
+  LWIP_UNUSED_ARG(pcb); /* only used for post */
 #endif /* LWIP_HTTPD_SUPPORT_POST */
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+  if ((hs->req_info.content_len != 0) || (ps->te != HTTP_TE_NONE)) {
+    /* a body nobody reads: where the next request starts is unknown */
+    hs->keepalive = 0;
+  }
+  err = http_find_file(hs, uri, ps->is_09);
+  if (hs->keepalive) {
+    /* the head is not needed any more, what follows it is the next
+       (pipelined) request */
+    hs->req = http_pbuf_skip(hs->req, ps->len);
+  }
+  return err;
+#else /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+  return http_find_file(hs, uri, ps->is_09);
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+}
 
 /**
  * When data has been received in the correct state, try to parse it
  * as a HTTP request.
  *
- * @param p the received pbuf
+ * @param inp the received pbuf, set to NULL when it has been queued
  * @param hs the connection state
  * @param pcb the tcp_pcb which received this packet
  * @return ERR_OK if request was OK and hs has been initialized correctly
@@ -1125,19 +2531,9 @@ httpd_post_data_recved(void *connection, u16_t recved_len)
 static err_t ICACHE_FLASH_ATTR
 http_parse_request(struct pbuf **inp, struct http_state *hs, struct tcp_pcb *pcb)
 {
-  printf("[*] http_parse_request invoked\n");
-  char *data;
-  char *crlf;
-  u16_t data_len;
   struct pbuf *p = *inp;
-#if LWIP_HTTPD_SUPPORT_REQUESTLIST
-  u16_t clen;
-#endif /* LWIP_HTTPD_SUPPORT_REQUESTLIST */
-#if LWIP_HTTPD_SUPPORT_POST
   err_t err;
-#endif /* LWIP_HTTPD_SUPPORT_POST */
 
-  LWIP_UNUSED_ARG(pcb); /* only used for post */
   LWIP_ASSERT("p != NULL", p != NULL);
   LWIP_ASSERT("hs != NULL", hs != NULL);
   /* first we set hs->if_post = 0 */
@@ -1149,138 +2545,56 @@ http_parse_request(struct pbuf **inp, struct http_state *hs, struct tcp_pcb *pcb
     return ERR_USE;
   }
 
-#if LWIP_HTTPD_SUPPORT_REQUESTLIST
-
   LWIP_DEBUGF(HTTPD_DEBUG, ("Received %"U16_F" bytes\n", p->tot_len));
 
-  /* first check allowed characters in this pbuf? */
-
-  /* enqueue the pbuf */
+  /* enqueue the pbuf, the parser only looks at the new data */
   if (hs->req == NULL) {
-    LWIP_DEBUGF(HTTPD_DEBUG, ("First pbuf\n"));
+    /* ignore empty lines before the request line: some clients end a POST
+       body with CRLF, which then precedes the next request */
+    u16_t skip = 0;
+    u8_t c;
+    while ((skip < p->tot_len) &&
+           (((c = pbuf_get_at(p, skip)) == '\r') || (c == '\n'))) {
+      skip++;
+    }
+    if (skip != 0) {
+      *inp = NULL;
+      p = http_pbuf_skip(p, skip);
+      if (p == NULL) {
+        return ERR_INPROGRESS;
+      }
+    }
     hs->req = p;
   } else {
-    LWIP_DEBUGF(HTTPD_DEBUG, ("pbuf enqueued\n"));
     pbuf_cat(hs->req, p);
   }
+  *inp = NULL;
 
-  if (hs->req->next != NULL) {
-    data_len = LWIP_MIN(hs->req->tot_len, LWIP_HTTPD_MAX_REQ_LENGTH);
-    pbuf_copy_partial(hs->req, httpd_req_buf, data_len, 0);
-    data = httpd_req_buf;
-  } else
-#endif /* LWIP_HTTPD_SUPPORT_REQUESTLIST */
-  {
-    data = (char *)p->payload;
-    data_len = p->len;
-    if (p->len != p->tot_len) {
-      LWIP_DEBUGF(HTTPD_DEBUG, ("Warning: incomplete header due to chained pbufs\n"));
+  err = http_parse_head(hs, p);
+  if (err == ERR_INPROGRESS) {
+    if (pbuf_clen(hs->req) <= LWIP_HTTPD_REQ_QUEUELEN) {
+      /* request not fully received */
+      return ERR_INPROGRESS;
     }
+    LWIP_DEBUGF(HTTPD_DEBUG, ("Request head in too many pbufs\n"));
+    err = ERR_ARG;
+  } else if (err == ERR_OK) {
+    err = http_process_request(hs, pcb);
   }
-
-  /* received enough data for minimal request? */
-  if (data_len >= MIN_REQ_LEN) {
-    /* wait for CRLF before parsing anything */
-    crlf = strnstr(data, CRLF, data_len);
-    if (crlf != NULL) {
-#if LWIP_HTTPD_SUPPORT_POST
-      int is_post = 0;
-#endif /* LWIP_HTTPD_SUPPORT_POST */
-      int is_09 = 0;
-      char *sp1, *sp2;
-      u16_t left_len, uri_len;
-      LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("CRLF received, parsing request\n"));
-      /* parse method */
-      if (!strncmp(data, "GET ", 4)) {
-        sp1 = data + 3;
-        /* received GET request */
-        LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("Received GET request\"\n"));
-#if LWIP_HTTPD_SUPPORT_POST
-      } else if (!strncmp(data, "POST ", 5)) {
-        /* store request type */
-        is_post = 1;
-        sp1 = data + 4;
-        /* received GET request */
-        LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("Received POST request\n"));
-#endif /* LWIP_HTTPD_SUPPORT_POST */
-      } else {
-        /* null-terminate the METHOD (pbuf is freed anyway wen returning) */
-        data[4] = 0;
-        /* unsupported method! */
-        LWIP_DEBUGF(HTTPD_DEBUG, ("Unsupported request method (not implemented): \"%s\"\n",
-          data));
-        return http_find_error_file(hs, 501);
-      }
-      /* if we come here, method is OK, parse URI */
-      left_len = data_len - ((sp1 +1) - data);
-      sp2 = strnstr(sp1 + 1, " ", left_len);
-#if LWIP_HTTPD_SUPPORT_V09
-      if (sp2 == NULL) {
-        /* HTTP 0.9: respond with correct protocol version */
-        sp2 = strnstr(sp1 + 1, CRLF, left_len);
-        is_09 = 1;
-#if LWIP_HTTPD_SUPPORT_POST
-        if (is_post) {
-          /* HTTP/0.9 does not support POST */
-          goto badrequest;
-        }
-#endif /* LWIP_HTTPD_SUPPORT_POST */
-      }
-#endif /* LWIP_HTTPD_SUPPORT_V09 */
-      uri_len = sp2 - (sp1 + 1);
-      if ((sp2 != 0) && (sp2 > sp1)) {
-        char *uri = sp1 + 1;
-        /* null-terminate the METHOD (pbuf is freed anyway wen returning) */
-        *sp1 = 0;
-        uri[uri_len] = 0;
-        LWIP_DEBUGF(HTTPD_DEBUG, ("Received \"%s\" request for URI: \"%s\"\n",
-                    data, uri));
-#if LWIP_HTTPD_SUPPORT_POST
-        if (is_post) {
-#if LWIP_HTTPD_SUPPORT_REQUESTLIST
-          struct pbuf **q = &hs->req;
-#else /* LWIP_HTTPD_SUPPORT_REQUESTLIST */
-          struct pbuf **q = inp;
-#endif /* LWIP_HTTPD_SUPPORT_REQUESTLIST */
-          hs->req_info.is_post = 1;
-          err = http_post_request(pcb, q, hs, data, data_len, uri, sp2);
-          if (err != ERR_OK) {
-            /* restore header for next try */
-            *sp1 = ' ';
-            *sp2 = ' ';
-            uri[uri_len] = ' ';
-          }
-          if (err == ERR_ARG) {
-            goto badrequest;
-          }
-          return err;
-        } else
-#endif /* LWIP_HTTPD_SUPPORT_POST */
-        {
-          return http_find_file(hs, uri, is_09);
-        }
-      } else {
-        LWIP_DEBUGF(HTTPD_DEBUG, ("invalid URI\n"));
-      }
-    }
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+  if ((err == ERR_VAL) || (err == ERR_ARG)) {
+    /* the rest of what the client sent cannot be trusted */
+    hs->keepalive = 0;
   }
-
-#if LWIP_HTTPD_SUPPORT_REQUESTLIST
-  clen = pbuf_clen(hs->req);
-  if ((hs->req->tot_len <= LWIP_HTTPD_REQ_BUFSIZE) &&
-    (clen <= LWIP_HTTPD_REQ_QUEUELEN)) {
-    /* request not fully received (too short or CRLF is missing) */
-    return ERR_INPROGRESS;
-  } else
-#endif /* LWIP_HTTPD_SUPPORT_REQUESTLIST */
-  {
-#if LWIP_HTTPD_SUPPORT_POST
-badrequest:
-#endif /* LWIP_HTTPD_SUPPORT_POST */
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+  if (err == ERR_VAL) {
+    return http_find_error_file(hs, 501);
+  } else if (err == ERR_ARG) {
     LWIP_DEBUGF(HTTPD_DEBUG, ("bad request\n"));
     /* could not parse request */
     return http_find_error_file(hs, 400);
   }
+  return err;
 }
 
 /** Try to find the file specified by uri and, if found, initialize hs
@@ -1299,6 +2613,7 @@ http_find_file(struct http_state *hs, const char *uri, int is_09)
   struct webfs_file *file = NULL;
   char *params;
 
+  hs->req_info.uri = (char *)uri;
   hs->req_info.params = NULL;
   params = (char *)strchr(uri, '?');
   if (params != NULL) {
@@ -1307,17 +2622,41 @@ http_find_file(struct http_state *hs, const char *uri, int is_09)
     params++;
     hs->req_info.params = params;
   }
-
+  /* the parameters (and a form body) are looked up by key from now on */
+  if (http_params_index(&hs->req_info) != 0) {
+    LWIP_DEBUGF(HTTPD_DEBUG, ("http_find_file: no memory to index the parameters\n"));
+  }
 
   LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("Opening %s\n", uri));
   printf("[*] http_find_file: file open %s\n", uri);
   /* we pass http_state into webfs_open */
-  file = webfs_open(uri, (void *)&hs->req_info);
-  if (file == NULL) {
+  if (webfs_open(&hs->webfs, uri, (void *)&hs->req_info)) {
+    file = &hs->webfs;
+  } else {
     printf("[*] http_find_file: %s 404\n", uri);
-    file = http_get_404_file(&uri);
+    file = http_get_404_file(hs, &uri);
   }
   printf("[*] http_find_file: file open %s done\n", uri);
+#if LWIP_HTTPD_MAX_DEFERRED
+  if ((file != NULL) && file->deferred) {
+    if (hs->deferred != 0) {
+      /* parked until httpd_complete(), which only knows the status */
+      hs->handle = file;
+      hs->file = NULL;
+      hs->left = 0;
+#if LWIP_HTTPD_DYNAMIC_HEADERS
+      hs->hdr_type = http_hdr_type(uri);
+#endif /* LWIP_HTTPD_DYNAMIC_HEADERS */
+      return ERR_OK;
+    }
+    LWIP_DEBUGF(HTTPD_DEBUG, ("http_find_file: %s deferred without httpd_defer()\n", uri));
+    file->deferred = 0;
+    file->status = 500;
+  } else if (hs->deferred != 0) {
+    /* the handler got a token but answered right away after all */
+    http_defer_release(hs);
+  }
+#endif /* LWIP_HTTPD_MAX_DEFERRED */
 
   return http_init_file(hs, file, is_09, uri);
 }
@@ -1336,44 +2675,40 @@ static err_t ICACHE_FLASH_ATTR
 http_init_file(struct http_state *hs, struct webfs_file *file, int is_09, const char *uri)
 {
   printf("[*] http_init_file invoked\n");
-  printf("[*] http_init_file file content: %s", file->data);
+  /* the response is ready: give back the room left in the arena's newest
+     chunk, what the request still needs (a send buffer) is bigger */
+  httpd_arena_fit(&hs->req_info.arena);
   if (file != NULL) {
-    /* file opened, initialise struct http_state */
+    /* file opened, initialise struct http_state: the response is in
+       memory and sent from there (without copying, see
+       HTTP_IS_DATA_VOLATILE), so hs->buf is never allocated for it */
     hs->handle = file;
     hs->file = (char*)file->data;
     LWIP_ASSERT("File length must be positive!", (file->len >= 0));
     hs->left = file->len;
+    if (file->stream != NULL) {
+      /* generated: everything, the first window too, is read through
+         webfs_read() into hs->buf and framed there */
+      hs->file = NULL;
+      hs->left = 0;
+    }
     hs->retries = 0;
+    HTTPD_STATS_INC(responses);
 #if LWIP_HTTPD_TIMING
     hs->time_started = sys_now();
 #endif /* LWIP_HTTPD_TIMING */
-#if !LWIP_HTTPD_DYNAMIC_HEADERS
-    LWIP_ASSERT("HTTP headers not included in file system", hs->handle->http_header_included);
-#endif /* !LWIP_HTTPD_DYNAMIC_HEADERS */
-#if LWIP_HTTPD_SUPPORT_V09
-    if (hs->handle->http_header_included && is_09) {
-      /* HTTP/0.9 responses are sent without HTTP header,
-         search for the end of the header. */
-      char *file_start = strnstr(hs->file, CRLF CRLF, hs->left);
-      if (file_start != NULL) {
-        size_t diff = file_start + 4 - hs->file;
-        hs->file += diff;
-        hs->left -= (u32_t)diff;
-      }
-    }
-#endif /* LWIP_HTTPD_SUPPORT_V09*/
   } else {
+    /* no 404 page either: send the built-in one */
     hs->handle = NULL;
-    hs->file = NULL;
-    hs->left = 0;
+    hs->file = (char *)HTTP_DEFAULT_404_HTML;
+    hs->left = sizeof(HTTP_DEFAULT_404_HTML) - 1;
     hs->retries = 0;
   }
 #if LWIP_HTTPD_DYNAMIC_HEADERS
-    /* Determine the HTTP headers to send based on the file extension of
-   * the requested URI. */
-  if ((hs->handle == NULL) || !hs->handle->http_header_included) {
-    printf("[*] HTTP GET HEADER INVOKED");
-    get_http_headers(hs, (char*)uri);
+  /* Choose the HTTP header from the status and the file extension of the
+   * requested URI; HTTP/0.9 responses have none. */
+  if (!is_09) {
+    get_http_headers(hs, uri);
   }
 #else /* LWIP_HTTPD_DYNAMIC_HEADERS */
   LWIP_UNUSED_ARG(uri);
@@ -1418,8 +2753,20 @@ http_sent(void *arg, struct tcp_pcb *pcb, u16_t len)
   }
 
   hs->retries = 0;
+  if (hs->snd_limit != 0) {
+    /* memory was freed: allow larger writes again */
+    hs->snd_limit = (hs->snd_limit >= TCP_SND_BUF / 2) ? 0 : (u16_t)(hs->snd_limit * 2);
+  }
 
-  http_send_data(pcb, hs);
+  if (hs->linger != HTTP_LINGER_NONE) {
+    http_linger_check(pcb, hs);
+    return ERR_OK;
+  }
+
+  if ((hs->handle != NULL) || (hs->left != 0) || hs->hdr_pending) {
+    /* a response is being sent (not waiting for the next request) */
+    http_send_data(pcb, hs);
+  }
 
   return ERR_OK;
 }
@@ -1452,9 +2799,33 @@ http_poll(void *arg, struct tcp_pcb *pcb)
     }
 #endif /* LWIP_HTTPD_ABORT_ON_CLOSE_MEM_ERROR */
     return ERR_OK;
+  } else if (hs->linger != HTTP_LINGER_NONE) {
+    if (!http_linger_check(pcb, hs) && (++hs->retries == HTTPD_MAX_RETRIES)) {
+      LWIP_DEBUGF(HTTPD_DEBUG, ("http_poll: response not ACKed, abort\n"));
+      /* http_err() frees hs */
+      tcp_abort(pcb);
+      return ERR_ABRT;
+    }
   } else {
+    u8_t max_retries = HTTPD_MAX_RETRIES;
+#if LWIP_HTTPD_MAX_DEFERRED
+    if (hs->deferred != 0) {
+      /* the handler is still at work: wait, but not forever */
+      if (++hs->retries >= LWIP_HTTPD_DEFER_TIMEOUT_POLLS) {
+        LWIP_DEBUGF(HTTPD_DEBUG, ("http_poll: deferred response timed out\n"));
+        httpd_complete(hs->deferred, 500, NULL, 0);
+      }
+      return ERR_OK;
+    }
+#endif /* LWIP_HTTPD_MAX_DEFERRED */
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+    if ((hs->requests != 0) && (hs->handle == NULL)) {
+      /* idle between the requests of a persistent connection */
+      max_retries = HTTPD_KEEPALIVE_IDLE_POLLS;
+    }
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
     hs->retries++;
-    if (hs->retries == HTTPD_MAX_RETRIES) {
+    if (hs->retries >= max_retries) {
       LWIP_DEBUGF(HTTPD_DEBUG, ("http_poll: too many retries, close\n"));
       http_close_conn(pcb, hs);
       return ERR_OK;
@@ -1465,17 +2836,77 @@ http_poll(void *arg, struct tcp_pcb *pcb)
      * cause the connection to close immediately. */
     if(hs && (hs->handle)) {
       LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("http_poll: try to send more data\n"));
-      if(http_send_data(pcb, hs)) {
-        /* If we wrote anything to be sent, go ahead and send it now. */
-        LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("tcp_output\n"));
-        tcp_output(pcb);
-      }
+      /* flushes whatever it queues */
+      http_send_data(pcb, hs);
     }
   }
 
   return ERR_OK;
 }
 
+/**
+ * Handle received data that is not POST body data: (part of) the head of
+ * a request.
+ *
+ * @param pcb the tcp_pcb which received the data
+ * @param hs the connection state, may be freed when this returns
+ * @param p the received pbuf, taken over by this function
+ */
+static void ICACHE_FLASH_ATTR
+http_recv_request(struct tcp_pcb *pcb, struct http_state *hs, struct pbuf *p)
+{
+  err_t parsed = ERR_ABRT;
+
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+  if (hs->keepalive && http_response_pending(hs)) {
+    /* the next request(s), sent before this response is out and ACKed:
+       keep them for http_next_request() */
+    http_hold_request(hs, p);
+    return;
+  }
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+
+  if (hs->handle == NULL) {
+    parsed = http_parse_request(&p, hs, pcb);
+    LWIP_ASSERT("http_parse_request: unexpected return value", parsed == ERR_OK
+      || parsed == ERR_INPROGRESS ||parsed == ERR_ARG || parsed == ERR_USE);
+  } else {
+    LWIP_DEBUGF(HTTPD_DEBUG, ("http_recv: already sending data\n"));
+  }
+  if (p != NULL) {
+    /* pbuf not queued for parsing, free it now */
+    pbuf_free(p);
+  }
+  if (parsed != ERR_INPROGRESS) {
+    /* request fully parsed or error: the head is not needed any more
+       (a POST still receiving its body has taken it over) */
+    if ((hs->req != NULL)
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+        /* else hs->req holds pipelined requests now */
+        && !hs->keepalive
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+       ) {
+      pbuf_free(hs->req);
+      hs->req = NULL;
+    }
+    if ((hs->req_head != NULL) && (HTTP_POST_LEFT(hs) == 0)) {
+      mem_free(hs->req_head);
+      hs->req_head = NULL;
+    }
+  }
+  if (parsed == ERR_OK) {
+    if (HTTP_POST_LEFT(hs) == 0)
+    {
+      LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("http_recv: data %p len %"S32_F"\n", hs->file, hs->left));
+      printf("[*] http_recv invoked\n");
+      http_send_data(pcb, hs);
+    }
+  } else if (parsed == ERR_ARG) {
+    /* @todo: close on ERR_USE? */
+    http_close_conn(pcb, hs);
+  }
+}
+
 /**
  * Data has been received on this pcb.
  * For HTTP 1.0, this should normally only happen once (if the request fits in one packet).
@@ -1504,8 +2935,8 @@ http_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
   }
 
 #if LWIP_HTTPD_SUPPORT_POST && LWIP_HTTPD_POST_MANUAL_WND
-  if (hs->no_auto_wnd) {
-     hs->unrecved_bytes += p->tot_len;
+  if ((HTTP_POST_LEFT(hs) > 0) && hs->post->no_auto_wnd) {
+     hs->post->unrecved_bytes += p->tot_len;
   } else
 #endif /* LWIP_HTTPD_SUPPORT_POST && LWIP_HTTPD_POST_MANUAL_WND */
   {
@@ -1513,52 +2944,21 @@ http_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
     tcp_recved(pcb, p->tot_len);
   }
 
-  if (hs->post_content_len_left > 0) {
+  if (HTTP_POST_LEFT(hs) > 0) {
     /* reset idle counter when POST data is received */
     hs->retries = 0;
     /* this is data for a POST, pass the complete pbuf to the application */
-    http_post_rxpbuf(hs, p);
+    parsed = http_post_rxpbuf(hs, p);
     /* pbuf is passed to the application, don't free it! */
-    if (hs->post_content_len_left == 0) {
-      /* all data received, send response or close connection */
+    if (parsed == ERR_ARG) {
+      http_close_conn(pcb, hs);
+    } else if (hs->handle != NULL) {
+      /* all data received (and taken, with a manual window), respond */
       http_send_data(pcb, hs);
     }
     return ERR_OK;
-  } else
-  {
-    if (hs->handle == NULL) {
-      parsed = http_parse_request(&p, hs, pcb);
-      LWIP_ASSERT("http_parse_request: unexpected return value", parsed == ERR_OK
-        || parsed == ERR_INPROGRESS ||parsed == ERR_ARG || parsed == ERR_USE);
-    } else {
-      LWIP_DEBUGF(HTTPD_DEBUG, ("http_recv: already sending data\n"));
-    }
-#if LWIP_HTTPD_SUPPORT_REQUESTLIST
-    if (parsed != ERR_INPROGRESS) {
-      /* request fully parsed or error */
-      if (hs->req != NULL) {
-        pbuf_free(hs->req);
-        hs->req = NULL;
-      }
-    }
-#else /* LWIP_HTTPD_SUPPORT_REQUESTLIST */
-    if (p != NULL) {
-      /* pbuf not passed to application, free it now */
-      pbuf_free(p);
-    }
-#endif /* LWIP_HTTPD_SUPPORT_REQUESTLIST */
-    if (parsed == ERR_OK) {
-      if (hs->post_content_len_left == 0)
-      {
-        LWIP_DEBUGF(HTTPD_DEBUG | LWIP_DBG_TRACE, ("http_recv: data %p len %"S32_F"\n", hs->file, hs->left));
-        printf("[*] http_recv invoked\n");
-        http_send_data(pcb, hs);
-      }
-    } else if (parsed == ERR_ARG) {
-      /* @todo: close on ERR_USE? */
-      http_close_conn(pcb, hs);
-    }
   }
+  http_recv_request(pcb, hs, p);
   return ERR_OK;
 }
 
@@ -1577,14 +2977,21 @@ http_accept(void *arg, struct tcp_pcb *pcb, err_t err)
   tcp_accepted(lpcb);
   /* Set priority */
   tcp_setprio(pcb, HTTPD_TCP_PRIO);
+  /* Responses are corked and flushed by http_flush(): Nagle would only
+     hold back the last segment of a response until the previous one is
+     ACKed. */
+  tcp_nagle_disable(pcb);
 
   /* Allocate memory for the structure that holds the state of the
      connection - initialized by that function. */
   hs = http_state_alloc();
   if (hs == NULL) {
-    LWIP_DEBUGF(HTTPD_DEBUG, ("http_accept: Out of memory, RST\n"));
+    LWIP_DEBUGF(HTTPD_DEBUG, ("http_accept: all %d connections in use, RST\n",
+      LWIP_HTTPD_MAX_CONNS));
+    HTTPD_STATS_INC(conns_refused);
     return ERR_MEM;
   }
+  HTTPD_STATS_INC(conns);
 
   /* Tell TCP that this is the structure we wish to be passed for our
      callbacks. */
@@ -1599,6 +3006,133 @@ http_accept(void *arg, struct tcp_pcb *pcb, err_t err)
   return ERR_OK;
 }
 
+#if LWIP_HTTPD_MAX_DEFERRED
+/** Called by an http_handler that cannot answer right away: the handler
+ * returns HTTP_DEFERRED and the connection waits, without blocking the
+ * server, until httpd_complete() is called with the token.
+ *
+ * @param req the request passed to the handler
+ * @return the token for httpd_complete(), 0 if LWIP_HTTPD_MAX_DEFERRED
+ *         responses are deferred already (the handler must answer now)
+ */
+httpd_defer_t ICACHE_FLASH_ATTR
+httpd_defer(HTTPRequest *req)
+{
+  struct http_state *hs = (struct http_state *)req->connection;
+  int i;
+
+  if (hs->deferred != 0) {
+    return hs->deferred;
+  }
+  for (i = 0; i < LWIP_HTTPD_MAX_DEFERRED; i++) {
+    if (http_deferred_tab[i].hs == NULL) {
+      if (++http_deferred_last == 0) {
+        http_deferred_last = 1;
+      }
+      http_deferred_tab[i].hs = hs;
+      http_deferred_tab[i].pcb = NULL;
+      http_deferred_tab[i].token = http_deferred_last;
+      hs->deferred = http_deferred_last;
+      return hs->deferred;
+    }
+  }
+  return 0;
+}
+
+/** Send the response of a deferred handler. Must be called from the thread
+ * the server runs in (use tcpip_callback() from other tasks), and not from
+ * the handler itself.
+ *
+ * @param token returned by httpd_defer()
+ * @param status HTTP status of the response (one listed in headers.def)
+ * @param data the response, copied; may be NULL if len is 0
+ * @param len length of data
+ * @return ERR_OK if the response is being sent,
+ *         ERR_ARG if the connection is gone (or timed out) or the handler
+ *         has not returned yet
+ */
+err_t ICACHE_FLASH_ATTR
+httpd_complete(httpd_defer_t token, u16_t status, const char *data, int len)
+{
+  struct http_deferred *d = http_defer_find(token);
+  struct webfs_file result;
+
+  if ((d == NULL) || (d->pcb == NULL)) {
+    return ERR_ARG;
+  }
+  memset(&result, 0, sizeof(result));
+  result.status = status;
+  if (len > 0) {
+    char *buf = (char *)httpd_arena_alloc(&d->hs->req_info.arena, (u32_t)len);
+    if (buf == NULL) {
+      result.status = 500;
+    } else {
+      MEMCPY(buf, data, len);
+      HTTPD_STATS_ADD(bytes_copied, len);
+      result.data = buf;
+      result.data_owner = WEBFS_DATA_ARENA;
+      result.len = len;
+    }
+  }
+  return httpd_complete_file(token, &result, NULL);
+}
+
+/** Like httpd_complete(), but takes over the response in result (its data,
+ * len, data_owner and status) instead of copying it; result no longer owns
+ * it on ERR_OK. A response in an arena of its own (WEBFS_DATA_ARENA, from
+ * a worker's copy of the request) is taken over with that arena.
+ */
+err_t ICACHE_FLASH_ATTR
+httpd_complete_file(httpd_defer_t token, struct webfs_file *result,
+                    struct httpd_arena_chunk **arena)
+{
+  struct http_deferred *d = http_defer_find(token);
+  struct http_state *hs;
+  struct tcp_pcb *pcb;
+  struct webfs_file *file;
+
+  if ((d == NULL) || (d->pcb == NULL)) {
+    return ERR_ARG;
+  }
+  hs = d->hs;
+  pcb = d->pcb;
+  file = hs->handle;
+  /* webfs_close() frees it like any handler's response */
+  file->data = result->data;
+  file->data_owner = result->data_owner;
+  file->len = result->len;
+  file->index = result->len;
+  file->status = result->status;
+  file->deferred = 0;
+  result->data = NULL;
+  result->data_owner = WEBFS_DATA_STATIC;
+  if (arena != NULL) {
+    httpd_arena_splice(&hs->req_info.arena, arena);
+  }
+  http_defer_release(hs);
+
+  http_init_file(hs, file, hs->parser.is_09, NULL);
+  http_send_data(pcb, hs);
+  return ERR_OK;
+}
+#endif /* LWIP_HTTPD_MAX_DEFERRED */
+
+#if LWIP_HTTPD_STATS
+/** Copy the server counters to 'stats' */
+void ICACHE_FLASH_ATTR
+httpd_get_stats(struct httpd_stats *stats)
+{
+  MEMCPY(stats, &httpd_stats_data, sizeof(struct httpd_stats));
+}
+
+/** Clear the server counters */
+void ICACHE_FLASH_ATTR
+httpd_reset_stats(void)
+{
+  memset(&httpd_stats_data, 0, sizeof(struct httpd_stats));
+}
+#endif /* LWIP_HTTPD_STATS */
+
 /**
  * Initialize the httpd with the specified local address.
  */
@@ -1627,12 +3161,16 @@ httpd_init_addr(ip_addr_t *local_addr)
 void ICACHE_FLASH_ATTR
 httpd_init(const u8_t * romfs)
 {
-#if HTTPD_USE_MEM_POOL
-  LWIP_ASSERT("memp_sizes[MEMP_HTTPD_STATE] >= sizeof(http_state)",
-     memp_sizes[MEMP_HTTPD_STATE] >= sizeof(http_state));
-#endif
+#if LWIP_HTTPD_DYNAMIC_HEADERS
+  LWIP_ASSERT("LWIP_HTTPD_MAX_HDR_LEN too small for headers.def",
+     http_hdr_table.max_len <= LWIP_HTTPD_MAX_HDR_LEN);
+#endif /* LWIP_HTTPD_DYNAMIC_HEADERS */
   LWIP_DEBUGF(HTTPD_DEBUG, ("httpd_init\n"));
 
+#if LWIP_HTTPD_WORKERS
+  httpd_worker_init();
+#endif /* LWIP_HTTPD_WORKERS */
+  http_state_pool_init();
   httpd_init_addr(IP_ADDR_ANY);
   printf("[*] init webfs\n");
   webfs_init(romfs);
@@ -51,6 +51,12 @@
 #define LWIP_HTTPD_SSI            0
 #endif
 
+/** Set this to 1 to count requests and copied bytes in httpd_stats (used by
+ * the host benchmarks, see host/bench) */
+#ifndef LWIP_HTTPD_STATS
+#define LWIP_HTTPD_STATS          0
+#endif
+
 /** Set this to 1 to support HTTP POST */
 #ifndef LWIP_HTTPD_SUPPORT_POST
 #define LWIP_HTTPD_SUPPORT_POST   1
@@ -231,4 +237,52 @@ void httpd_post_data_recved(void *connection, u16_t recved_len);
 
 void httpd_init(const u8_t * romfs);
 
+/** Number of responses that handlers may defer at the same time (see
+ * HTTP_DEFERRED), 0 to leave deferred handlers out */
+#ifndef LWIP_HTTPD_MAX_DEFERRED
+#define LWIP_HTTPD_MAX_DEFERRED   4
+#endif
+
+#if LWIP_HTTPD_MAX_DEFERRED
+/** Identifies a deferred response, never 0 */
+typedef u32_t httpd_defer_t;
+
+struct http_request;
+
+httpd_defer_t httpd_defer(struct http_request *req);
+err_t httpd_complete(httpd_defer_t token, u16_t status, const char *data, int len);
+#endif /* LWIP_HTTPD_MAX_DEFERRED */
+
+/** Number of worker tasks that run the handlers of routes with the
+ * "worker" option (see routes.def) instead of the tcpip thread, so slow
+ * handlers do not hold up ACKs and other connections. 0 runs every handler
+ * in the tcpip thread. The responses are deferred, so at most
+ * LWIP_HTTPD_MAX_DEFERRED of them are in the workers at a time; the
+ * handlers of further requests run in the tcpip thread. */
+#ifndef LWIP_HTTPD_WORKERS
+#define LWIP_HTTPD_WORKERS        0
+#endif
+
+#if LWIP_HTTPD_WORKERS && !LWIP_HTTPD_MAX_DEFERRED
+#error "LWIP_HTTPD_WORKERS needs LWIP_HTTPD_MAX_DEFERRED"
+#endif
+
+#if LWIP_HTTPD_STATS
+/** Counters maintained by the server, only written from the tcpip thread */
+struct httpd_stats {
+  u32_t conns;          /* connections accepted */
+  u32_t conns_refused;  /* connections reset, all LWIP_HTTPD_MAX_CONNS in use */
+  u32_t responses;      /* responses started */
+  u32_t bytes_sent;     /* bytes passed to tcp_write */
+  u32_t bytes_copied;   /* bytes memcpy'd by the server or copied by tcp_write */
+  u32_t segments;       /* segments sent when flushing responses (see http_flush) */
+  u32_t writes_avoided; /* tcp_write calls cut to the send buffer up front
+                           (each one at least one ERR_MEM retry before) */
+  u32_t write_errs;     /* tcp_write calls that failed with ERR_MEM */
+};
+
+void httpd_get_stats(struct httpd_stats *stats);
+void httpd_reset_stats(void);
+#endif /* LWIP_HTTPD_STATS */
+
 #endif /* __HTTPD_H__ */
@@ -0,0 +1,181 @@
+/**
+ * @file
+ * Per-request bump allocator, see httpd_arena.h.
+ *
+ * Allocations are taken from the newest chunk as long as they fit; a new
+ * chunk of LWIP_HTTPD_ARENA_CHUNK bytes is started when they do not. An
+ * allocation larger than that gets a chunk of exactly its size, linked in
+ * behind the newest chunk so that the room left there is still used.
+ * Nothing is freed on its own, except that the last allocation of a chunk
+ * can be shrunk (or dropped) with httpd_arena_trim(), as the handler
+ * buffers are once the response length is known, and httpd_arena_fit()
+ * hands the unused end of the newest chunk back to the heap.
+ *
+ * An arena belongs to one request and is only used by one thread at a
+ * time: the tcpip thread, or the worker running the request's handler on
+ * an arena of its own (see httpd_worker.c).
+ */
+#include "lwip/opt.h"
+#include "lwip/mem.h"
+#include "httpd_arena.h"
+#include "api.h"
+
+#define HTTPD_ARENA_HDR   LWIP_MEM_ALIGN_SIZE(sizeof(struct httpd_arena_chunk))
+/** Largest allocation: the chunk sizes have to fit u16_t and mem_size_t */
+#define HTTPD_ARENA_MAX   (0xffff - HTTPD_ARENA_HDR - MEM_ALIGNMENT)
+
+#define HTTPD_ARENA_DATA(c) ((u8_t *)(c) + HTTPD_ARENA_HDR)
+
+/** Allocate size bytes, aligned to MEM_ALIGNMENT, for the rest of the
+ * request.
+ *
+ * @return the memory, NULL if the heap is out of it
+ */
+void * ICACHE_FLASH_ATTR
+httpd_arena_alloc(struct httpd_arena_chunk **arena, u32_t size)
+{
+  struct httpd_arena_chunk *c = *arena;
+  u16_t chunk_size;
+
+  if (size > HTTPD_ARENA_MAX) {
+    return NULL;
+  }
+  size = LWIP_MEM_ALIGN_SIZE(size);
+  if ((c != NULL) && ((u32_t)(c->size - c->used) >= size)) {
+    c->last = c->used;
+    c->used = (u16_t)(c->used + size);
+    return HTTPD_ARENA_DATA(c) + c->last;
+  }
+
+  chunk_size = (u16_t)LWIP_MAX(size, LWIP_HTTPD_ARENA_CHUNK);
+  c = (struct httpd_arena_chunk *)mem_malloc((mem_size_t)(HTTPD_ARENA_HDR + chunk_size));
+  if (c == NULL) {
+    return NULL;
+  }
+  c->size = chunk_size;
+  c->used = (u16_t)size;
+  c->last = 0;
+  if ((size > LWIP_HTTPD_ARENA_CHUNK) && (*arena != NULL)) {
+    /* full already: keep allocating from the newest chunk */
+    c->next = (*arena)->next;
+    (*arena)->next = c;
+  } else {
+    c->next = *arena;
+    *arena = c;
+  }
+  return HTTPD_ARENA_DATA(c);
+}
+
+/** Shrink an allocation to size bytes, giving the rest back to its chunk.
+ * Only the last allocation made from a chunk can be shrunk; any other one
+ * is left as it is. A chunk of its own is shrunk in the heap as well, and
+ * freed if nothing is left of it.
+ *
+ * @return p, or NULL if it was dropped with its chunk
+ */
+void * ICACHE_FLASH_ATTR
+httpd_arena_trim(struct httpd_arena_chunk **arena, void *p, u32_t size)
+{
+  struct httpd_arena_chunk **pc;
+  struct httpd_arena_chunk *c;
+  u16_t used;
+
+  for (pc = arena; (c = *pc) != NULL; pc = &c->next) {
+    if (((u8_t *)p >= HTTPD_ARENA_DATA(c)) && ((u8_t *)p < HTTPD_ARENA_DATA(c) + c->size)) {
+      break;
+    }
+  }
+  if ((c == NULL) || ((u8_t *)p != HTTPD_ARENA_DATA(c) + c->last)) {
+    return p;
+  }
+  size = LWIP_MEM_ALIGN_SIZE(size);
+  if (size >= (u32_t)(c->used - c->last)) {
+    return p;
+  }
+  used = (u16_t)(c->last + size);
+  c->used = used;
+  if (c->size > LWIP_HTTPD_ARENA_CHUNK) {
+    if (used == 0) {
+      *pc = c->next;
+      mem_free(c);
+      return NULL;
+    }
+    c = (struct httpd_arena_chunk *)mem_trim(c, (mem_size_t)(HTTPD_ARENA_HDR + used));
+    c->size = used;
+  }
+  return p;
+}
+
+/** Give the room left in the newest chunk back to the heap, once the
+ * request is not expected to allocate much more */
+void ICACHE_FLASH_ATTR
+httpd_arena_fit(struct httpd_arena_chunk **arena)
+{
+  struct httpd_arena_chunk *c = *arena;
+
+  if ((c != NULL) && (c->used < c->size)) {
+    c = (struct httpd_arena_chunk *)mem_trim(c, (mem_size_t)(HTTPD_ARENA_HDR + c->used));
+    c->size = c->used;
+  }
+}
+
+/** @return 1 if p points into memory of this arena */
+int ICACHE_FLASH_ATTR
+httpd_arena_owns(struct httpd_arena_chunk *arena, const void *p)
+{
+  for (; arena != NULL; arena = arena->next) {
+    if (((const u8_t *)p >= HTTPD_ARENA_DATA(arena)) &&
+        ((const u8_t *)p < HTTPD_ARENA_DATA(arena) + arena->size)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** Move the chunks of 'from' into arena (behind its newest chunk), for
+ * memory that outlives the request it was allocated for */
+void ICACHE_FLASH_ATTR
+httpd_arena_splice(struct httpd_arena_chunk **arena, struct httpd_arena_chunk **from)
+{
+  struct httpd_arena_chunk *last = *from;
+
+  if (last == NULL) {
+    return;
+  }
+  while (last->next != NULL) {
+    last = last->next;
+  }
+  if (*arena != NULL) {
+    last->next = (*arena)->next;
+    (*arena)->next = *from;
+  } else {
+    *arena = *from;
+  }
+  *from = NULL;
+}
+
+/** Free every chunk of the arena at once */
+void ICACHE_FLASH_ATTR
+httpd_arena_free(struct httpd_arena_chunk **arena)
+{
+  struct httpd_arena_chunk *c = *arena;
+
+  while (c != NULL) {
+    struct httpd_arena_chunk *next = c->next;
+    mem_free(c);
+    c = next;
+  }
+  *arena = NULL;
+}
+
+/** Memory for a handler that lasts until the response is sent; it must
+ * not be freed. Handlers running in a worker get it from the worker's
+ * copy of the request, which is handed over with the response.
+ *
+ * @return size bytes, NULL if the heap is out of memory
+ */
+void * ICACHE_FLASH_ATTR
+http_alloc(HTTPRequest *req, uint32_t size)
+{
+  return httpd_arena_alloc(&req->arena, size);
+}
@@ -0,0 +1,40 @@
+/**
+ * @file
+ * Per-request bump allocator.
+ *
+ * What a request needs beyond its struct http_state (the POST state and
+ * body, the handler's response, the send buffer, handler temporaries from
+ * http_alloc()) is carved out of a few chunks of the lwIP heap instead of
+ * being allocated and freed one by one. The chunks are
+ * freed together when the request ends, so a request leaves no holes of
+ * odd sizes behind in the heap however its allocations interleave with
+ * those of other connections.
+ */
+#ifndef __HTTPD_ARENA_H__
+#define __HTTPD_ARENA_H__
+
+#include "lwip/opt.h"
+#include "lwip/mem.h"
+
+/** Size of an arena chunk. Allocations up to this share chunks, larger
+ * ones (send buffers, big responses) get a chunk of their own. */
+#ifndef LWIP_HTTPD_ARENA_CHUNK
+#define LWIP_HTTPD_ARENA_CHUNK    256
+#endif
+
+struct httpd_arena_chunk {
+  struct httpd_arena_chunk *next;
+  u16_t size;   /* bytes of memory after the header */
+  u16_t used;   /* bytes handed out */
+  u16_t last;   /* offset of the last allocation, for httpd_arena_trim() */
+};
+
+/* The arena is the list of its chunks, newest first; NULL when empty */
+void *httpd_arena_alloc(struct httpd_arena_chunk **arena, u32_t size);
+void *httpd_arena_trim(struct httpd_arena_chunk **arena, void *p, u32_t size);
+void httpd_arena_fit(struct httpd_arena_chunk **arena);
+int httpd_arena_owns(struct httpd_arena_chunk *arena, const void *p);
+void httpd_arena_splice(struct httpd_arena_chunk **arena, struct httpd_arena_chunk **from);
+void httpd_arena_free(struct httpd_arena_chunk **arena);
+
+#endif /* __HTTPD_ARENA_H__ */
@@ -0,0 +1,452 @@
+/**
+ * @file
+ * Streaming parser of multipart/form-data request bodies, see
+ * httpd_multipart.h.
+ *
+ * Each byte of the body is taken once, in pieces of any size: the
+ * delimiter ("\r\n--" and the boundary) is searched with
+ * Boyer-Moore-Horspool, which mostly moves the window by the length of
+ * the delimiter and so does not look at most bytes of a part at all. The
+ * end of a piece may be the start of a delimiter; those few bytes are
+ * held back (keep) and searched again with the next piece, so a
+ * delimiter split across pbufs is found like any other. Part data is
+ * passed to the handler in place, from keep or from the piece.
+ *
+ * The body is taken to start with "\r\n" so that the first delimiter,
+ * which has none before it, is found the same way.
+ */
+#include "lwip/opt.h"
+#include "lwip/mem.h"
+#include "httpd_multipart.h"
+#include "httpd_arena.h"
+
+/** "\r\n--" and the boundary */
+#define HTTPD_MP_DELIM_MAX  (4 + HTTPD_MULTIPART_BOUNDARY_MAX)
+
+/* States of the parser */
+#define HTTPD_MP_PREAMBLE   0 /* before the first delimiter, skipped */
+#define HTTPD_MP_DELIM      1 /* just after a delimiter */
+#define HTTPD_MP_DELIM_DASH 2 /* the second '-' of a closing delimiter */
+#define HTTPD_MP_DELIM_PAD  3 /* whitespace up to the end of its line */
+#define HTTPD_MP_DELIM_LF   4
+#define HTTPD_MP_HEADERS    5 /* headers of a part, into hdr */
+#define HTTPD_MP_DATA       6
+#define HTTPD_MP_DONE       7 /* after the closing delimiter: the epilogue is
+                                 skipped */
+
+struct httpd_multipart {
+  http_part_handler handler;
+  HTTPPart part;
+  u16_t hdr_len;      /* bytes of the part's headers in hdr */
+  u8_t state;         /* HTTPD_MP_* */
+  u8_t delim_len;
+  u8_t keep_len;      /* bytes held back, less than delim_len */
+  u8_t skip[256];     /* shift of the window by its last byte */
+  char delim[HTTPD_MP_DELIM_MAX];
+  char keep[HTTPD_MP_DELIM_MAX];
+  char hdr[LWIP_HTTPD_MULTIPART_HDR_LEN];
+};
+
+/** Compare len bytes of s with a lower-case word, ignoring case */
+static int ICACHE_FLASH_ATTR
+httpd_mp_eq(const char *s, const char *word, size_t len)
+{
+  while (len-- > 0) {
+    char c = *s++;
+    if ((c >= 'A') && (c <= 'Z')) {
+      c = (char)(c + ('a' - 'A'));
+    }
+    if (c != *word++) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/** Skip the whitespace at both ends of s[0..*len) */
+static const char * ICACHE_FLASH_ATTR
+httpd_mp_trim(const char *s, u16_t *len)
+{
+  while ((*len > 0) && ((*s == ' ') || (*s == '\t'))) {
+    s++;
+    (*len)--;
+  }
+  while ((*len > 0) && ((s[*len - 1] == ' ') || (s[*len - 1] == '\t'))) {
+    (*len)--;
+  }
+  return s;
+}
+
+/**
+ * Find a parameter of a header value ("type; name=value; name="value"").
+ *
+ * @param v the value, its first ';'-separated element is skipped
+ * @param len length of v
+ * @param name lower-case name of the parameter
+ * @param value_len receives the length of the value
+ * @return the value without its quotes (not NUL-terminated), NULL if the
+ *         parameter is not there
+ */
+static const char * ICACHE_FLASH_ATTR
+httpd_mp_param(const char *v, u16_t len, const char *name, u16_t *value_len)
+{
+  size_t name_len = strlen(name);
+  u16_t i = 0;
+
+  while (i < len) {
+    const char *p;
+    u16_t p_len, start;
+    u8_t quoted = 0;
+    /* to the start of the next parameter; a quoted ';' is no separator */
+    for (; (i < len) && ((v[i] != ';') || quoted); i++) {
+      if (v[i] == '"') {
+        quoted = !quoted;
+      }
+    }
+    if (i == len) {
+      break;
+    }
+    start = ++i;
+    for (quoted = 0; (i < len) && ((v[i] != ';') || quoted); i++) {
+      if (v[i] == '"') {
+        quoted = !quoted;
+      }
+    }
+    p_len = (u16_t)(i - start);
+    p = httpd_mp_trim(v + start, &p_len);
+    if ((p_len > name_len) && (p[name_len] == '=') && httpd_mp_eq(p, name, name_len)) {
+      p += name_len + 1;
+      p_len = (u16_t)(p_len - name_len - 1);
+      if ((p_len >= 2) && (p[0] == '"') && (p[p_len - 1] == '"')) {
+        p++;
+        p_len = (u16_t)(p_len - 2);
+      }
+      *value_len = p_len;
+      return p;
+    }
+    /* i is at the ';' that ends it: go on from there */
+  }
+  return NULL;
+}
+
+/**
+ * The boundary of a request whose Content-Type is multipart/form-data.
+ *
+ * @param req the request, its head still received
+ * @param len receives the length of the boundary
+ * @return the boundary (not NUL-terminated), NULL if the request has
+ *         another type or no valid boundary
+ */
+const char * ICACHE_FLASH_ATTR
+httpd_multipart_boundary(const HTTPRequest *req, u8_t *len)
+{
+  static const char type[] = "multipart/form-data";
+  u16_t v_len, b_len;
+  const char *v = http_header(req, HTTP_HDR_CONTENT_TYPE, &v_len);
+  const char *b;
+
+  if ((v == NULL) || (v_len < sizeof(type) - 1) || !httpd_mp_eq(v, type, sizeof(type) - 1) ||
+      ((v_len > sizeof(type) - 1) && (v[sizeof(type) - 1] != ';') &&
+       (v[sizeof(type) - 1] != ' ') && (v[sizeof(type) - 1] != '\t'))) {
+    return NULL;
+  }
+  b = httpd_mp_param(v, v_len, "boundary", &b_len);
+  if ((b == NULL) || (b_len == 0) || (b_len > HTTPD_MULTIPART_BOUNDARY_MAX)) {
+    return NULL;
+  }
+  *len = (u8_t)b_len;
+  return b;
+}
+
+/**
+ * Start parsing the body of a request: the parser is allocated from the
+ * request's arena.
+ *
+ * @param req the request, its head still received
+ * @param handler receives the parts
+ * @return the parser, NULL if the request is not multipart/form-data or
+ *         there is no memory
+ */
+struct httpd_multipart * ICACHE_FLASH_ATTR
+httpd_multipart_new(HTTPRequest *req, http_part_handler handler)
+{
+  struct httpd_multipart *mp;
+  const char *boundary;
+  u8_t len;
+  int i;
+
+  boundary = httpd_multipart_boundary(req, &len);
+  if (boundary == NULL) {
+    return NULL;
+  }
+  mp = (struct httpd_multipart *)httpd_arena_alloc(&req->arena, sizeof(struct httpd_multipart));
+  if (mp == NULL) {
+    return NULL;
+  }
+  memset(mp, 0, sizeof(struct httpd_multipart));
+  mp->handler = handler;
+  MEMCPY(mp->delim, "\r\n--", 4);
+  MEMCPY(mp->delim + 4, boundary, len);
+  mp->delim_len = (u8_t)(4 + len);
+  /* a byte not in the delimiter (but for its last) moves the window by
+     all of it, one that is by as much as lines it up with the last one */
+  for (i = 0; i < 256; i++) {
+    mp->skip[i] = mp->delim_len;
+  }
+  for (i = 0; i < mp->delim_len - 1; i++) {
+    mp->skip[(u8_t)mp->delim[i]] = (u8_t)(mp->delim_len - 1 - i);
+  }
+  MEMCPY(mp->keep, "\r\n", 2);
+  mp->keep_len = 2;
+  mp->state = HTTPD_MP_PREAMBLE;
+  return mp;
+}
+
+/** Byte i of keep followed by data */
+#define HTTPD_MP_AT(mp, data, i) \
+  ((u8_t)(((i) < (mp)->keep_len) ? (mp)->keep[i] : (data)[(i) - (mp)->keep_len]))
+
+/**
+ * Search the delimiter in keep followed by data[0..len).
+ *
+ * @param found set to 1 if it is there
+ * @return where the delimiter starts, or (not found) where one could
+ *         still start: nothing before that is part of one
+ */
+static u32_t ICACHE_FLASH_ATTR
+httpd_mp_search(const struct httpd_multipart *mp, const char *data, u32_t len, u8_t *found)
+{
+  u32_t total = mp->keep_len + len;
+  u32_t n = mp->delim_len;
+  u32_t pos = 0;
+
+  while (pos + n <= total) {
+    u8_t last = HTTPD_MP_AT(mp, data, pos + n - 1);
+    if (last == (u8_t)mp->delim[n - 1]) {
+      u32_t i = n - 1;
+      while ((i > 0) && (HTTPD_MP_AT(mp, data, pos + i - 1) == (u8_t)mp->delim[i - 1])) {
+        i--;
+      }
+      if (i == 0) {
+        *found = 1;
+        return pos;
+      }
+    }
+    pos += mp->skip[last];
+  }
+  /* only a '\r' can start the delimiter that is cut off */
+  while ((pos < total) && (HTTPD_MP_AT(mp, data, pos) != '\r')) {
+    pos++;
+  }
+  *found = 0;
+  return pos;
+}
+
+/** Pass data of the current part to the handler
+ *
+ * @return ERR_OK, ERR_ABRT if it refused the request
+ */
+static err_t ICACHE_FLASH_ATTR
+httpd_mp_data(struct httpd_multipart *mp, HTTPRequest *req, const char *data, u32_t len)
+{
+  if ((len == 0) || (mp->state != HTTPD_MP_DATA)) {
+    return ERR_OK;
+  }
+  if (mp->handler(req, HTTP_PART_DATA, &mp->part, data, (int)len, NULL) < 0) {
+    return ERR_ABRT;
+  }
+  mp->part.len += len;
+  return ERR_OK;
+}
+
+/**
+ * Take data up to and including the next delimiter, or all of it if there
+ * is none: what comes before it is data of the current part (or the
+ * preamble), what could be the start of a delimiter is kept.
+ *
+ * @param used receives the bytes of data taken
+ * @return ERR_OK, ERR_ABRT if the handler refused the request
+ */
+static err_t ICACHE_FLASH_ATTR
+httpd_mp_scan(struct httpd_multipart *mp, HTTPRequest *req, const char *data, u32_t len,
+              u32_t *used)
+{
+  u32_t keep_len = mp->keep_len;
+  u32_t total = keep_len + len;
+  u8_t found;
+  u32_t pos = httpd_mp_search(mp, data, len, &found);
+  err_t err;
+
+  /* what comes before pos is part data: first the bytes held back */
+  err = httpd_mp_data(mp, req, mp->keep, LWIP_MIN(pos, keep_len));
+  if ((err == ERR_OK) && (pos > keep_len)) {
+    err = httpd_mp_data(mp, req, data, pos - keep_len);
+  }
+  if (err != ERR_OK) {
+    return err;
+  }
+  if (found) {
+    /* keep is shorter than the delimiter: it ends in data */
+    *used = pos + mp->delim_len - keep_len;
+    mp->keep_len = 0;
+    if (mp->state == HTTPD_MP_DATA) {
+      if (mp->handler(req, HTTP_PART_END, &mp->part, NULL, 0, NULL) < 0) {
+        return ERR_ABRT;
+      }
+      mp->part.index++;
+    }
+    mp->state = HTTPD_MP_DELIM;
+    return ERR_OK;
+  }
+  /* hold back [pos, total), less than a delimiter */
+  if (pos < keep_len) {
+    memmove(mp->keep, mp->keep + pos, keep_len - pos);
+    MEMCPY(mp->keep + keep_len - pos, data, len);
+  } else {
+    MEMCPY(mp->keep, data + (pos - keep_len), total - pos);
+  }
+  mp->keep_len = (u8_t)(total - pos);
+  *used = len;
+  return ERR_OK;
+}
+
+/** The headers of a part are complete: find its name, file name and type
+ * and tell the handler */
+static err_t ICACHE_FLASH_ATTR
+httpd_mp_begin(struct httpd_multipart *mp, HTTPRequest *req)
+{
+  HTTPPart *part = &mp->part;
+  u16_t i = 0;
+
+  part->name = part->filename = part->type = NULL;
+  part->name_len = part->filename_len = part->type_len = 0;
+  part->len = 0;
+  while (i < mp->hdr_len) {
+    const char *line = mp->hdr + i;
+    u16_t line_len = 0, colon, v_len;
+    const char *v;
+
+    while ((i + line_len < mp->hdr_len) && (line[line_len] != '\n')) {
+      line_len++;
+    }
+    i = (u16_t)(i + line_len + 1);
+    if ((line_len > 0) && (line[line_len - 1] == '\r')) {
+      line_len--;
+    }
+    for (colon = 0; (colon < line_len) && (line[colon] != ':'); colon++) {
+    }
+    if (colon == line_len) {
+      continue;
+    }
+    v_len = (u16_t)(line_len - colon - 1);
+    v = httpd_mp_trim(line + colon + 1, &v_len);
+    if ((colon == 19) && httpd_mp_eq(line, "content-disposition", 19)) {
+      part->name = httpd_mp_param(v, v_len, "name", &part->name_len);
+      part->filename = httpd_mp_param(v, v_len, "filename", &part->filename_len);
+    } else if ((colon == 12) && httpd_mp_eq(line, "content-type", 12)) {
+      part->type = v;
+      part->type_len = v_len;
+    }
+  }
+  mp->state = HTTPD_MP_DATA;
+  if (mp->handler(req, HTTP_PART_BEGIN, part, NULL, 0, NULL) < 0) {
+    return ERR_ABRT;
+  }
+  return ERR_OK;
+}
+
+/** Take one byte of what follows a delimiter: the rest of its line, then
+ * the headers of a part
+ *
+ * @return ERR_OK, ERR_VAL if the body is malformed, ERR_ABRT if the
+ *         handler refused the request
+ */
+static err_t ICACHE_FLASH_ATTR
+httpd_mp_byte(struct httpd_multipart *mp, HTTPRequest *req, char c)
+{
+  switch (mp->state) {
+  case HTTPD_MP_DELIM:
+  case HTTPD_MP_DELIM_PAD:
+    if ((c == '-') && (mp->state == HTTPD_MP_DELIM)) {
+      mp->state = HTTPD_MP_DELIM_DASH;
+    } else if ((c == ' ') || (c == '\t')) {
+      mp->state = HTTPD_MP_DELIM_PAD;
+    } else if (c == '\r') {
+      mp->state = HTTPD_MP_DELIM_LF;
+    } else if (c == '\n') {
+      mp->state = HTTPD_MP_HEADERS;
+      mp->hdr_len = 0;
+    } else {
+      return ERR_VAL;
+    }
+    break;
+  case HTTPD_MP_DELIM_DASH:
+    if (c != '-') {
+      return ERR_VAL;
+    }
+    mp->state = HTTPD_MP_DONE;
+    break;
+  case HTTPD_MP_DELIM_LF:
+    if (c != '\n') {
+      return ERR_VAL;
+    }
+    mp->state = HTTPD_MP_HEADERS;
+    mp->hdr_len = 0;
+    break;
+  case HTTPD_MP_HEADERS:
+    if (mp->hdr_len == LWIP_HTTPD_MULTIPART_HDR_LEN) {
+      LWIP_DEBUGF(HTTPD_DEBUG, ("multipart: headers of a part too long\n"));
+      return ERR_VAL;
+    }
+    mp->hdr[mp->hdr_len++] = c;
+    if (c == '\n') {
+      /* an empty line ends them; there may be no header at all */
+      u16_t n = mp->hdr_len;
+      if ((n == 1) || ((n == 2) && (mp->hdr[0] == '\r')) || (mp->hdr[n - 2] == '\n') ||
+          ((n >= 3) && (mp->hdr[n - 2] == '\r') && (mp->hdr[n - 3] == '\n'))) {
+        return httpd_mp_begin(mp, req);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+  return ERR_OK;
+}
+
+/**
+ * Parse the next piece of the body.
+ *
+ * @param mp the parser, from httpd_multipart_new()
+ * @param req the request
+ * @param data the piece, which need not stay where it is afterwards
+ * @param len its length
+ * @return ERR_OK, ERR_VAL if the body is malformed, ERR_ABRT if the
+ *         handler refused the request
+ */
+err_t ICACHE_FLASH_ATTR
+httpd_multipart_feed(struct httpd_multipart *mp, HTTPRequest *req, const char *data, u32_t len)
+{
+  err_t err = ERR_OK;
+  u32_t i = 0;
+
+  while ((i < len) && (err == ERR_OK)) {
+    if ((mp->state == HTTPD_MP_PREAMBLE) || (mp->state == HTTPD_MP_DATA)) {
+      u32_t used;
+      err = httpd_mp_scan(mp, req, data + i, len - i, &used);
+      i += used;
+    } else if (mp->state == HTTPD_MP_DONE) {
+      break;
+    } else {
+      err = httpd_mp_byte(mp, req, data[i++]);
+    }
+  }
+  return err;
+}
+
+/** @return 1 if the closing delimiter has been received */
+int ICACHE_FLASH_ATTR
+httpd_multipart_done(const struct httpd_multipart *mp)
+{
+  return mp->state == HTTPD_MP_DONE;
+}
@@ -0,0 +1,35 @@
+/**
+ * @file
+ * Streaming parser of multipart/form-data request bodies.
+ *
+ * A route with a part handler (multipart=fn in routes.def) gets its body
+ * split into parts as it arrives, instead of buffered: the headers of each
+ * part are collected and passed on parsed, its data is passed on where it
+ * lies. What the parser holds is bounded by struct httpd_multipart
+ * (a delimiter and the headers of one part), whatever the size of the
+ * parts.
+ */
+#ifndef __HTTPD_MULTIPART_H__
+#define __HTTPD_MULTIPART_H__
+
+#include "lwip/opt.h"
+#include "lwip/err.h"
+#include "api.h"
+
+/** Room for the headers of one part (Content-Disposition, Content-Type);
+ * a part with more is refused. */
+#ifndef LWIP_HTTPD_MULTIPART_HDR_LEN
+#define LWIP_HTTPD_MULTIPART_HDR_LEN  256
+#endif
+
+/** Longest boundary, RFC 2046 */
+#define HTTPD_MULTIPART_BOUNDARY_MAX  70
+
+struct httpd_multipart;
+
+const char *httpd_multipart_boundary(const HTTPRequest *req, u8_t *len);
+struct httpd_multipart *httpd_multipart_new(HTTPRequest *req, http_part_handler handler);
+err_t httpd_multipart_feed(struct httpd_multipart *mp, HTTPRequest *req, const char *data, u32_t len);
+int httpd_multipart_done(const struct httpd_multipart *mp);
+
+#endif /* __HTTPD_MULTIPART_H__ */
@@ -0,0 +1,151 @@
+/* Per-connection state of the server, private to httpd.c.
+ *
+ * Every connection takes one struct http_state from a pool of
+ * LWIP_HTTPD_MAX_CONNS, so its size decides how many clients fit in the
+ * RAM set aside for the server. It only holds what every request needs;
+ * a request with a body gets a struct http_post_state from the request's
+ * arena (httpd_arena.h), and a generated response its read buffer.
+ * 'make size-report' in host/ prints the sizes for the configurations
+ * that change them. */
+
+#ifndef __HTTPD_STATE_H__
+#define __HTTPD_STATE_H__
+
+#include "lwip/opt.h"
+#include "lwip/pbuf.h"
+#include "httpd.h"
+#include "httpd_structs.h"
+#include "fs.h"
+#include "api.h"
+#include "http_request.h"
+
+/** Number of connections served at the same time. Their state (struct
+ * http_state, with the open file) is preallocated, so accepting one never
+ * touches the heap; connections beyond this are reset (conns_refused).
+ * One per TCP pcb by default.
+ */
+#ifndef LWIP_HTTPD_MAX_CONNS
+#define LWIP_HTTPD_MAX_CONNS                MEMP_NUM_TCP_PCB
+#endif
+#if LWIP_HTTPD_MAX_CONNS > 255
+#error "LWIP_HTTPD_MAX_CONNS must fit http_state.next_free"
+#endif
+
+/** Set this to 1 to enabled timing each file sent */
+#ifndef LWIP_HTTPD_TIMING
+#define LWIP_HTTPD_TIMING                   0
+#endif
+
+/** Set this to 0 to close the connection after every response. Otherwise
+    HTTP/1.1 requests (and HTTP/1.0 ones with "Connection: keep-alive") keep
+    it open for the next request; responses are framed by Content-Length. */
+#ifndef LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+#define LWIP_HTTPD_SUPPORT_11_KEEPALIVE     1
+#endif
+
+/** Set this to 0 to refuse request bodies sent with
+    "Transfer-Encoding: chunked" (501) instead of decoding them as they
+    arrive. */
+#ifndef LWIP_HTTPD_SUPPORT_REQ_CHUNKED
+#define LWIP_HTTPD_SUPPORT_REQ_CHUNKED      1
+#endif
+
+struct tcp_pcb;
+struct httpd_multipart;
+
+/** Resumable parser for the head of a request: every received byte is
+ * looked at once, wherever the segment boundaries fall. Positions are
+ * offsets from the start of the request. */
+struct http_parser {
+  u16_t len;            /* bytes of the head scanned so far */
+  u16_t uri_off;
+  u16_t uri_len;
+  u16_t name_match;     /* bit n: the name still matches http_parse_hdrs[n] */
+  u8_t state;           /* HTTP_PARSE_* */
+  u8_t method_len;
+  char method[8];
+  u8_t name_len;        /* length of the current header name (or version) */
+  u8_t hdr;             /* HTTP_PARSE_HDR_* whose value is being parsed */
+  u8_t hdr_slot;        /* where the length of that value goes: HTTP_HDR_* + 1,
+                           HTTP_PARSE_SLOT_OTHER | index into req_info.hdrs,
+                           0 for nowhere */
+  u8_t has_content_len;
+  u8_t is_09;
+  u8_t is_11;           /* HTTP/1.1 or later */
+  u8_t conn;            /* HTTP_CONN_* */
+  u8_t te;              /* HTTP_TE_* */
+  u8_t expect;          /* HTTP_EXPECT_* */
+  u8_t token_len;       /* token of a list value (Connection,
+                           Transfer-Encoding, Expect), lower case */
+  char token[12];
+};
+
+#if LWIP_HTTPD_SUPPORT_POST
+/** What a request with a body needs while the body comes in, allocated by
+ * http_post_request() and freed with the rest of the request */
+struct http_post_state {
+  u32_t content_len_left; /* ~0 until a chunked body is complete */
+  http_body_handler body; /* streams the body, NULL to buffer it */
+  struct httpd_multipart *multipart; /* parses it for a part handler */
+  struct pbuf *req;       /* request packet: uri and params live there
+                             until the body is complete */
+#if LWIP_HTTPD_POST_MANUAL_WND
+  u32_t unrecved_bytes;
+  struct tcp_pcb *pcb;
+#endif /* LWIP_HTTPD_POST_MANUAL_WND */
+#if LWIP_HTTPD_SUPPORT_REQ_CHUNKED
+  u32_t chunk_max;        /* most data bytes the body may have */
+  u32_t chunk_left;       /* data bytes of the current chunk still to come */
+  u16_t chunk_meta;       /* bytes of the current chunk extension, or of
+                             all trailers */
+  u8_t chunk_state;       /* HTTP_REQ_CHUNK_* */
+#endif /* LWIP_HTTPD_SUPPORT_REQ_CHUNKED */
+#if LWIP_HTTPD_POST_MANUAL_WND
+  u8_t no_auto_wnd;
+#endif /* LWIP_HTTPD_POST_MANUAL_WND */
+};
+#endif /* LWIP_HTTPD_SUPPORT_POST */
+
+/** Sorted by size, so that the fields of each configuration pack */
+struct http_state {
+  struct webfs_file *handle;  /* &webfs while a file is open, else NULL */
+  char *file;       /* Pointer to first unsent byte in buf. */
+  struct pbuf *req; /* pbufs of the request head, until it is complete */
+  char *req_head;   /* copy of a head that was split across pbufs */
+#if LWIP_HTTPD_DYNAMIC_HEADERS
+  char *buf;        /* read buffer of a generated response (arena) */
+#endif /* LWIP_HTTPD_DYNAMIC_HEADERS */
+#if LWIP_HTTPD_SUPPORT_POST
+  struct http_post_state *post; /* NULL unless receiving a body */
+#endif /* LWIP_HTTPD_SUPPORT_POST */
+  u32_t left;       /* Number of unsent bytes in buf. */
+#if LWIP_HTTPD_MAX_DEFERRED
+  httpd_defer_t deferred; /* token of the response the handler deferred */
+#endif /* LWIP_HTTPD_MAX_DEFERRED */
+#if LWIP_HTTPD_TIMING
+  u32_t time_started;
+#endif /* LWIP_HTTPD_TIMING */
+  u16_t snd_limit;  /* largest write to try after ERR_MEM, 0: no limit */
+#if LWIP_HTTPD_DYNAMIC_HEADERS
+  u16_t buf_len;    /* size of buf, at most two MSS */
+  u16_t hdr_pos;    /* header bytes written so far */
+#endif /* LWIP_HTTPD_DYNAMIC_HEADERS */
+#if LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+  u16_t requests;   /* requests received on this connection */
+  u8_t keepalive;   /* keep the connection open after this response */
+#endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+  u8_t next_free;   /* while unused: pool index + 1 of the next free one */
+  u8_t retries;
+  u8_t linger;      /* HTTP_LINGER_*: closing, waiting for the ACKs */
+#if LWIP_HTTPD_DYNAMIC_HEADERS
+  u8_t hdr_block;   /* index into http_hdr_table.blocks */
+  u8_t hdr_type;    /* index into http_hdr_table.types */
+  u8_t hdr_pending; /* the header is not completely written yet */
+  u8_t chunked;     /* HTTP_CHUNKED_* */
+#endif /* LWIP_HTTPD_DYNAMIC_HEADERS */
+  struct http_parser parser;
+  struct webfs_file webfs;
+  HTTPRequest req_info;
+};
+
+#endif /* __HTTPD_STATE_H__ */
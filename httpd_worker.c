@@ -0,0 +1,266 @@
+/**
+ * @file
+ * Worker tasks running route handlers outside the tcpip thread.
+ *
+ * The handlers of routes with the "worker" option (see routes.def) would
+ * otherwise run in the tcpip thread, holding up ACKs and every other
+ * connection while they format their response. With LWIP_HTTPD_WORKERS
+ * set, webfs_open_custom() hands such a request to a worker instead and
+ * the response is deferred (see httpd_defer()):
+ *
+ * - the tcpip thread copies the request (URI, parameters, headers and
+ *   body, which the connection may free before the worker is done) into
+ *   a job and pushes it onto the job ring of the next worker,
+ * - the worker runs the handler, pushes the job onto its done ring and
+ *   queues httpd_worker_drain() with tcpip_callback(),
+ * - httpd_worker_drain() passes the responses to httpd_complete_file().
+ *
+ * Each ring has exactly one producer and one consumer, so neither side
+ * takes a lock (see spsc_ring.h). The tasks are created with
+ * sys_thread_new(), so they are FreeRTOS tasks on the device and pthreads
+ * in the host build. Handlers allocate their responses from the lwIP heap,
+ * which is thread safe with NO_SYS=0, into an arena of the job's own (see
+ * httpd_arena.h) that goes to the connection with the response.
+ */
+#include "lwip/opt.h"
+#include "lwip/mem.h"
+#include "lwip/sys.h"
+#include "lwip/tcpip.h"
+#include "httpd_worker.h"
+#include "httpd_arena.h"
+#include "spsc_ring.h"
+
+#include <string.h>
+
+#if LWIP_HTTPD_WORKERS
+
+/** Stack size and priority of the worker tasks (sys_thread_new()); keep
+ * them below the tcpip thread so they never delay it */
+#ifndef HTTPD_WORKER_STACKSIZE
+#define HTTPD_WORKER_STACKSIZE    512
+#endif
+
+#ifndef HTTPD_WORKER_PRIO
+#define HTTPD_WORKER_PRIO         2
+#endif
+
+#if SPSC_RING_LEN < LWIP_HTTPD_MAX_DEFERRED
+#error "SPSC_RING_LEN must hold LWIP_HTTPD_MAX_DEFERRED jobs"
+#endif
+
+#if !SYS_LIGHTWEIGHT_PROT
+#error "LWIP_HTTPD_WORKERS needs SYS_LIGHTWEIGHT_PROT"
+#endif
+
+/** A request handed to a worker, and the response handed back */
+struct httpd_job {
+  httpd_defer_t token;
+  const RouteMethod *m;
+  HTTPRequest req;            /* its strings point into copy, its arena
+                                 holds what the handler allocated */
+  struct webfs_file result;   /* the handler's response */
+  char copy[1];               /* the head from the URI on, the body and the
+                                 parameter indexes */
+};
+
+struct httpd_worker {
+  struct spsc_ring jobs;      /* tcpip thread -> worker */
+  struct spsc_ring done;      /* worker -> tcpip thread */
+  sys_sem_t wake;             /* signalled after each push onto jobs */
+};
+
+static struct httpd_worker httpd_workers[LWIP_HTTPD_WORKERS];
+/** Worker to try first, round robin (tcpip thread only) */
+static u8_t httpd_worker_next;
+/** Jobs submitted and not freed by httpd_worker_drain() yet (tcpip thread
+ * only). A deferred response that times out or loses its connection
+ * gives back its token while the worker still has the job, so this and
+ * not LWIP_HTTPD_MAX_DEFERRED bounds what the rings have to hold. */
+static u8_t httpd_worker_live;
+/** httpd_worker_drain() is queued and has not started yet; tested and set
+ * under SYS_ARCH_PROTECT, the core has no atomic exchange */
+static u8_t httpd_worker_drain_queued;
+
+/** Bytes of the request head from req->uri on that a handler may read:
+ * the URI, its parameters and the headers recorded for http_header() */
+static size_t ICACHE_FLASH_ATTR
+httpd_worker_head_len(const HTTPRequest *req)
+{
+  size_t len = strlen(req->uri) + 1;
+  int i;
+
+  if (req->params != NULL) {
+    len = (size_t)(req->params - req->uri) + strlen(req->params) + 1;
+  }
+  for (i = 0; i < HTTP_HDR_COUNT; i++) {
+    if (req->hdr[i].off != 0) {
+      len = LWIP_MAX(len, (size_t)req->hdr[i].off + req->hdr[i].len);
+    }
+  }
+#if HTTP_MAX_HEADERS
+  for (i = 0; i < req->hdr_count; i++) {
+    const HTTPHeader *h = &req->hdrs[i];
+    len = LWIP_MAX(len, (size_t)h->name_off + h->name_len + 1 + h->value_len);
+  }
+#endif /* HTTP_MAX_HEADERS */
+  return len;
+}
+
+/** Runs in the tcpip thread: sends the responses the workers are done with */
+static void
+httpd_worker_drain(void *arg)
+{
+  struct httpd_job *job;
+  int i;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  LWIP_UNUSED_ARG(arg);
+  /* cleared before looking, so a result pushed from now on queues us again */
+  SYS_ARCH_PROTECT(lev);
+  httpd_worker_drain_queued = 0;
+  SYS_ARCH_UNPROTECT(lev);
+  for (i = 0; i < LWIP_HTTPD_WORKERS; i++) {
+    while ((job = (struct httpd_job *)spsc_ring_pop(&httpd_workers[i].done)) != NULL) {
+      /* ERR_ARG: the connection is gone, the response is still ours */
+      httpd_complete_file(job->token, &job->result, &job->req.arena);
+      webfs_free_data(&job->result);
+      httpd_arena_free(&job->req.arena);
+      mem_free(job);
+      httpd_worker_live--;
+    }
+  }
+}
+
+static void
+httpd_worker_thread(void *arg)
+{
+  struct httpd_worker *w = (struct httpd_worker *)arg;
+  struct httpd_job *job;
+  u8_t queued;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  for (;;) {
+    sys_arch_sem_wait(&w->wake, 0);
+    while ((job = (struct httpd_job *)spsc_ring_pop(&w->jobs)) != NULL) {
+      if (!webfs_run_route(&job->result, job->m, &job->req)) {
+        /* as in the tcpip thread: the 404 page */
+        job->req.status = 404;
+        if (!webfs_run_route(&job->result, &page_err_404.func[job->req.method], &job->req)) {
+          job->req.status = 500;
+        }
+      } else if (job->result.deferred) {
+        /* httpd_defer() is not for handlers in a worker */
+        job->req.status = 500;
+      }
+      job->result.status = job->req.status;
+      /* cannot be full: httpd_worker_submit() keeps no more than
+         SPSC_RING_LEN jobs alive */
+      while (!spsc_ring_push(&w->done, job)) {
+        sys_msleep(1);
+      }
+      SYS_ARCH_PROTECT(lev);
+      queued = httpd_worker_drain_queued;
+      httpd_worker_drain_queued = 1;
+      SYS_ARCH_UNPROTECT(lev);
+      if (!queued) {
+        while (tcpip_callback_with_block(httpd_worker_drain, NULL, 1) != ERR_OK) {
+          sys_msleep(1);
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Hand a request to a worker. Called by webfs_open_custom() in the tcpip
+ * thread, before the handler would run there.
+ *
+ * @return 1 if a worker runs the handler (the response is deferred),
+ *         0 if it has to run right away
+ */
+int ICACHE_FLASH_ATTR
+httpd_worker_submit(const RouteMethod *m, HTTPRequest *req)
+{
+  size_t head_len = httpd_worker_head_len(req);
+  size_t post_len = (req->post_data != NULL) ? req->post_len + 1 : 0;
+  /* the indexes hold offsets only, they are valid for the copies too */
+  size_t query_len = (req->query != NULL) ? http_params_size(req->query) + MEM_ALIGNMENT : 0;
+  size_t form_len = (req->form != NULL) ? http_params_size(req->form) + MEM_ALIGNMENT : 0;
+  struct httpd_job *job;
+  httpd_defer_t token;
+  char *p;
+  int i;
+
+  if (httpd_worker_live == SPSC_RING_LEN) {
+    /* the done rings could overflow: run it in the tcpip thread */
+    return 0;
+  }
+  token = httpd_defer(req);
+  if (token == 0) {
+    return 0;
+  }
+  /* if this fails, the token is given back as the handler answers */
+  job = (struct httpd_job *)mem_malloc((mem_size_t)(sizeof(struct httpd_job) +
+    head_len + post_len + query_len + form_len));
+  if (job == NULL) {
+    return 0;
+  }
+  memset(job, 0, sizeof(struct httpd_job));
+  job->token = token;
+  job->m = m;
+  job->req = *req;
+  /* there is no connection to use from a worker, nor its arena */
+  job->req.connection = NULL;
+  job->req.arena = NULL;
+  p = job->copy;
+  /* in one piece: the parameters and headers are found relative to it */
+  MEMCPY(p, req->uri, head_len);
+  job->req.uri = p;
+  if (req->params != NULL) {
+    job->req.params = p + (req->params - req->uri);
+  }
+  p += head_len;
+  if (post_len != 0) {
+    MEMCPY(p, req->post_data, post_len);
+    job->req.post_data = p;
+    p += post_len;
+  }
+  if (query_len != 0) {
+    job->req.query = (HTTPParams *)LWIP_MEM_ALIGN(p);
+    MEMCPY(job->req.query, req->query, http_params_size(req->query));
+    p += query_len;
+  }
+  if (form_len != 0) {
+    job->req.form = (HTTPParams *)LWIP_MEM_ALIGN(p);
+    MEMCPY(job->req.form, req->form, http_params_size(req->form));
+  }
+
+  for (i = 0; i < LWIP_HTTPD_WORKERS; i++) {
+    struct httpd_worker *w = &httpd_workers[httpd_worker_next];
+    httpd_worker_next = (u8_t)((httpd_worker_next + 1) % LWIP_HTTPD_WORKERS);
+    if (spsc_ring_push(&w->jobs, job)) {
+      httpd_worker_live++;
+      sys_sem_signal(&w->wake);
+      return 1;
+    }
+  }
+  mem_free(job);
+  return 0;
+}
+
+/** Start the worker tasks, called by httpd_init() */
+void ICACHE_FLASH_ATTR
+httpd_worker_init(void)
+{
+  int i;
+
+  for (i = 0; i < LWIP_HTTPD_WORKERS; i++) {
+    err_t err = sys_sem_new(&httpd_workers[i].wake, 0);
+    LWIP_ASSERT("httpd_worker_init: sys_sem_new failed", err == ERR_OK);
+    LWIP_UNUSED_ARG(err);
+    sys_thread_new("httpd_worker", httpd_worker_thread, &httpd_workers[i],
+      HTTPD_WORKER_STACKSIZE, HTTPD_WORKER_PRIO);
+  }
+}
+
+#endif /* LWIP_HTTPD_WORKERS */
@@ -0,0 +1,21 @@
+#ifndef __HTTPD_WORKER_H__
+#define __HTTPD_WORKER_H__
+
+#include "httpd.h"
+#include "fs.h"
+#include "api.h"
+
+#if LWIP_HTTPD_WORKERS
+/* httpd_worker.c */
+void httpd_worker_init(void);
+int httpd_worker_submit(const RouteMethod *m, HTTPRequest *req);
+#endif /* LWIP_HTTPD_WORKERS */
+
+#if LWIP_HTTPD_MAX_DEFERRED
+/* httpd.c */
+struct httpd_arena_chunk;
+err_t httpd_complete_file(httpd_defer_t token, struct webfs_file *result,
+                          struct httpd_arena_chunk **arena);
+#endif /* LWIP_HTTPD_MAX_DEFERRED */
+
+#endif /* __HTTPD_WORKER_H__ */
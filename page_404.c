@@ -1,10 +1,8 @@
 #include "esp_common.h"
 #include "api_struct.h"
 
-const char* ICACHE_FLASH_ATTR
-page_404(HTTPRequest *req, void *args)
+int ICACHE_FLASH_ATTR
+page_404(HTTPRequest *req, char *buf, int buf_len, void *args)
 {
-	char *api_buffer = (char *)malloc(MAX_API_CONTENT);
-	strcpy(api_buffer, "404 Not Found");
-	return api_buffer;
-}
\ No newline at end of file
+	return snprintf(buf, buf_len, "404 Not Found");
+}
@@ -0,0 +1,103 @@
+#include "esp_common.h"
+#include "lwip/tcpip.h"
+#include "api_struct.h"
+#include "httpd.h"
+
+/* Access points in range as JSON, from a WiFi scan. The scan takes
+   seconds, so the handler defers the response instead of waiting for it;
+   requests coming in while a scan is running wait for the same one. */
+
+/* JSON of one access point at its longest: a 32-byte SSID, rssi -128,
+   channel 255, an 11-digit authmode and the leading comma */
+#define SCAN_ENTRY_MAX	96
+
+/* the requests waiting for the scan, only used in the tcpip thread */
+static httpd_defer_t scan_waiting[LWIP_HTTPD_MAX_DEFERRED];
+static int scan_num_waiting;
+
+/* result of the last scan, handed from the scan callback to page_scan_done */
+static char *scan_result;
+static int scan_result_len;
+/* set if page_scan_done could not be queued: the next request runs it */
+static volatile int scan_done_lost;
+
+/* Runs in the tcpip thread: answers everyone who waited for the scan */
+static void ICACHE_FLASH_ATTR
+page_scan_done(void *arg)
+{
+	int i;
+
+	for (i = 0; i < scan_num_waiting; i++) {
+		httpd_complete(scan_waiting[i], (scan_result != NULL) ? 200 : 500,
+			       scan_result, scan_result_len);
+	}
+	scan_num_waiting = 0;
+	free(scan_result);
+	scan_result = NULL;
+	scan_result_len = 0;
+}
+
+static void ICACHE_FLASH_ATTR
+page_scan_cb(void *arg, STATUS status)
+{
+	struct bss_info *bss;
+	int n = 0, len, size;
+	char *json;
+
+	for (bss = (struct bss_info *)arg; bss != NULL; bss = STAILQ_NEXT(bss, next))
+		n++;
+	size = n * SCAN_ENTRY_MAX + 3;
+	json = (status == OK) ? (char *)malloc(size) : NULL;
+	if (json != NULL) {
+		len = snprintf(json, size, "[");
+		for (bss = (struct bss_info *)arg; bss != NULL && len < size;
+		     bss = STAILQ_NEXT(bss, next)) {
+			char ssid[33];
+			int i;
+			/* the SSID is 32 arbitrary bytes: keep it valid JSON */
+			for (i = 0; i < bss->ssid_len && i < 32; i++) {
+				uint8 c = bss->ssid[i];
+				ssid[i] = (c < 0x20 || c >= 0x7f || c == '"' || c == '\\') ? '?' : (char)c;
+			}
+			ssid[i] = '\0';
+			len += snprintf(json + len, size - len,
+					"%s{\"ssid\":\"%s\",\"rssi\":%d,\"channel\":%d,\"authmode\":%d}",
+					(len > 1) ? "," : "", ssid, bss->rssi, bss->channel,
+					(int)bss->authmode);
+		}
+		if (len < size)
+			len += snprintf(json + len, size - len, "]");
+		/* snprintf() returns what it would have written */
+		if (len >= size)
+			len = size - 1;
+		scan_result = json;
+		scan_result_len = len;
+	}
+	/* the scan callback does not run in the tcpip thread */
+	if (tcpip_callback(page_scan_done, NULL) != ERR_OK)
+		scan_done_lost = 1;
+}
+
+int ICACHE_FLASH_ATTR
+page_scan(HTTPRequest *req, char *buf, int buf_len, void *args)
+{
+	httpd_defer_t token;
+
+	if (scan_done_lost) {
+		/* the requests that waited have timed out by now */
+		scan_done_lost = 0;
+		page_scan_done(NULL);
+	}
+	if (scan_num_waiting == LWIP_HTTPD_MAX_DEFERRED ||
+	    (token = httpd_defer(req)) == 0) {
+		req->status = 500;
+		return snprintf(buf, buf_len, "{\"error\":\"busy\"}");
+	}
+	if (scan_num_waiting == 0 && !wifi_station_scan(NULL, page_scan_cb)) {
+		/* no scan started: the token is released as the handler answers */
+		req->status = 500;
+		return snprintf(buf, buf_len, "{\"error\":\"scan failed\"}");
+	}
+	scan_waiting[scan_num_waiting++] = token;
+	return HTTP_DEFERRED;
+}
@@ -1,71 +1,63 @@
 #include "esp_common.h"
-#include "api_struct.h"
+#include "api.h"
 
+int ICACHE_FLASH_ATTR
+page_ssid_get(HTTPRequest *req, char *buf, int buf_len, void *args)
+{
+	struct softap_config apconfig;
+	const char template[] = "{" \
+							"\"SSID\": \"%s\"," \
+							"\"PASSWORD\": \"%s\"," \
+							"\"CHANNEL\": %d," \
+							"\"AUTHMODE\": %d," \
+							"\"SSID_HIDDEN\": %d," \
+							"\"MAX_CONNECTION\": %d" \
+							"}";
+	wifi_softap_get_config(&apconfig);
+
+	return snprintf(buf, buf_len, template, (char *)apconfig.ssid, \
+									   (char *)apconfig.password, \
+									   apconfig.channel, \
+									   apconfig.authmode, \
+									   apconfig.ssid_hidden, \
+									   apconfig.max_connection);
+}
+
+/* POST for change softap config */
 const char* ICACHE_FLASH_ATTR
-page_ssid(HTTPRequest *req, void *args)
+page_ssid_post(HTTPRequest *req, void *args)
 {
-	char *api_buffer = (char *)malloc(MAX_API_CONTENT);
-	
-	if(0 == req->is_post)
+	/* freed with the request */
+	char *api_buffer = (char *)http_alloc(req, MAX_API_CONTENT);
+	if (api_buffer == NULL)
+		return NULL;
+	int len, which, iter;
+
+	printf("params: %s \n", req->params ? req->params : "");
+	/* rtn data*/
+	len = snprintf(api_buffer, MAX_API_CONTENT, "POST DATA TEST:\n");
+	/* parameters, then the post data */
+	for (which = HTTP_PARAMS_QUERY; which <= HTTP_PARAMS_FORM; which++)
 	{
-		struct softap_config apconfig;
-		const char template[] = "{" \
-								"\"SSID\": \"%s\"," \
-								"\"PASSWORD\": \"%s\"," \
-								"\"CHANNEL\": %d," \
-								"\"AUTHMODE\": %d," \
-								"\"SSID_HIDDEN\": %d," \
-								"\"MAX_CONNECTION\": %d" \
-								"}";
-		/* GET */
-		wifi_softap_get_config(&apconfig);
-		/* GET */
-		const char method[] = "GET";
-		char *params = req->params;
+		int count = http_param_count(req, which);
 
-		sprintf(api_buffer, template, (char *)apconfig.ssid, \
-									  (char *)apconfig.password, \
-									  apconfig.channel, \
-									  apconfig.authmode, \
-									  apconfig.ssid_hidden, \
-									  apconfig.max_connection);
-	} else {
-		/* POST for change softap config */
-		const char method[] = "POST";
-		char *params = req->params;
-		printf("params: %s \n", params);
-		uint16_t para_amount;
-		uint16_t iter;
-		Params para[MAX_PARAM];
-		para_amount = extract_params(params, para);
-		printf("[*] parsed %d parameters \n", para_amount);
-		/* rtn data*/
-		sprintf(api_buffer, "POST DATA TEST:\n");
-		/* parameters */
-		strcat(api_buffer, "parameters:\n");
-		printf("\n\n%s\n\n", api_buffer);
-		for(iter = 0; iter < para_amount; iter++)
-		{
-			strcat(api_buffer, "key:");
-			strcat(api_buffer, para[iter].key);
-			strcat(api_buffer, "\tvalue:");
-			strcat(api_buffer, para[iter].value);
-		}
-		printf("\n\n%s\n\n", api_buffer);
-		strcat(api_buffer, "\n");
-		strcat(api_buffer, "post data:\n");
-		para_amount = extract_params(req->post_data, para);
-		printf("[*] parsed %d data_post \n", para_amount);
-		for(iter = 0; iter < para_amount; iter++)
+		printf("[*] parsed %d %s \n", count,
+		       which == HTTP_PARAMS_QUERY ? "parameters" : "data_post");
+		len += snprintf(api_buffer + len, MAX_API_CONTENT - len, "%s",
+				which == HTTP_PARAMS_QUERY ? "parameters:\n" : "\npost data:\n");
+		for (iter = 0; iter < count && len < MAX_API_CONTENT; iter++)
 		{
-			strcat(api_buffer, "key:");
-			strcat(api_buffer, para[iter].key);
-			strcat(api_buffer, "\tvalue:");
-			strcat(api_buffer, para[iter].value);
+			const char *key;
+			uint16_t key_len, value_len;
+			const char *value = http_param_at(req, which, iter, &key, &key_len, &value_len);
+
+			len += snprintf(api_buffer + len, MAX_API_CONTENT - len, "key:%.*s\tvalue:%.*s",
+					key_len, key, value_len, value);
 		}
-		printf("\n\n%s\n\n", api_buffer);
-		
+		if (len >= MAX_API_CONTENT)
+			break;
 	}
+	printf("\n\n%s\n\n", api_buffer);
 
 	return api_buffer;
 }
@@ -0,0 +1,34 @@
+#include "esp_common.h"
+#include "api_struct.h"
+
+/* Stations connected to the softAP as CSV, one "mac,ip" line each, of any
+   number: generated a window at a time, *state counts the lines sent */
+int ICACHE_FLASH_ATTR
+page_stations(HTTPRequest *req, char *buf, int buf_len, uint32_t *state, void *args)
+{
+	struct station_info *sta;
+	uint32_t i = 0;
+	int len = 0;
+	char line[40];
+
+	if (*state == 0 && req != NULL) {
+		len = snprintf(buf, buf_len, "mac,ip\n");
+	}
+	for (sta = wifi_softap_get_station_info(); sta != NULL; sta = STAILQ_NEXT(sta, next), i++) {
+		int n;
+		if (i < *state)
+			continue;
+		n = snprintf(line, sizeof(line), "%02x:%02x:%02x:%02x:%02x:%02x,%d.%d.%d.%d\n",
+			     sta->bssid[0], sta->bssid[1], sta->bssid[2],
+			     sta->bssid[3], sta->bssid[4], sta->bssid[5],
+			     ip4_addr1(&sta->ip), ip4_addr2(&sta->ip),
+			     ip4_addr3(&sta->ip), ip4_addr4(&sta->ip));
+		if (len + n > buf_len)
+			break;
+		memcpy(buf + len, line, n);
+		len += n;
+		(*state)++;
+	}
+	wifi_softap_free_station_info();
+	return len;
+}
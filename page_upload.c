@@ -0,0 +1,79 @@
+#include "esp_common.h"
+#include "api_struct.h"
+
+/* File upload from an HTML form (multipart/form-data). The parts are
+   passed to page_upload_part as they arrive, so a file may be larger than
+   the heap; this one only counts the bytes of each file and sums them,
+   where a firmware update would write them to flash. page_upload answers
+   with what the last upload held. */
+
+#define UPLOAD_NAME_MAX	32
+
+static struct {
+	char field[UPLOAD_NAME_MAX];
+	char filename[UPLOAD_NAME_MAX];
+	uint32_t size;
+	uint32_t sum;
+	uint16_t parts;
+} upload_last;
+
+static void ICACHE_FLASH_ATTR
+page_upload_name(char *dst, const char *s, uint16_t len)
+{
+	if (s == NULL)
+		len = 0;
+	if (len >= UPLOAD_NAME_MAX)
+		len = UPLOAD_NAME_MAX - 1;
+	memcpy(dst, s, len);
+	dst[len] = '\0';
+}
+
+int ICACHE_FLASH_ATTR
+page_upload_part(HTTPRequest *req, int event, HTTPPart *part, const char *data,
+		 int len, void *args)
+{
+	int i;
+
+	switch (event) {
+	case HTTP_PART_BEGIN:
+		if (part->index == 0)
+			memset(&upload_last, 0, sizeof(upload_last));
+		upload_last.parts = part->index + 1;
+		/* the strings of part are gone once it ends */
+		if (part->filename != NULL) {
+			page_upload_name(upload_last.field, part->name, part->name_len);
+			page_upload_name(upload_last.filename, part->filename, part->filename_len);
+		}
+		part->state = 0;
+		break;
+	case HTTP_PART_DATA:
+		if (part->filename == NULL)
+			break;
+		for (i = 0; i < len; i++)
+			part->state += (uint8_t)data[i];
+		break;
+	case HTTP_PART_END:
+		if (part->filename != NULL) {
+			upload_last.size = part->len;
+			upload_last.sum = part->state;
+		}
+		break;
+	}
+	return 0;
+}
+
+int ICACHE_FLASH_ATTR
+page_upload(HTTPRequest *req, char *buf, int buf_len, void *args)
+{
+	const char template[] = "{" \
+				"\"FIELD\": \"%s\"," \
+				"\"FILENAME\": \"%s\"," \
+				"\"SIZE\": %u," \
+				"\"SUM\": %u," \
+				"\"PARTS\": %u" \
+				"}";
+
+	return snprintf(buf, buf_len, template, upload_last.field, upload_last.filename,
+			(unsigned)upload_last.size, (unsigned)upload_last.sum,
+			(unsigned)upload_last.parts);
+}
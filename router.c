@@ -0,0 +1,108 @@
+#include "esp_common.h"
+#include "api.h"
+#include "router_hash.h"
+
+extern int page_404(HTTPRequest *, char *, int, void *);
+
+#define PAGE_404	{.handler = page_404, .buf_size = 32}
+
+const URLRouter page_err_404 = {
+	"/404.html", {PAGE_404, PAGE_404, PAGE_404, PAGE_404}
+};
+
+/* Match path[pos..len) against the trie below node 'idx', static children
+   first, then parameters, then wildcards. Returns route + 1 or 0. */
+static uint32_t ICACHE_FLASH_ATTR
+router_match_node(const URLRouteTable *table, uint32_t idx, const char *path,
+		  uint32_t pos, uint32_t len, HTTPRequest *req, uint32_t argc)
+{
+	const URLRouteNode *node = &table->nodes[idx];
+	uint32_t end = pos;
+	uint32_t i, route;
+
+	switch (node->type) {
+	case ROUTE_NODE_STATIC:
+		if (len - pos < node->label_len ||
+		    memcmp(path + pos, node->label, node->label_len) != 0)
+			return 0;
+		end = pos + node->label_len;
+		break;
+	case ROUTE_NODE_PARAM:
+		while (end < len && path[end] != '/')
+			end++;
+		if (end == pos)
+			return 0;
+		break;
+	default:
+		/* ROUTE_NODE_WILDCARD */
+		end = len;
+		break;
+	}
+	if (node->type != ROUTE_NODE_STATIC) {
+		if (req != NULL && argc < HTTP_MAX_PATH_ARGS) {
+			req->path_args[argc].off = (uint16_t)pos;
+			req->path_args[argc].len = (uint16_t)(end - pos);
+		}
+		argc++;
+	}
+	if (end == len && node->route != 0) {
+		if (req != NULL)
+			req->path_argc = (argc < HTTP_MAX_PATH_ARGS) ? argc : HTTP_MAX_PATH_ARGS;
+		return node->route;
+	}
+	for (i = 0; i < node->child_count; i++) {
+		route = router_match_node(table, node->first_child + i, path, end, len, req, argc);
+		if (route != 0)
+			return route;
+	}
+	return 0;
+}
+
+/*
+	@param table: route table generated by tools/mkroutes
+	@param url: NUL-terminated request path, without parameters
+	@param req: receives the path parameters (may be NULL), as slices
+	            relative to url, so url should be req->uri
+
+	@return URLRouter*: matching route or NULL
+*/
+const URLRouter * ICACHE_FLASH_ATTR
+router_lookup(const URLRouteTable *table, const char *url, HTTPRequest *req)
+{
+	uint32_t len = strlen(url);
+	uint32_t hash = router_hash(url, len, table->seed);
+	/* slots live in flash: only aligned 32-bit reads */
+	const uint32_t *slot = &table->slots[(hash & table->mask) * 2];
+	uint32_t meta = slot[1];
+	uint32_t route;
+
+	if (req != NULL)
+		req->path_argc = 0;
+	/* static routes: one hash, a length check and at most one compare */
+	if (meta != 0 && slot[0] == hash && (meta >> 16) == len) {
+		const URLRouter *r = &table->routes[(meta & 0xffff) - 1];
+		if (memcmp(r->url, url, len) == 0)
+			return r;
+	}
+	if (table->nodes == NULL)
+		return NULL;
+	route = router_match_node(table, 0, url, 0, len, req, 0);
+	return route ? &table->routes[route - 1] : NULL;
+}
+
+/*
+	@param req: request matched by router_lookup
+	@param idx: index of the ":param" or "*" in the route pattern
+	@param len: receives the length of the argument
+
+	@return char*: start of the argument inside req->uri (not
+	               NUL-terminated) or NULL if there is no such argument
+*/
+const char * ICACHE_FLASH_ATTR
+http_path_arg(const HTTPRequest *req, uint8_t idx, uint16_t *len)
+{
+	if (idx >= req->path_argc)
+		return NULL;
+	*len = req->path_args[idx].len;
+	return req->uri + req->path_args[idx].off;
+}
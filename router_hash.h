@@ -0,0 +1,21 @@
+/* URL hash shared by the router and tools/mkroutes, which uses it to build
+ * the collision-free route table at build time. Keep both in sync: a change
+ * here requires regenerating routes.c. */
+
+#ifndef _ROUTER_HASH_H
+#define _ROUTER_HASH_H
+#include <stdint.h>
+
+/* FNV-1a with a seed folded into the offset basis */
+static inline uint32_t
+router_hash(const char *s, uint32_t len, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ seed;
+	while (len--) {
+		h ^= (uint8_t)*s++;
+		h *= 16777619u;
+	}
+	return h ^ (h >> 16);
+}
+
+#endif
@@ -0,0 +1,42 @@
+/* Generated by tools/mkroutes from routes.def, do not edit. */
+
+#include "esp_common.h"
+#include "api.h"
+
+extern int page_index(HTTPRequest *, char *, int, void *);
+extern int page_ssid_get(HTTPRequest *, char *, int, void *);
+extern const char* page_ssid_post(HTTPRequest *, void*);
+extern int page_stations(HTTPRequest *, char *, int, uint32_t *, void *);
+extern int page_scan(HTTPRequest *, char *, int, void *);
+extern int page_upload(HTTPRequest *, char *, int, void *);
+extern int page_upload_part(HTTPRequest *, int, HTTPPart *, const char *, int, void *);
+
+/* {url, {GET, POST, PUT, DELETE}}, each a RouteMethod by field name */
+static const URLRouter router_urls[] ICACHE_RODATA_ATTR = {
+	{"/", {{.handler = page_index}, {.handler = page_index}, {.handler = page_index}, {.handler = page_index}}},
+	{"/ssid", {{.handler = page_ssid_get, .buf_size = 192, .flags = ROUTE_WORKER}, {.legacy = page_ssid_post, .max_body = 256, .flags = ROUTE_WORKER}, {0}, {0}}},
+	{"/stations.csv", {{.stream = page_stations}, {0}, {0}, {0}}},
+	{"/scan", {{.handler = page_scan}, {0}, {0}, {0}}},
+	{"/upload", {{0}, {.handler = page_upload, .part = page_upload_part}, {0}, {0}}},
+};
+
+/* slot = router_hash(url, len, seed) & mask: {hash, len << 16 | route + 1} */
+static const uint32_t router_slots[] ICACHE_RODATA_ATTR = {
+	0x209d4138u, 0x00050002u, /* /ssid */
+	0xf3de3341u, 0x00050004u, /* /scan */
+	0x619d8b62u, 0x00070005u, /* /upload */
+	0, 0,
+	0xc631f54cu, 0x000d0003u, /* /stations.csv */
+	0, 0,
+	0x2e0cb3a6u, 0x00010001u, /* / */
+	0, 0,
+};
+
+const URLRouteTable router_table = {
+	router_urls,
+	router_slots,
+	0x00000004u, /* seed */
+	7, /* mask */
+	5, /* routes */
+	NULL /* no dynamic routes */
+};
@@ -0,0 +1,48 @@
+/* Lock-free single-producer/single-consumer ring of pointers.
+ *
+ * One thread pushes and one other thread pops; neither ever blocks or
+ * takes a lock. head is only written by the producer and tail only by the
+ * consumer, each published with a release store that the other side reads
+ * with an acquire load, so a slot is always filled before it can be seen.
+ * Both counters run freely and wrap; the ring size is a power of two. */
+
+#ifndef _SPSC_RING_H
+#define _SPSC_RING_H
+#include <stdint.h>
+
+#define SPSC_RING_LEN	8	/* slots, a power of two */
+
+struct spsc_ring {
+	uint32_t head;		/* next slot to fill, producer only */
+	uint32_t tail;		/* next slot to empty, consumer only */
+	void *slots[SPSC_RING_LEN];
+};
+
+/* Returns 0 if the ring is full */
+static inline int
+spsc_ring_push(struct spsc_ring *r, void *item)
+{
+	uint32_t head = r->head;
+
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == SPSC_RING_LEN)
+		return 0;
+	r->slots[head & (SPSC_RING_LEN - 1)] = item;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/* Returns NULL if the ring is empty */
+static inline void *
+spsc_ring_pop(struct spsc_ring *r)
+{
+	uint32_t tail = r->tail;
+	void *item;
+
+	if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+		return NULL;
+	item = r->slots[tail & (SPSC_RING_LEN - 1)];
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return item;
+}
+
+#endif
@@ -0,0 +1,12 @@
+/*
+ * Sizes of the per-connection state, read back with nm by 'make
+ * size-report' in host/. Never linked into the server.
+ */
+
+#include "../httpd_state.h"
+
+const char httpd_size_state[sizeof(struct http_state)];
+#if LWIP_HTTPD_SUPPORT_POST
+const char httpd_size_post[sizeof(struct http_post_state)];
+#endif
+const char httpd_size_conns[LWIP_HTTPD_MAX_CONNS];
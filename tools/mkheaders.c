@@ -0,0 +1,320 @@
+/*
+ * mkheaders: build-time generator for the HTTP response headers.
+ *
+ * Reads the status lines and content types (headers.def) and writes a C
+ * file with:
+ * - one header block per status, HTTP version and connection mode, from
+ *   the status line to the Connection header, so that a response header
+ *   is one copy of a block, the framing (Content-Length or chunked) and
+ *   one content type,
+ * - the content type lines, each ending the header with a blank line,
+ * - a collision-free hash over the file extensions, so that finding the
+ *   content type of a URI costs one hash, one length check and at most
+ *   one string compare.
+ *
+ * Usage: mkheaders headers.def > http_headers.c
+ *
+ * headers.def holds one entry per line:
+ *   status <code> <reason phrase>
+ *   type <content-type> <extension>...
+ * where the extension "*" makes a type the default for extensions that are
+ * not listed and "-" the one for URIs without an extension.
+ * Empty lines and lines starting with '#' are ignored.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../router_hash.h"
+
+#define MAX_STATUS      32
+#define MAX_TYPES       64
+#define MAX_EXTS        256
+#define MAX_EXT_LEN     16
+#define MAX_TEXT_LEN    96
+#define MAX_SLOTS       4096
+#define MAX_SEED_TRIES  200000
+
+/* Content-Length digits of a u32_t */
+#define MAX_DIGITS      10
+
+/* The framing lines, as C source */
+#define CONTENT_LENGTH  "Content-Length: "
+#define CHUNKED         "Transfer-Encoding: chunked\\r\\n"
+/* the longer of the Content-Length line (digits and CRLF) and CHUNKED */
+#define LONGEST_FRAMING \
+	((sizeof(CONTENT_LENGTH) - 1 + MAX_DIGITS + 2 > sizeof("Transfer-Encoding: chunked\r\n") - 1) ? \
+	 (sizeof(CONTENT_LENGTH) - 1 + MAX_DIGITS + 2) : (sizeof("Transfer-Encoding: chunked\r\n") - 1))
+
+/* Keep in sync with the generated strings below */
+static const char *conn_names[] = { "Close", "keep-alive" };
+
+struct status {
+	unsigned code;
+	char reason[MAX_TEXT_LEN];
+};
+
+struct ext {
+	char name[MAX_EXT_LEN];
+	uint32_t len;
+	int type;
+};
+
+static struct status statuses[MAX_STATUS];
+static int num_statuses;
+static char types[MAX_TYPES][MAX_TEXT_LEN];
+static int num_types;
+static struct ext exts[MAX_EXTS];
+static int num_exts;
+static int type_default = -1;
+static int type_noext = -1;
+static uint16_t slot_ext[MAX_SLOTS];
+
+static int
+add_ext(const char *path, int lineno, const char *name, int type)
+{
+	int i;
+
+	if (strcmp(name, "*") == 0 || strcmp(name, "-") == 0) {
+		int *t = (name[0] == '*') ? &type_default : &type_noext;
+		if (*t >= 0) {
+			fprintf(stderr, "%s:%d: second type for \"%s\"\n", path, lineno, name);
+			return -1;
+		}
+		*t = type;
+		return 0;
+	}
+	if (strlen(name) >= MAX_EXT_LEN || strpbrk(name, ".\"\\") != NULL) {
+		fprintf(stderr, "%s:%d: bad extension %s\n", path, lineno, name);
+		return -1;
+	}
+	for (i = 0; i < num_exts; i++) {
+		if (strcmp(exts[i].name, name) == 0) {
+			fprintf(stderr, "%s:%d: duplicate extension %s\n", path, lineno, name);
+			return -1;
+		}
+	}
+	if (num_exts == MAX_EXTS) {
+		fprintf(stderr, "%s:%d: too many extensions\n", path, lineno);
+		return -1;
+	}
+	strcpy(exts[num_exts].name, name);
+	exts[num_exts].len = (uint32_t)strlen(name);
+	exts[num_exts].type = type;
+	num_exts++;
+	return 0;
+}
+
+static int
+read_headers(const char *path)
+{
+	char line[512];
+	int lineno = 0;
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *w, *rest, *save, *end;
+		int i;
+
+		lineno++;
+		w = strtok_r(line, " \t\r\n", &save);
+		if (w == NULL || w[0] == '#')
+			continue;
+		if (strcmp(w, "status") == 0) {
+			struct status *s = &statuses[num_statuses];
+			w = strtok_r(NULL, " \t\r\n", &save);
+			rest = strtok_r(NULL, "\r\n", &save);
+			if (w == NULL || rest == NULL || (s->code = strtoul(w, &end, 10)) < 100 ||
+			    s->code > 999 || *end != '\0' || strlen(rest) >= MAX_TEXT_LEN ||
+			    strpbrk(rest, "\"\\") != NULL) {
+				fprintf(stderr, "%s:%d: expected \"status <code> <reason>\"\n", path, lineno);
+				goto err;
+			}
+			for (i = 0; i < num_statuses; i++) {
+				if (statuses[i].code == s->code) {
+					fprintf(stderr, "%s:%d: duplicate status %u\n", path, lineno, s->code);
+					goto err;
+				}
+			}
+			if (num_statuses == MAX_STATUS) {
+				fprintf(stderr, "%s:%d: too many statuses\n", path, lineno);
+				goto err;
+			}
+			strcpy(s->reason, rest + strspn(rest, " \t"));
+			num_statuses++;
+		} else if (strcmp(w, "type") == 0) {
+			w = strtok_r(NULL, " \t\r\n", &save);
+			if (w == NULL || strlen(w) >= MAX_TEXT_LEN || strpbrk(w, "\"\\") != NULL ||
+			    num_types == MAX_TYPES) {
+				fprintf(stderr, "%s:%d: expected \"type <content-type> <extension>...\"\n",
+					path, lineno);
+				goto err;
+			}
+			strcpy(types[num_types], w);
+			while ((w = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+				if (add_ext(path, lineno, w, num_types) != 0)
+					goto err;
+			}
+			num_types++;
+		} else {
+			fprintf(stderr, "%s:%d: unknown entry %s\n", path, lineno, w);
+			goto err;
+		}
+	}
+	fclose(f);
+	return 0;
+err:
+	fclose(f);
+	return -1;
+}
+
+/* ---------------------------------------------------------------- hash */
+
+/* Returns 1 if 'seed' maps every extension to its own slot */
+static int
+try_seed(uint32_t seed, uint32_t mask)
+{
+	int i;
+
+	memset(slot_ext, 0, sizeof(slot_ext));
+	for (i = 0; i < num_exts; i++) {
+		uint32_t slot = router_hash(exts[i].name, exts[i].len, seed) & mask;
+		if (slot_ext[slot] != 0)
+			return 0;
+		slot_ext[slot] = (uint16_t)(i + 1);
+	}
+	return 1;
+}
+
+static int
+find_seed(uint32_t *seed, uint32_t *size)
+{
+	uint32_t s, n;
+
+	for (n = 1; n < (uint32_t)num_exts; n <<= 1)
+		;
+	for (; n <= MAX_SLOTS; n <<= 1) {
+		for (s = 0; s < MAX_SEED_TRIES; s++) {
+			if (try_seed(s, n - 1)) {
+				*seed = s;
+				*size = n;
+				return 0;
+			}
+		}
+	}
+	return -1;
+}
+
+/* ---------------------------------------------------------------- output */
+
+static void
+emit(const char *def, uint32_t seed, uint32_t size)
+{
+	uint32_t slot;
+	size_t len, longest_type = 0;
+	int s, v, c, t, longest = 0;
+
+	printf("/* Generated by tools/mkheaders from %s, do not edit. */\n\n", def);
+	printf("#include \"esp_common.h\"\n");
+	printf("#include \"http_headers.h\"\n\n");
+	printf("#define HDR(s)\t{ s, sizeof(s) - 1 }\n");
+	printf("#define SERVER\t\"Server: \" HTTPD_SERVER_AGENT \"\\r\\n\"\n\n");
+
+	printf("static const uint32_t http_hdr_codes[] ICACHE_RODATA_ATTR = {\n\t");
+	for (s = 0; s < num_statuses; s++)
+		printf("%u%s", statuses[s].code, (s + 1 < num_statuses) ? ", " : "\n");
+	printf("};\n\n");
+
+	printf("/* [status][HTTP/1.1][keep-alive], each up to the framing */\n");
+	printf("static const HTTPHdrString http_hdr_blocks[] ICACHE_RODATA_ATTR = {\n");
+	for (s = 0; s < num_statuses; s++) {
+		/* the server name is the same in every block */
+		if (strlen(statuses[s].reason) > strlen(statuses[longest].reason))
+			longest = s;
+		for (v = 0; v < 2; v++) {
+			for (c = 0; c < 2; c++) {
+				printf("\tHDR(\"HTTP/1.%d %u %s\\r\\n\" SERVER \"Connection: %s\\r\\n\"),\n",
+				       v, statuses[s].code, statuses[s].reason, conn_names[c]);
+			}
+		}
+	}
+	printf("};\n\n");
+
+	printf("/* the content type and the blank line */\n");
+	printf("static const HTTPHdrString http_hdr_types[] ICACHE_RODATA_ATTR = {\n");
+	for (t = 0; t < num_types; t++) {
+		len = strlen("Content-type: \r\n\r\n") + strlen(types[t]);
+		if (len > longest_type)
+			longest_type = len;
+		printf("\tHDR(\"Content-type: %s\\r\\n\\r\\n\"),\n", types[t]);
+	}
+	printf("};\n\n");
+
+	printf("/* slot = router_hash(ext, len, seed) & mask: {hash, len << 16 | type + 1} */\n");
+	printf("static const uint32_t http_hdr_slots[] ICACHE_RODATA_ATTR = {\n");
+	for (slot = 0; slot < size; slot++) {
+		const struct ext *e;
+		if (slot_ext[slot] == 0) {
+			printf("\t0, 0,\n");
+			continue;
+		}
+		e = &exts[slot_ext[slot] - 1];
+		printf("\t0x%08xu, 0x%08xu, /* %s: %s */\n", router_hash(e->name, e->len, seed),
+		       (e->len << 16) | (uint32_t)(e->type + 1), e->name, types[e->type]);
+	}
+	printf("};\n\n");
+
+	printf("static const char *const http_hdr_exts[] ICACHE_RODATA_ATTR = {\n");
+	for (slot = 0; slot < size; slot++) {
+		if (slot_ext[slot] == 0)
+			printf("\tNULL,\n");
+		else
+			printf("\t\"%s\",\n", exts[slot_ext[slot] - 1].name);
+	}
+	printf("};\n\n");
+
+	printf("const HTTPHdrTable http_hdr_table = {\n");
+	printf("\thttp_hdr_codes,\n\t%d, /* statuses */\n", num_statuses);
+	printf("\thttp_hdr_blocks,\n\thttp_hdr_types,\n\thttp_hdr_slots,\n\thttp_hdr_exts,\n");
+	printf("\t0x%08xu, /* seed */\n\t%u, /* mask */\n", seed, size - 1);
+	printf("\t%d, /* other extensions: %s */\n", type_default, types[type_default]);
+	printf("\t%d, /* no extension: %s */\n", type_noext, types[type_noext]);
+	printf("\tHDR(\"%s\"),\n", CONTENT_LENGTH);
+	printf("\tHDR(\"%s\"),\n", CHUNKED);
+	printf("\tsizeof(\"HTTP/1.1 %u %s\\r\\n\" SERVER \"Connection: %s\\r\\n\") - 1 +\n"
+	       "\t\t%u + %u /* longest header */\n", statuses[longest].code,
+	       statuses[longest].reason, conn_names[1],
+	       (unsigned)LONGEST_FRAMING, (unsigned)longest_type);
+	printf("};\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	uint32_t seed, size;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s headers.def\n", argv[0]);
+		return 2;
+	}
+	if (read_headers(argv[1]) != 0)
+		return 1;
+	if (num_statuses == 0 || type_default < 0) {
+		fprintf(stderr, "%s: needs a status and a default (\"*\") type\n", argv[1]);
+		return 1;
+	}
+	if (type_noext < 0)
+		type_noext = type_default;
+	if (find_seed(&seed, &size) != 0) {
+		fprintf(stderr, "%s: no collision-free seed found\n", argv[1]);
+		return 1;
+	}
+	/* leave slot_ext filled for the winning seed */
+	try_seed(seed, size - 1);
+	emit(argv[1], seed, size);
+	return 0;
+}
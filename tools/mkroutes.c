@@ -0,0 +1,635 @@
+/*
+ * mkroutes: build-time generator for the URL routing table.
+ *
+ * Reads the route definitions (routes.def) and writes a C file with:
+ * - the URLRouter table, one entry per URL pattern with a handler slot
+ *   per HTTP method,
+ * - a collision-free hash over the static URLs, so that an exact match
+ *   costs one hash, one length check and at most one string compare,
+ * - a compressed radix trie over the URLs with path parameters (":name",
+ *   one segment) or a trailing prefix wildcard ("*"), so that lookups do
+ *   not grow with the number of routes sharing a prefix.
+ *
+ * Usage: mkroutes [-n name] routes.def > routes.c
+ *   -n name   prefix of the generated symbols (default "router")
+ *
+ * routes.def holds one route per line: "[method] <url> <handler> [options]",
+ * where method is GET, POST, PUT, DELETE or ANY (the default). Options:
+ *   v2        handler is an http_handler (writes into a server buffer and
+ *             returns the length) rather than a legacy router_handler
+ *   stream    handler is an http_stream_handler, generating the response
+ *             a window at a time
+ *   buf=N     expected response size of a v2 handler, or the size of the
+ *             first window of a stream handler
+ *   body=fn   stream the request body to fn (an http_body_handler)
+ *             instead of buffering it into req->post_data
+ *   multipart=fn  parse a multipart/form-data body as it arrives and
+ *             pass its parts to fn (an http_part_handler); other bodies
+ *             are refused (415)
+ *   manual_wnd  fn reopens the TCP window with httpd_post_data_recved()
+ *   max_body=N  refuse bodies of more than N bytes (413) before they
+ *             arrive
+ *   accept=fn decide on a request from its head, before its body arrives
+ *             (fn is an http_accept_handler)
+ *   worker    run the (v2 or legacy) handler in a worker task rather than
+ *             in the tcpip thread, when the server has workers
+ * Empty lines and lines starting with '#' are ignored.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../router_hash.h"
+
+#define MAX_ROUTES      1024
+#define MAX_NODES       (4 * MAX_ROUTES)
+#define MAX_CHILDREN    64
+#define MAX_URL_LEN     128
+#define MAX_NAME_LEN    64
+#define MAX_SLOTS       8192
+#define MAX_SEED_TRIES  200000
+
+/* Keep in sync with http_request.h and api_struct.h */
+static const char *method_names[] = { "GET", "POST", "PUT", "DELETE" };
+#define NUM_METHODS     4
+
+#define NODE_STATIC     0
+#define NODE_PARAM      1
+#define NODE_WILDCARD   2
+
+struct handler {
+	char name[MAX_NAME_LEN];
+	char body[MAX_NAME_LEN];
+	char part[MAX_NAME_LEN];
+	char accept[MAX_NAME_LEN];
+	int v2;
+	int stream;
+	int manual_wnd;
+	int worker;
+	unsigned long buf_size;
+	unsigned long max_body;
+};
+
+/* Kinds of functions referenced by the table, each with its prototype */
+#define SYM_LEGACY      0
+#define SYM_HANDLER     1
+#define SYM_BODY        2
+#define SYM_STREAM      3
+#define SYM_ACCEPT      4
+#define SYM_PART        5
+
+static const char *sym_protos[] = {
+	"extern const char* %s(HTTPRequest *, void*);\n",
+	"extern int %s(HTTPRequest *, char *, int, void *);\n",
+	"extern int %s(HTTPRequest *, const char *, int, void *);\n",
+	"extern int %s(HTTPRequest *, char *, int, uint32_t *, void *);\n",
+	"extern int %s(HTTPRequest *, void *);\n",
+	"extern int %s(HTTPRequest *, int, HTTPPart *, const char *, int, void *);\n",
+};
+
+struct symbol {
+	char name[MAX_NAME_LEN];
+	int kind;
+};
+
+struct route {
+	char url[MAX_URL_LEN];
+	struct handler handler[NUM_METHODS];
+	uint32_t len;
+	int dynamic;
+};
+
+struct node {
+	char label[MAX_URL_LEN];
+	int type;
+	int route;                      /* index into routes[] or -1 */
+	int children[MAX_CHILDREN];
+	int num_children;
+	int index;                      /* position in the emitted array */
+};
+
+static struct route routes[MAX_ROUTES];
+static int num_routes;
+static struct node nodes[MAX_NODES];
+static int num_nodes;
+static uint16_t slot_route[MAX_SLOTS];
+static struct symbol symbols[3 * MAX_ROUTES * NUM_METHODS];
+static int num_symbols;
+
+static int
+find_route(const char *url)
+{
+	int i;
+	for (i = 0; i < num_routes; i++) {
+		if (strcmp(routes[i].url, url) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/* Checks the ":param" and "*" syntax; returns 1 for a dynamic pattern,
+ * 0 for a static one and -1 on error */
+static int
+check_pattern(const char *url)
+{
+	const char *p;
+	int dynamic = 0;
+
+	for (p = url; *p; p++) {
+		if (*p == ':' && p[-1] == '/') {
+			if (p[1] == '/' || p[1] == '\0')
+				return -1;
+			dynamic = 1;
+		} else if (*p == '*') {
+			if (p[-1] != '/' || p[1] != '\0')
+				return -1;
+			dynamic = 1;
+		}
+	}
+	return dynamic;
+}
+
+/* Records a function for its extern declaration; returns -1 if it was
+   already used with another signature */
+static int
+add_symbol(const char *name, int kind)
+{
+	int i;
+	for (i = 0; i < num_symbols; i++) {
+		if (strcmp(symbols[i].name, name) == 0)
+			return (symbols[i].kind == kind) ? 0 : -1;
+	}
+	strcpy(symbols[num_symbols].name, name);
+	symbols[num_symbols].kind = kind;
+	num_symbols++;
+	return 0;
+}
+
+static int
+read_routes(const char *path)
+{
+	char line[512];
+	int lineno = 0;
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *w[8], *url, *save;
+		struct handler h;
+		int n, i, m, first, last, r, dynamic;
+
+		lineno++;
+		for (n = 0; n < 8; n++) {
+			w[n] = strtok_r(n ? NULL : line, " \t\r\n", &save);
+			if (w[n] == NULL)
+				break;
+		}
+		if (n == 0 || w[0][0] == '#')
+			continue;
+		/* the method is optional, URLs always start with a slash */
+		i = (w[0][0] == '/') ? 0 : 1;
+		first = 0;
+		last = NUM_METHODS - 1;
+		if (i == 1 && strcmp(w[0], "ANY") != 0) {
+			for (m = 0; m < NUM_METHODS; m++) {
+				if (strcmp(w[0], method_names[m]) == 0)
+					break;
+			}
+			if (m == NUM_METHODS) {
+				fprintf(stderr, "%s:%d: unknown method %s\n", path, lineno, w[0]);
+				goto err;
+			}
+			first = last = m;
+		}
+		if (n < i + 2 || strlen(w[i]) >= MAX_URL_LEN || strlen(w[i + 1]) >= MAX_NAME_LEN ||
+		    (dynamic = (w[i][0] == '/') ? check_pattern(w[i]) : -1) < 0) {
+			fprintf(stderr, "%s:%d: expected \"[method] <url> <handler> [options]\"\n",
+				path, lineno);
+			goto err;
+		}
+		url = w[i];
+		memset(&h, 0, sizeof(h));
+		strcpy(h.name, w[i + 1]);
+		for (i += 2; i < n; i++) {
+			char *end;
+			if (strcmp(w[i], "v2") == 0) {
+				h.v2 = 1;
+			} else if (strcmp(w[i], "stream") == 0) {
+				h.stream = 1;
+			} else if (strncmp(w[i], "buf=", 4) == 0 &&
+				   (h.buf_size = strtoul(w[i] + 4, &end, 0)) != 0 && *end == '\0') {
+				/* size hint taken */
+			} else if (strncmp(w[i], "body=", 5) == 0 && w[i][5] != '\0' &&
+				   strlen(w[i] + 5) < MAX_NAME_LEN) {
+				strcpy(h.body, w[i] + 5);
+			} else if (strncmp(w[i], "multipart=", 10) == 0 && w[i][10] != '\0' &&
+				   strlen(w[i] + 10) < MAX_NAME_LEN) {
+				strcpy(h.part, w[i] + 10);
+			} else if (strncmp(w[i], "accept=", 7) == 0 && w[i][7] != '\0' &&
+				   strlen(w[i] + 7) < MAX_NAME_LEN) {
+				strcpy(h.accept, w[i] + 7);
+			} else if (strncmp(w[i], "max_body=", 9) == 0 &&
+				   (h.max_body = strtoul(w[i] + 9, &end, 0)) != 0 && *end == '\0') {
+				/* limit taken */
+			} else if (strcmp(w[i], "manual_wnd") == 0) {
+				h.manual_wnd = 1;
+			} else if (strcmp(w[i], "worker") == 0) {
+				h.worker = 1;
+			} else {
+				fprintf(stderr, "%s:%d: bad option %s\n", path, lineno, w[i]);
+				goto err;
+			}
+		}
+		if (h.v2 && h.stream) {
+			fprintf(stderr, "%s:%d: v2 and stream exclude each other\n", path, lineno);
+			goto err;
+		}
+		if (h.buf_size != 0 && !h.v2 && !h.stream) {
+			fprintf(stderr, "%s:%d: buf= needs a v2 or stream handler\n", path, lineno);
+			goto err;
+		}
+		if (h.worker && h.stream) {
+			fprintf(stderr, "%s:%d: stream handlers cannot run in a worker\n", path, lineno);
+			goto err;
+		}
+		if (h.body[0] != '\0' && h.part[0] != '\0') {
+			fprintf(stderr, "%s:%d: body= and multipart= exclude each other\n", path, lineno);
+			goto err;
+		}
+		if (h.manual_wnd && h.body[0] == '\0') {
+			fprintf(stderr, "%s:%d: manual_wnd needs a body handler\n", path, lineno);
+			goto err;
+		}
+		if (add_symbol(h.name, h.v2 ? SYM_HANDLER : (h.stream ? SYM_STREAM : SYM_LEGACY)) != 0 ||
+		    (h.body[0] != '\0' && add_symbol(h.body, SYM_BODY) != 0) ||
+		    (h.part[0] != '\0' && add_symbol(h.part, SYM_PART) != 0) ||
+		    (h.accept[0] != '\0' && add_symbol(h.accept, SYM_ACCEPT) != 0)) {
+			fprintf(stderr, "%s:%d: function used with two different signatures\n", path, lineno);
+			goto err;
+		}
+		r = find_route(url);
+		if (r < 0) {
+			if (num_routes == MAX_ROUTES) {
+				fprintf(stderr, "%s:%d: too many routes\n", path, lineno);
+				goto err;
+			}
+			r = num_routes++;
+			strcpy(routes[r].url, url);
+			routes[r].len = (uint32_t)strlen(url);
+			routes[r].dynamic = dynamic;
+		}
+		for (m = first; m <= last; m++) {
+			if (routes[r].handler[m].name[0] != '\0') {
+				fprintf(stderr, "%s:%d: duplicate %s %s\n", path, lineno, method_names[m], url);
+				goto err;
+			}
+			routes[r].handler[m] = h;
+		}
+	}
+	fclose(f);
+	return 0;
+err:
+	fclose(f);
+	return -1;
+}
+
+/* ---------------------------------------------------------------- hash */
+
+/* Returns 1 if 'seed' maps every static route to its own slot */
+static int
+try_seed(uint32_t seed, uint32_t mask)
+{
+	int i;
+
+	memset(slot_route, 0, sizeof(slot_route));
+	for (i = 0; i < num_routes; i++) {
+		uint32_t slot;
+		if (routes[i].dynamic)
+			continue;
+		slot = router_hash(routes[i].url, routes[i].len, seed) & mask;
+		if (slot_route[slot] != 0)
+			return 0;
+		slot_route[slot] = (uint16_t)(i + 1);
+	}
+	return 1;
+}
+
+static int
+find_seed(uint32_t *seed, uint32_t *size)
+{
+	uint32_t s, n;
+	int i, num_static = 0;
+
+	for (i = 0; i < num_routes; i++)
+		num_static += !routes[i].dynamic;
+	for (n = 1; n < (uint32_t)num_static; n <<= 1)
+		;
+	for (; n <= MAX_SLOTS; n <<= 1) {
+		for (s = 0; s < MAX_SEED_TRIES; s++) {
+			if (try_seed(s, n - 1)) {
+				*seed = s;
+				*size = n;
+				return 0;
+			}
+		}
+	}
+	return -1;
+}
+
+/* ---------------------------------------------------------------- trie */
+
+static int
+new_node(int type, const char *label, size_t len)
+{
+	struct node *n;
+
+	if (num_nodes == MAX_NODES) {
+		fprintf(stderr, "mkroutes: too many trie nodes\n");
+		exit(1);
+	}
+	n = &nodes[num_nodes];
+	memset(n, 0, sizeof(*n));
+	memcpy(n->label, label, len);
+	n->label[len] = '\0';
+	n->type = type;
+	n->route = -1;
+	return num_nodes++;
+}
+
+static void
+add_child(int parent, int child)
+{
+	if (nodes[parent].num_children == MAX_CHILDREN) {
+		fprintf(stderr, "mkroutes: too many children below \"%s\"\n", nodes[parent].label);
+		exit(1);
+	}
+	nodes[parent].children[nodes[parent].num_children++] = child;
+}
+
+/* Insert the static text [s, s + len) below 'at', splitting edges on the
+ * common prefix; returns the node where the text ends */
+static int
+insert_static(int at, const char *s, size_t len)
+{
+	while (len > 0) {
+		int i, found = -1;
+		size_t common = 0;
+
+		for (i = 0; i < nodes[at].num_children; i++) {
+			struct node *c = &nodes[nodes[at].children[i]];
+			if (c->type == NODE_STATIC && c->label[0] == s[0]) {
+				found = nodes[at].children[i];
+				break;
+			}
+		}
+		if (found < 0) {
+			int n = new_node(NODE_STATIC, s, len);
+			add_child(at, n);
+			return n;
+		}
+		while (common < len && nodes[found].label[common] == s[common])
+			common++;
+		if (nodes[found].label[common] != '\0') {
+			/* split: 'found' keeps the tail below a new prefix node */
+			int split = new_node(NODE_STATIC, s, common);
+			struct node *f = &nodes[found];
+			memmove(f->label, f->label + common, strlen(f->label + common) + 1);
+			nodes[at].children[i] = split;
+			add_child(split, found);
+			found = split;
+		}
+		at = found;
+		s += common;
+		len -= common;
+	}
+	return at;
+}
+
+static int
+insert_special(int at, int type)
+{
+	int i;
+	for (i = 0; i < nodes[at].num_children; i++) {
+		if (nodes[nodes[at].children[i]].type == type)
+			return nodes[at].children[i];
+	}
+	i = new_node(type, "", 0);
+	add_child(at, i);
+	return i;
+}
+
+static void
+insert_route(int root, int r)
+{
+	const char *p = routes[r].url;
+	int at = root;
+
+	while (*p) {
+		const char *q = p;
+		if (*p == ':') {
+			while (*q && *q != '/')
+				q++;
+			at = insert_special(at, NODE_PARAM);
+		} else if (*p == '*') {
+			q++;
+			at = insert_special(at, NODE_WILDCARD);
+		} else {
+			while (*q && !(*q == ':' && q[-1] == '/') && *q != '*')
+				q++;
+			at = insert_static(at, p, (size_t)(q - p));
+		}
+		p = q;
+	}
+	nodes[at].route = r;
+}
+
+static int
+child_order(const void *a, const void *b)
+{
+	const struct node *x = &nodes[*(const int *)a], *y = &nodes[*(const int *)b];
+	if (x->type != y->type)
+		return x->type - y->type;
+	return (unsigned char)x->label[0] - (unsigned char)y->label[0];
+}
+
+/* ---------------------------------------------------------------- output */
+
+static void
+c_string(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			putchar('\\');
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+/* Route patterns may end in a slash and a star, which must not open a
+ * comment in the generated file */
+static void
+c_comment(const char *s)
+{
+	printf(" /* ");
+	for (; *s; s++) {
+		putchar(*s);
+		if (*s == '/' && s[1] == '*')
+			putchar(' ');
+	}
+	printf(" */");
+}
+
+static void
+emit_trie(const char *name, int root)
+{
+	int order[MAX_NODES], head = 0, tail = 0, i;
+
+	/* breadth first, so that the children of a node are contiguous */
+	order[tail++] = root;
+	while (head < tail) {
+		struct node *n = &nodes[order[head]];
+		n->index = head++;
+		qsort(n->children, n->num_children, sizeof(int), child_order);
+		for (i = 0; i < n->num_children; i++)
+			order[tail++] = n->children[i];
+	}
+
+	printf("/* {label, label length, type, first child, children, route + 1} */\n");
+	printf("static const URLRouteNode %s_nodes[] ICACHE_RODATA_ATTR = {\n", name);
+	for (i = 0; i < tail; i++) {
+		struct node *n = &nodes[order[i]];
+		int first = n->num_children ? nodes[n->children[0]].index : 0;
+		static const char *types[] = { "ROUTE_NODE_STATIC", "ROUTE_NODE_PARAM", "ROUTE_NODE_WILDCARD" };
+		printf("\t{");
+		c_string(n->label);
+		printf(", %u, %s, %d, %d, %d},", (unsigned)strlen(n->label), types[n->type],
+		       first, n->num_children, n->route + 1);
+		if (n->route >= 0)
+			c_comment(routes[n->route].url);
+		printf("\n");
+	}
+	printf("};\n\n");
+}
+
+static void
+emit(const char *name, const char *def, uint32_t seed, uint32_t size, int root)
+{
+	uint32_t slot;
+	int i, r, m, has_dynamic = 0;
+
+	printf("/* Generated by tools/mkroutes from %s, do not edit. */\n\n", def);
+	printf("#include \"esp_common.h\"\n");
+	printf("#include \"api.h\"\n\n");
+	for (i = 0; i < num_symbols; i++)
+		printf(sym_protos[symbols[i].kind], symbols[i].name);
+	for (r = 0; r < num_routes; r++)
+		has_dynamic |= routes[r].dynamic;
+
+	printf("\n/* {url, {GET, POST, PUT, DELETE}}, each a RouteMethod by field name */\n");
+	printf("static const URLRouter %s_urls[] ICACHE_RODATA_ATTR = {\n", name);
+	for (r = 0; r < num_routes; r++) {
+		printf("\t{");
+		c_string(routes[r].url);
+		printf(", {");
+		for (m = 0; m < NUM_METHODS; m++) {
+			const struct handler *h = &routes[r].handler[m];
+			printf("%s", m ? ", " : "");
+			if (h->name[0] == '\0') {
+				printf("{0}");
+				continue;
+			}
+			printf("{.%s = %s", h->v2 ? "handler" : (h->stream ? "stream" : "legacy"), h->name);
+			if (h->body[0] != '\0')
+				printf(", .body = %s", h->body);
+			if (h->part[0] != '\0')
+				printf(", .part = %s", h->part);
+			if (h->accept[0] != '\0')
+				printf(", .accept = %s", h->accept);
+			if (h->buf_size != 0)
+				printf(", .buf_size = %lu", h->buf_size);
+			if (h->max_body != 0)
+				printf(", .max_body = %lu", h->max_body);
+			if (h->manual_wnd || h->worker)
+				printf(", .flags = %s",
+				       (h->manual_wnd && h->worker) ? "ROUTE_MANUAL_WND | ROUTE_WORKER" :
+				       h->manual_wnd ? "ROUTE_MANUAL_WND" : "ROUTE_WORKER");
+			printf("}");
+		}
+		printf("}},\n");
+	}
+	printf("};\n\n");
+
+	printf("/* slot = router_hash(url, len, seed) & mask: {hash, len << 16 | route + 1} */\n");
+	printf("static const uint32_t %s_slots[] ICACHE_RODATA_ATTR = {\n", name);
+	for (slot = 0; slot < size; slot++) {
+		r = slot_route[slot];
+		if (r == 0) {
+			printf("\t0, 0,\n");
+		} else {
+			const struct route *rt = &routes[r - 1];
+			printf("\t0x%08xu, 0x%08xu,", router_hash(rt->url, rt->len, seed),
+			       (rt->len << 16) | (uint32_t)r);
+			c_comment(rt->url);
+			printf("\n");
+		}
+	}
+	printf("};\n\n");
+
+	if (has_dynamic)
+		emit_trie(name, root);
+
+	printf("const URLRouteTable %s_table = {\n", name);
+	printf("\t%s_urls,\n\t%s_slots,\n\t0x%08xu, /* seed */\n\t%u, /* mask */\n\t%d, /* routes */\n",
+	       name, name, seed, size - 1, num_routes);
+	if (has_dynamic)
+		printf("\t%s_nodes\n", name);
+	else
+		printf("\tNULL /* no dynamic routes */\n");
+	printf("};\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *name = "router";
+	uint32_t seed, size;
+	int opt, r, root;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		if (opt == 'n') {
+			name = optarg;
+		} else {
+			fprintf(stderr, "usage: %s [-n name] routes.def\n", argv[0]);
+			return 2;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-n name] routes.def\n", argv[0]);
+		return 2;
+	}
+	if (read_routes(argv[optind]) != 0)
+		return 1;
+	if (num_routes == 0) {
+		fprintf(stderr, "%s: no routes\n", argv[optind]);
+		return 1;
+	}
+	if (find_seed(&seed, &size) != 0) {
+		fprintf(stderr, "%s: no collision-free seed found\n", argv[optind]);
+		return 1;
+	}
+	/* leave slot_route filled for the winning seed */
+	try_seed(seed, size - 1);
+
+	root = new_node(NODE_STATIC, "", 0);
+	for (r = 0; r < num_routes; r++) {
+		if (routes[r].dynamic)
+			insert_route(root, r);
+	}
+	emit(name, argv[optind], seed, size, root);
+	return 0;
+}